@@ -38,10 +38,14 @@
  *  Adapted imports and function calls to avoid building the whole thing
  *  Removed main
  *
+ * Opened files and their symbol tables are cached, so every file is only read once.
+ * Use load_file to fill the cache ahead of the first call to process_file.
+ *
  * Return codes:
  *      0: ok
  *      1: general error
  *      2: out of memory
+ *      3: a memory limit would be exceeded
  */
 
 #define PACKAGE "stacktrace-lib"
@@ -51,6 +55,8 @@
 #include <bfd.h>
 #include <stdio.h>
 #include <memory.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifndef __APPLE__
 #   include <libiberty/demangle.h>
@@ -65,6 +71,8 @@
 #define ERR_GENERAL 1
 // A allocation error (out of memory etc.)
 #define ERR_ALLOCATION 2
+// A memory limit would be exceeded
+#define ERR_LIMIT 3
 
 #define bfd_section_flags(section) section->flags
 
@@ -78,6 +86,8 @@
 
 static bfd_boolean unwind_inlines;    /* -i, unwind inlined functions. */
 static bfd_boolean do_demangle;        /* -C, demangle names.  */
+static bfd_boolean read_lines = TRUE;  /* Read the line tables, use the symbol table only if false. */
+static bfd_boolean collect_inlines;    /* Store the inlined functions found while unwinding. */
 
 /* Flags passed to the name demangler.  */
 static int demangle_flags = DMGL_PARAMS | DMGL_ANSI;
@@ -86,8 +96,29 @@ static int naddr;        /* Number of addresses to process.  */
 static const char **addr;        /* Hex addresses to process.  */
 
 static asymbol **syms;        /* Symbol table.  */
-
-static int slurp_symtab(bfd *);
+static asymbol **functions;        /* Function symbols, sorted by address.  */
+static long nfunctions;        /* Number of function symbols.  */
+
+static address_info *inlined;        /* Inlined functions found while unwinding.  */
+static int ninlined;        /* Number of inlined functions found.  */
+static int inlined_size;        /* Number of inlined functions which fit into inlined.  */
+
+/* A file opened by bfd, stored in the file cache */
+typedef struct addr2line_file_s {
+    dev_t dev;                  /* The device of the file */
+    ino_t ino;                  /* The inode of the file */
+    bfd *abfd;                  /* The opened file */
+    asymbol **syms;             /* The symbol table of the file */
+    asymbol **functions;        /* The function symbols of the file sorted by address, NULL if not indexed */
+    long nfunctions;            /* The number of function symbols */
+    unsigned long bytes;        /* The estimated memory used by the symbol and line tables */
+    int lines_loaded;           /* Whether the line tables were read */
+    struct addr2line_file_s *next; /* The next file in the cache */
+} cached_file;
+
+static cached_file *file_cache = NULL; /* All opened files */
+
+static int slurp_symtab(bfd *, unsigned long *);
 
 static void find_address_in_section(bfd *, asection *, void *);
 
@@ -95,9 +126,11 @@ static void find_offset_in_section(bfd *, asection *);
 
 static void translate_addresses(bfd *, asection *, address_info *);
 
+static void find_function_in_symtab(bfd *, asection *, address_info *);
+
 /* Read in the symbol table.  */
 
-static int slurp_symtab(bfd *abfd) {
+static int slurp_symtab(bfd *abfd, unsigned long *bytes) {
     long storage;
     long symcount;
     bfd_boolean dynamic = FALSE;
@@ -131,6 +164,8 @@ static int slurp_symtab(bfd *abfd) {
         symcount = bfd_canonicalize_dynamic_symtab(abfd, syms);
     }
 
+    *bytes = storage;
+
     /* PR 17512: file: 2a1d3b5b.
        Do not pretend that we have some symbols when we don't.  */
     if (symcount <= 0) {
@@ -195,6 +230,97 @@ static void find_offset_in_section(bfd *abfd, asection *section) {
                                                 &discriminator);
 }
 
+/* Copy a string into a fixed size buffer, truncating it if required.  */
+
+static void copy_string(char *dest, const char *src, size_t size) {
+    strncpy(dest, src, size - 1);
+    dest[size - 1] = '\0';
+}
+
+/* Append a copy of an address info to the inlined functions.  */
+
+static int add_inlined(const address_info *info) {
+    if (ninlined == inlined_size) {
+        int size = inlined_size == 0 ? 4 : inlined_size * 2;
+        address_info *tmp = realloc(inlined, size * sizeof(address_info));
+        if (!tmp) return ERR_ALLOCATION;
+
+        inlined = tmp;
+        inlined_size = size;
+    }
+
+    inlined[ninlined++] = *info;
+    return OK;
+}
+
+/* The start of bfd's elf_symbol_type, which is not part of the installed headers.
+   The symbols of ELF files are stored as elf_symbol_type, so this prefix is
+   used to read their size.  */
+
+typedef struct {
+    asymbol symbol;
+    struct {
+        bfd_vma st_value;
+        bfd_vma st_size;
+    } internal_elf_sym;
+} elf_symbol_prefix;
+
+/* Get the size of a symbol or 0 if it is unknown.  */
+
+static bfd_vma symbol_size(bfd *abfd, asymbol *sym) {
+    if (bfd_get_flavour(abfd) != bfd_target_elf_flavour) return 0;
+    return ((elf_symbol_prefix *) sym)->internal_elf_sym.st_size;
+}
+
+/* Compare two symbols by their address. Used to sort the function symbols.  */
+
+static int compare_symbols(const void *a, const void *b) {
+    bfd_vma va = bfd_asymbol_value(*(asymbol *const *) a);
+    bfd_vma vb = bfd_asymbol_value(*(asymbol *const *) b);
+
+    return va < vb ? -1 : va > vb;
+}
+
+/* Find the function containing pc using the symbol table only.
+   This does not read any line tables, so the file names and
+   the line are not set.  */
+
+static void find_function_in_symtab(bfd *abfd, asection *section, address_info *info) {
+    bfd_vma vma = section ? pc + bfd_section_vma(abfd, section) : pc;
+    long low = 0, high = nfunctions;
+    bfd_vma size;
+    char *alloc = NULL;
+    const char *name;
+
+    // Find the last function starting at or before vma
+    while (low < high) {
+        long mid = low + (high - low) / 2;
+        if (bfd_asymbol_value(functions[mid]) <= vma)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low == 0) return;
+
+    // An address past the end of the function is in a gap between functions.
+    // Symbols without a size, like some assembler functions, are trusted
+    size = symbol_size(abfd, functions[low - 1]);
+    if (size != 0 && vma - bfd_asymbol_value(functions[low - 1]) >= size) return;
+
+    name = functions[low - 1]->name;
+    if (name == NULL || *name == '\0') return;
+
+    if (do_demangle) {
+        alloc = bfd_demangle(abfd, name, demangle_flags);
+        if (alloc != NULL)
+            name = alloc;
+    }
+
+    copy_string(info->name, name, sizeof(info->name));
+    free(alloc);
+}
+
 /* Read hexadecimal addresses from stdin, translate into
    file_name:line_number and optionally function name.  */
 
@@ -217,6 +343,11 @@ static void translate_addresses(bfd *abfd, asection *section, address_info *info
         // Set function address
         info[naddr].address = pc;
 
+        if (!read_lines) {
+            find_function_in_symtab(abfd, section, info + naddr);
+            continue;
+        }
+
         found = FALSE;
         if (section)
             find_offset_in_section(abfd, section);
@@ -240,7 +371,7 @@ static void translate_addresses(bfd *abfd, asection *section, address_info *info
                     }
 
                     if (name != NULL) {
-                        strcpy(info[naddr].name, name);
+                        copy_string(info[naddr].name, name, sizeof(info[naddr].name));
                     }
 
                     free(alloc);
@@ -251,14 +382,14 @@ static void translate_addresses(bfd *abfd, asection *section, address_info *info
 
                 // Set file names
                 if (filename != NULL) {
-                    strcpy(info[naddr].filename, filename);
+                    copy_string(info[naddr].filename, filename, sizeof(info[naddr].filename));
 
                     char *h;
 
                     h = strrchr(filename, '/');
                     if (h != NULL) {
                         filename = h + 1;
-                        strcpy(info[naddr].basename, filename);
+                        copy_string(info[naddr].basename, filename, sizeof(info[naddr].basename));
                     }
                 }
 
@@ -266,6 +397,10 @@ static void translate_addresses(bfd *abfd, asection *section, address_info *info
                     found = FALSE;
                 else
                     found = bfd_find_inliner_info(abfd, &filename, &functionname, &line);
+
+                // The current function was inlined into the one found next, store it
+                if (found && collect_inlines && add_inlined(info + naddr) != OK)
+                    collect_inlines = FALSE;
             } while (found);
         }
     }
@@ -276,71 +411,99 @@ static void translate_addresses(bfd *abfd, asection *section, address_info *info
  * Source: https://stackoverflow.com/a/6039648/14148409
  *
  * @param file_name the name of the file
+ * @param stat_buf the stat struct to write the file information to
  * @return the size of the file
  */
-static long getFileSize(const char *file_name) {
-    struct stat stat_buf;
-    int rc = stat(file_name, &stat_buf);
-    return rc == 0 ? stat_buf.st_size : -1;
+static long getFileSize(const char *file_name, struct stat *stat_buf) {
+    int rc = stat(file_name, stat_buf);
+    return rc == 0 ? stat_buf->st_size : -1;
 }
 
 static int initialized = FALSE;
 
-/* Process a file.  Returns an exit value for main().  */
+/* Initialize bfd if not already initialized */
 
-addr2line_result
-process_file(const char *file_name, const char *section_name, const char *target, const char **_addr, int _naddr) {
-    bfd *abfd;
-    asection *section;
-    char **matching;
+static int init_bfd(const char **err_msg) {
+    if (initialized) return OK;
 
-    addr = _addr;
-    naddr = _naddr;
+    bfd_init();
 
-    addr2line_result res;
-    res.status = OK;
-    res.info = NULL;
-    res.err_msg = NULL;
+    if (!bfd_ok()) {
+        *err_msg = "bfd init failed";
+        return ERR_GENERAL;
+    }
 
-    // Init bfd if not already initialized
-    if (!initialized) {
-        bfd_init();
+    if (!bfd_set_default_target(TARGET)) {
+        *err_msg = "bfd_set_default_target failed";
+        return ERR_GENERAL;
+    }
 
-        if (!bfd_ok()) {
-            res.status = ERR_GENERAL;
-            res.err_msg = "bfd init failed";
+    initialized = TRUE;
+    return OK;
+}
 
-            return res;
-        }
+/* Add the size of a debug section to the size estimate passed as data.
+   This is called via bfd_map_over_sections.  */
 
-        if (!bfd_set_default_target(TARGET)) {
-            res.status = ERR_GENERAL;
-            res.err_msg = "bfd_set_default_target failed";
+static void add_debug_section_size(bfd *abfd, asection *section, void *data) {
+    if (strncmp(section->name, ".debug_", 7) == 0 || strncmp(section->name, ".zdebug_", 8) == 0) {
+        *(unsigned long *) data += bfd_section_size(abfd, section);
+    }
+}
 
-            return res;
-        }
+/* Read the line tables of the first code section. bfd reads
+   the debug information of the whole file on the first lookup.
+   This is called via bfd_map_over_sections.  */
 
-        initialized = TRUE;
-    }
+static void read_lines_in_section(bfd *abfd, asection *section, void *data) {
+    cached_file *file = (cached_file *) data;
+    const char *file_name, *function_name;
+    unsigned int line_nr, discriminator_nr;
 
-    if (getFileSize(file_name) < 1) {
-        res.status = ERR_GENERAL;
-        return res;
+    if (file->lines_loaded || (bfd_section_flags(section) & (unsigned) SEC_CODE) == 0)
+        return;
+
+    bfd_find_nearest_line_discriminator(abfd, section, file->syms, 0, &file_name, &function_name, &line_nr,
+                                        &discriminator_nr);
+    file->lines_loaded = TRUE;
+}
+
+/* Open a file or get it from the file cache. The file is only opened
+   if its estimated memory usage does not exceed max_bytes (if not 0).  */
+
+static int open_file(const char *file_name, const char *target, unsigned long max_bytes, cached_file **out,
+                     const char **err_msg) {
+    struct stat stat_buf;
+    cached_file *file;
+    bfd *abfd;
+    char **matching;
+    long storage;
+    unsigned long estimate = 0;
+
+    int stat = init_bfd(err_msg);
+    if (stat != OK) return stat;
+
+    if (getFileSize(file_name, &stat_buf) < 1) return ERR_GENERAL;
+
+    // Search the file in the cache. Files are identified by
+    // their inode, as the same file may be reached using different paths
+    for (file = file_cache; file != NULL; file = file->next) {
+        if (file->dev == stat_buf.st_dev && file->ino == stat_buf.st_ino) {
+            *out = file;
+            return OK;
+        }
     }
 
     abfd = bfd_openr(file_name, target);
-    if (abfd == NULL) {
-        res.status = ERR_GENERAL;
-        return res;
-    }
+    if (abfd == NULL) return ERR_GENERAL;
 
     /* Decompress sections.  */
     abfd->flags |= (unsigned) BFD_DECOMPRESS;
 
     if (bfd_check_format(abfd, bfd_archive)) {
-        res.status = ERR_GENERAL;
-        res.err_msg = "cannot get addresses from archive";
-        return res;
+        bfd_close(abfd);
+        *err_msg = "cannot get addresses from archive";
+        return ERR_GENERAL;
     }
 
     if (!bfd_check_format_matches(abfd, bfd_object, &matching)) {
@@ -348,47 +511,199 @@ process_file(const char *file_name, const char *section_name, const char *target
             free(matching);
         }
 
-        res.status = ERR_GENERAL;
-        res.err_msg = "bfd format does not match";
+        bfd_close(abfd);
+        *err_msg = "bfd format does not match";
+        return ERR_GENERAL;
+    }
+
+    // Estimate the memory used by the symbol table and the line tables
+    // before reading anything, so files exceeding the limit are never read
+    if (max_bytes != 0) {
+        storage = bfd_get_symtab_upper_bound(abfd);
+        if (storage == 0) storage = bfd_get_dynamic_symtab_upper_bound(abfd);
+        if (storage > 0) estimate = storage;
+
+        bfd_map_over_sections(abfd, add_debug_section_size, &estimate);
+        if (estimate > max_bytes) {
+            bfd_close(abfd);
+            *err_msg = "the file exceeds the memory limit";
+            return ERR_LIMIT;
+        }
+    }
+
+    file = calloc(1, sizeof(cached_file));
+    if (!file) {
+        bfd_close(abfd);
+        return ERR_ALLOCATION;
+    }
+
+    stat = slurp_symtab(abfd, &file->bytes);
+    if (stat != OK) {
+        free(syms);
+        syms = NULL;
+        free(file);
+        bfd_close(abfd);
+
+        *err_msg = "Unable to read the symbol table";
+        return stat;
+    }
+
+    bfd_map_over_sections(abfd, add_debug_section_size, &file->bytes);
+
+    file->dev = stat_buf.st_dev;
+    file->ino = stat_buf.st_ino;
+    file->abfd = abfd;
+    file->syms = syms;
+    syms = NULL;
+
+    file->next = file_cache;
+    file_cache = file;
+
+    *out = file;
+    return OK;
+}
+
+/* Collect the function symbols of a file, sorted by their address.  */
+
+static int index_functions(cached_file *file) {
+    long count = 0, i;
+
+    if (file->functions != NULL || file->syms == NULL) return OK;
+
+    for (i = 0; file->syms[i] != NULL; i++) {
+        if (file->syms[i]->flags & (unsigned) BSF_FUNCTION) count++;
+    }
+
+    file->functions = malloc((count + 1) * sizeof(asymbol *));
+    if (!file->functions) return ERR_ALLOCATION;
+
+    count = 0;
+    for (i = 0; file->syms[i] != NULL; i++) {
+        if (file->syms[i]->flags & (unsigned) BSF_FUNCTION) file->functions[count++] = file->syms[i];
+    }
+
+    qsort(file->functions, count, sizeof(asymbol *), compare_symbols);
+    file->nfunctions = count;
+    file->bytes += (count + 1) * sizeof(asymbol *);
+
+    return OK;
+}
+
+/* Process a file.  Returns an exit value for main().  */
+
+addr2line_result
+process_file(const char *file_name, const char *section_name, const char *target, const char **_addr, int _naddr) {
+    cached_file *file;
+    asection *section;
+
+    addr = _addr;
+    naddr = _naddr;
+
+    addr2line_result res;
+    res.status = OK;
+    res.info = NULL;
+    res.err_msg = NULL;
+    res.inlined = NULL;
+    res.ninlined = 0;
+
+    res.status = open_file(file_name, target, 0, &file, &res.err_msg);
+    if (res.status != OK) {
         return res;
     }
 
+    if (!read_lines) {
+        res.status = index_functions(file);
+        if (res.status != OK) return res;
+    }
+
     if (section_name != NULL) {
-        section = bfd_get_section_by_name(abfd, section_name);
+        section = bfd_get_section_by_name(file->abfd, section_name);
         if (section == NULL) fprintf(stderr, "%s: cannot find section %s", file_name, section_name);
     } else
         section = NULL;
 
-    int stat = slurp_symtab(abfd);
-    if (stat != OK) {
-        res.err_msg = "Unable to read the symbol table";
-        res.status = stat;
-        return res;
-    }
-
     // Allocate function info, return error if allocation fails
     address_info *info = calloc(naddr, sizeof(address_info));
     if (!info) {
-        free(syms);
-        syms = NULL;
-        bfd_close(abfd);
-
         res.status = ERR_ALLOCATION;
         return res;
     }
 
     res.info = info;
 
-    translate_addresses(abfd, section, info);
+    syms = file->syms;
+    functions = file->functions;
+    nfunctions = file->nfunctions;
+    inlined = NULL;
+    ninlined = inlined_size = 0;
 
-    free(syms);
-    syms = NULL;
+    int collect = collect_inlines;
+    translate_addresses(file->abfd, section, info);
+    collect_inlines = collect;
+
+    syms = functions = NULL;
+    nfunctions = 0;
 
-    bfd_close(abfd);
+    res.inlined = inlined;
+    res.ninlined = ninlined;
+    inlined = NULL;
 
     return res;
 }
 
+int load_file(const char *file_name, int read_lines, unsigned long max_bytes, unsigned long *bytes,
+              addr2line_file **handle) {
+    cached_file *file;
+    const char *err_msg = NULL;
+
+    int stat = open_file(file_name, NULL, max_bytes, &file, &err_msg);
+    if (stat != OK) return stat;
+
+    if (read_lines) {
+        bfd_map_over_sections(file->abfd, read_lines_in_section, file);
+    }
+
+    if (bytes != NULL) *bytes = file->bytes;
+    if (handle != NULL) *handle = file;
+    return OK;
+}
+
+int unload_file(addr2line_file *handle) {
+    cached_file **prev, *file;
+
+    // The file is found by its handle, as the path may now refer to another file
+    for (prev = &file_cache; *prev != NULL; prev = &(*prev)->next) {
+        file = *prev;
+        if (file == handle) {
+            *prev = file->next;
+
+            free(file->functions);
+            free(file->syms);
+            bfd_close(file->abfd);
+            free(file);
+
+            return OK;
+        }
+    }
+
+    return ERR_GENERAL;
+}
+
+void clear_file_cache() {
+    cached_file *next;
+
+    while (file_cache != NULL) {
+        next = file_cache->next;
+
+        free(file_cache->functions);
+        free(file_cache->syms);
+        bfd_close(file_cache->abfd);
+        free(file_cache);
+
+        file_cache = next;
+    }
+}
+
 void set_options(int _unwind_inlines, int no_recurse_limit, int demangle, const char *demangling_style) {
     unwind_inlines = _unwind_inlines;
     if (no_recurse_limit) {
@@ -411,6 +726,11 @@ void set_options(int _unwind_inlines, int no_recurse_limit, int demangle, const
 #endif
 }
 
+void set_lookup_options(int _read_lines, int _collect_inlines) {
+    read_lines = _read_lines;
+    collect_inlines = _collect_inlines;
+}
+
 const char *bfd_getError() {
     return bfd_errmsg(bfd_get_error());
 }
@@ -2,23 +2,32 @@
 
 #include <execinfo.h>
 #include <cstring>
+#include <mutex>
 
-addr2line::addr2line_res::addr2line_res(const addr2line_result &res, int naddr) : info(naddr), status(res.status),
+// addr2line.c uses global state, calls into it must be serialized
+static std::mutex addr2line_mtx;
+
+addr2line::addr2line_res::addr2line_res(const addr2line_result &res, int naddr) : info(naddr), inlined(),
+                                                                                  status(res.status),
                                                                                   err_msg(res.err_msg) {
-    if (status == 0)
+    if (status == 0) {
         memcpy(info.data(), res.info, naddr * sizeof(address_info));
-    else
+        if (res.inlined) inlined.assign(res.inlined, res.inlined + res.ninlined);
+    } else {
         info.resize(0); // addr2line failed make info an empty vector
+    }
 }
 
 addr2line::addr2line_res::addr2line_res(const addr2line_res &res) = default;
 
-addr2line::addr2line_res::addr2line_res(addr2line_res &&res) noexcept: info(std::move(res.info)), status(res.status),
-                                                                       err_msg(res.err_msg) {}
+addr2line::addr2line_res::addr2line_res(addr2line_res &&res) noexcept: info(std::move(res.info)),
+                                                                       inlined(std::move(res.inlined)),
+                                                                       status(res.status), err_msg(res.err_msg) {}
 
 addr2line::addr2line_res &addr2line::addr2line_res::operator=(const addr2line::addr2line_res &res) {
     if (&res != this) {
         info = res.info;
+        inlined = res.inlined;
         status = res.status;
         err_msg = res.err_msg;
     }
@@ -62,9 +71,30 @@ std::map<std::string, std::vector<std::string>> addr2line::parseAddressArray(voi
 
 addr2line::addr2line_res
 addr2line::process(const char *file_name, const char **addr, int naddr, const char *section_name, const char *target) {
+    std::unique_lock<std::mutex> lock(addr2line_mtx);
     addr2line_result result = ::process_file(file_name, section_name, target, addr, naddr);
+    lock.unlock();
+
+    addr2line_res res(result, naddr);
+    free(result.info);
+    free(result.inlined);
+    return res;
+}
+
+addr2line::addr2line_res addr2line::process(const char *file_name, const char **addr, int naddr, const options &opts) {
+    std::unique_lock<std::mutex> lock(addr2line_mtx);
+    ::set_options(opts.unwindInlines, true, opts.demangle, nullptr);
+    ::set_lookup_options(opts.readLines, opts.collectInlines);
+
+    addr2line_result result = ::process_file(file_name, nullptr, nullptr, addr, naddr);
+
+    // Restore the defaults
+    ::set_lookup_options(true, false);
+    lock.unlock();
+
     addr2line_res res(result, naddr);
     free(result.info);
+    free(result.inlined);
     return res;
 }
 
@@ -87,7 +117,7 @@ addr2line::address_map addr2line::processAddressArray(void **addr, int naddr) {
 }
 
 addr2line::addr2line_res addr2line::processAddress(const char *addr) {
-    addr2line_res res({nullptr, 1, nullptr}, 0);
+    addr2line_res res({nullptr, 1, nullptr, nullptr, 0}, 0);
 
     std::string msg, file, address;
     size_t o, p, c;
@@ -107,4 +137,24 @@ addr2line::addr2line_res addr2line::processAddress(const char *addr) {
     std::vector<const char *> data = {address.c_str()};
 
     return addr2line::process(file.c_str(), data.data(), 1, nullptr, nullptr);
+}
+
+int addr2line::loadFile(const char *file_name, bool readLines, size_t maxBytes, size_t &bytes,
+                        addr2line_file *&file) {
+    std::unique_lock<std::mutex> lock(addr2line_mtx);
+    unsigned long res_bytes = 0;
+    int status = ::load_file(file_name, readLines, maxBytes, &res_bytes, &file);
+    bytes = res_bytes;
+
+    return status;
+}
+
+bool addr2line::unloadFile(addr2line_file *file) {
+    std::unique_lock<std::mutex> lock(addr2line_mtx);
+    return ::unload_file(file) == 0;
+}
+
+void addr2line::clearFileCache() {
+    std::unique_lock<std::mutex> lock(addr2line_mtx);
+    ::clear_file_cache();
 }
\ No newline at end of file
@@ -53,14 +53,27 @@ typedef struct addr2line_result_s {
     address_info *info;
     // The status of the call.
     // Equals to 0 if the call succeeded, 1, if a general error occurred,
-    // 2, if an allocation error occurred (out of memory etc.).
+    // 2, if an allocation error occurred (out of memory etc.),
+    // 3, if a memory limit would be exceeded.
     int status;
     // The error message (if available).
     // Will be nullptr if no error message is available.
     // Must not be freed whatsoever.
     const char *err_msg;
+    // The inlined functions found while unwinding inlined functions.
+    // Only set if collecting inlined functions is enabled using
+    // set_lookup_options. Every entry's address is the address it was
+    // inlined at, the innermost function comes first.
+    // Must be freed using free().
+    address_info *inlined;
+    // The number of entries in inlined
+    int ninlined;
 } addr2line_result;
 
+// A file opened by load_file, stored in the file cache.
+// The same file reached using different paths has the same handle.
+typedef struct addr2line_file_s addr2line_file;
+
 /**
  * Process a file using logic from the addr2line tool
  *
@@ -74,6 +87,35 @@ typedef struct addr2line_result_s {
 addr2line_result
 process_file(const char *file_name, const char *section_name, const char *target, const char **addr, int naddr);
 
+/**
+ * Open a file and read its symbol table into the file cache, so
+ * following calls to process_file don't have to read the file again.
+ * Files already in the cache are not read again.
+ *
+ * @param file_name the path to the file
+ * @param read_lines whether to also read the line number tables of the file
+ * @param max_bytes the max number of bytes the file's symbol and line tables may use or 0 for no limit
+ * @param bytes will be set to the estimated number of bytes used by the file. May be null
+ * @param file will be set to the handle of the cached file. May be null
+ * @return 0 if the file was loaded, 3 if the file exceeds max_bytes, another error code otherwise
+ */
+int load_file(const char *file_name, int read_lines, unsigned long max_bytes, unsigned long *bytes,
+              addr2line_file **file);
+
+/**
+ * Close a cached file and free its symbol table. Works even if
+ * the file was deleted or replaced since it was loaded.
+ *
+ * @param file the handle returned by load_file
+ * @return 0 if the file was closed, 1 if the file was not in the cache
+ */
+int unload_file(addr2line_file *file);
+
+/**
+ * Close all cached files and free their symbol tables
+ */
+void clear_file_cache();
+
 /**
  * Set some options for addr2line
  *
@@ -84,6 +126,16 @@ process_file(const char *file_name, const char *section_name, const char *target
  */
 void set_options(int unwind_inlines, int no_recurse_limit, int demangle, const char *demangling_style);
 
+/**
+ * Set the options used to look up addresses
+ *
+ * @param read_lines whether to read the line tables. If 0, only the
+ *                   function names are looked up using the symbol table
+ * @param collect_inlines whether to store the inlined functions found while unwinding
+ *                        inlined functions in addr2line_result.inlined
+ */
+void set_lookup_options(int read_lines, int collect_inlines);
+
 /**
  * Get the last error from bfd
  *
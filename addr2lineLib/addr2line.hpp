@@ -52,10 +52,29 @@ namespace addr2line {
         ~addr2line_res();
 
         std::vector<address_info> info; // The address infos
+        std::vector<address_info> inlined; // The inlined functions, if collected
         int status; // The status
         const char *err_msg; // The error message, if available
     };
 
+    /**
+     * Options for processing addresses
+     */
+    struct options {
+        // Whether to unwind inlined functions. Equals to the -i option
+        bool unwindInlines = true;
+
+        // Whether to store the inlined functions in addr2line_res::inlined
+        bool collectInlines = false;
+
+        // Whether to read the line tables. If false, only the function
+        // names are looked up using the symbol table
+        bool readLines = true;
+
+        // Whether to demangle function names. Equals to the -C option
+        bool demangle = true;
+    };
+
     // A map containing a file name as a key
     // and an addr2line_re object containing address information as a value
     typedef std::map<std::string, addr2line_res> address_map;
@@ -82,6 +101,18 @@ namespace addr2line {
     addr2line_res process(const char *file_name, const char **addr, int naddr, const char *section_name = nullptr,
                           const char *target = nullptr);
 
+    /**
+     * Process a file using logic from the addr2line tool.
+     * The options are only used for this call.
+     *
+     * @param file_name the path to the file
+     * @param addr an array of the addresses to process
+     * @param naddr the number of addresses to process
+     * @param opts the options to use
+     * @return the result of the operation
+     */
+    addr2line_res process(const char *file_name, const char **addr, int naddr, const options &opts);
+
     /**
      * Process a map created by parseAddressArray(2)
      *
@@ -107,6 +138,31 @@ namespace addr2line {
      * @return a addr2line_res
      */
     addr2line_res processAddress(const char *addr);
+
+    /**
+     * Load a file into the file cache. See load_file in addr2line.h
+     *
+     * @param file_name the path to the file
+     * @param readLines whether to also read the line number tables
+     * @param maxBytes the max number of bytes the file may use or 0 for no limit
+     * @param bytes will be set to the estimated number of bytes used by the file
+     * @param file will be set to the handle of the cached file
+     * @return the status of the operation
+     */
+    int loadFile(const char *file_name, bool readLines, size_t maxBytes, size_t &bytes, addr2line_file *&file);
+
+    /**
+     * Remove a file from the file cache
+     *
+     * @param file the handle returned by loadFile
+     * @return true, if the file was removed
+     */
+    bool unloadFile(addr2line_file *file);
+
+    /**
+     * Close all files in the file cache
+     */
+    void clearFileCache();
 }
 
 #endif //STACKTRACE_ADDR2LINE_HPP
@@ -0,0 +1,501 @@
+#include "stacktrace.hpp"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#   include <csignal>
+#   include <unistd.h>
+#   include <sys/wait.h>
+#endif
+
+using namespace markusjx::stacktrace;
+
+/**
+ * Call a function at a given stack depth
+ *
+ * @param depth the number of frames to add to the stack
+ * @param fn the function to call
+ */
+static void atDepth(int depth, const std::function<void()> &fn) {
+    if (depth <= 0) {
+        fn();
+    } else {
+        atDepth(depth - 1, fn);
+    }
+}
+
+/**
+ * Measure the average time a function takes
+ *
+ * @param iterations the number of times to call the function
+ * @param fn the function to measure
+ * @return the average time in microseconds
+ */
+static double measure(int iterations, const std::function<void()> &fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn();
+    }
+
+    std::chrono::duration<double, std::micro> duration = std::chrono::steady_clock::now() - start;
+    return duration.count() / iterations;
+}
+
+/**
+ * Print a benchmark result
+ *
+ * @param name the name of the benchmark
+ * @param us the time in microseconds
+ */
+static void print(const std::string &name, double us) {
+    std::cout << std::left << std::setw(40) << name << std::right << std::setw(12) << std::fixed
+              << std::setprecision(2) << us << " us" << std::endl;
+}
+
+/**
+ * Benchmark creating stack traces using every resolve level
+ */
+static void benchResolveLevels() {
+    const std::pair<const char *, resolve_level> levels[] = {
+            {"raw",           resolve_level::raw},
+            {"module_offset", resolve_level::module_offset},
+            {"function",      resolve_level::function},
+            {"function_line", resolve_level::function_line},
+            {"full",          resolve_level::full}
+    };
+
+    std::cout << "Resolve levels (32 frames deep):" << std::endl;
+    for (const auto &level : levels) {
+        const int iterations = 200;
+        double cold = measure(iterations, [&level] {
+            stacktrace::clearCache();
+            atDepth(32, [&level] { stacktrace trace(0, 128, level.second); });
+        });
+
+        double warm = measure(iterations, [&level] {
+            atDepth(32, [&level] { stacktrace trace(0, 128, level.second); });
+        });
+
+        print(std::string("  ") + level.first + " (cold)", cold);
+        print(std::string("  ") + level.first + " (cached)", warm);
+    }
+}
+
+/**
+ * Benchmark resolving many traces one by one and using stacktrace::symbolize
+ */
+static void benchSymbolize() {
+    std::vector<stacktrace> traces;
+    for (int i = 0; i < 1000; i++) {
+        atDepth(i % 16, [&traces] { traces.emplace_back(); });
+    }
+
+    std::cout << "Resolving 1000 traces:" << std::endl;
+    print("  one by one (cold)", measure(5, [&traces] {
+        stacktrace::clearCache();
+        for (const stacktrace &trace : traces) {
+            stacktrace copy(trace);
+            (void) copy.toString();
+        }
+    }));
+
+    print("  symbolize (cold)", measure(5, [&traces] {
+        stacktrace::clearCache();
+        symbol_table table = stacktrace::symbolize(traces);
+        for (const stacktrace &trace : traces) {
+            stacktrace copy(trace);
+            copy.resolveFrom(table);
+            (void) copy.toString();
+        }
+    }));
+}
+
+/**
+ * Benchmark the size and speed of serializing traces
+ */
+static void benchSerialize() {
+    std::vector<stacktrace> traces;
+    for (int i = 0; i < 1000; i++) {
+        atDepth(i % 16, [&traces] { traces.emplace_back(); });
+    }
+
+    // Resolve every trace once, so only the serialization is measured
+    size_t textSize = 0, rawSize = 0, symbolsSize = 0, jsonRawSize = 0, jsonSize = 0;
+    for (const stacktrace &trace : traces) {
+        textSize += trace.toString().size();
+        rawSize += trace.serialize().size();
+        symbolsSize += trace.serialize(true).size();
+        jsonRawSize += trace.toJson(false).size();
+        jsonSize += trace.toJson().size();
+    }
+
+    std::cout << "Average size of 1000 traces (bytes):" << std::endl
+              << "  toString                 " << textSize / traces.size() << std::endl
+              << "  binary                   " << rawSize / traces.size() << std::endl
+              << "  binary with symbols      " << symbolsSize / traces.size() << std::endl
+              << "  json                     " << jsonRawSize / traces.size() << std::endl
+              << "  json with symbols        " << jsonSize / traces.size() << std::endl;
+
+    std::vector<std::string> serialized;
+    for (const stacktrace &trace : traces) {
+        serialized.push_back(trace.serialize(true));
+    }
+
+    std::cout << "Serializing 1000 traces:" << std::endl;
+    print("  binary", measure(5, [&traces] {
+        for (const stacktrace &trace : traces) (void) trace.serialize();
+    }));
+
+    print("  binary with symbols", measure(5, [&traces] {
+        for (const stacktrace &trace : traces) (void) trace.serialize(true);
+    }));
+
+    print("  json", measure(5, [&traces] {
+        for (const stacktrace &trace : traces) (void) trace.toJson(false);
+    }));
+
+    print("  json with symbols", measure(5, [&traces] {
+        for (const stacktrace &trace : traces) (void) trace.toJson();
+    }));
+
+    print("  deserialize with symbols", measure(5, [&serialized] {
+        for (const std::string &data : serialized) (void) stacktrace::deserialize(data);
+    }));
+}
+
+static void benchCopy() {
+    std::vector<stacktrace> traces;
+    for (int i = 0; i < 1000; i++) {
+        atDepth(i % 16, [&traces] { traces.emplace_back(); });
+        (void) traces.back().getFrames();
+    }
+
+    // Copies share the resolved frames, so this only measures the pointer copies
+    std::cout << "Copying 1000 resolved traces:" << std::endl;
+    print("  copy", measure(5, [&traces] {
+        std::vector<stacktrace> copies(traces);
+        (void) copies;
+    }));
+}
+
+static void benchStackTable() {
+    stack_table table;
+
+    // Record 16 different stacks many times, as a service recording errors would
+    std::cout << "Recording 1000 stacks:" << std::endl;
+    print("  stacktrace", measure(5, [] {
+        for (int i = 0; i < 1000; i++) {
+            atDepth(i % 16, [] { (void) stacktrace(); });
+        }
+    }));
+
+    print("  stack_table::capture", measure(5, [&table] {
+        for (int i = 0; i < 1000; i++) {
+            atDepth(i % 16, [&table] { (void) table.capture(); });
+        }
+    }));
+
+    stack_aggregator aggregator;
+    print("  stack_aggregator::record", measure(5, [&aggregator] {
+        for (int i = 0; i < 1000; i++) {
+            atDepth(i % 16, [&aggregator] { aggregator.record(); });
+        }
+    }));
+
+    std::cout << "  " << table.size() << " unique stacks" << std::endl;
+    print("  stack_aggregator::top(5)", measure(1, [&aggregator] { (void) aggregator.top(5); }));
+
+    std::string folded, pprof;
+    print("  stack_aggregator::writeFolded", measure(5, [&aggregator, &folded] {
+        folded.clear();
+        aggregator.writeFolded([](void *ctx, const char *data, size_t size) {
+            static_cast<std::string *>(ctx)->append(data, size);
+        }, &folded);
+    }));
+
+    print("  stack_aggregator::writePprof", measure(5, [&aggregator, &pprof] {
+        pprof.clear();
+        aggregator.writePprof([](void *ctx, const char *data, size_t size) {
+            static_cast<std::string *>(ctx)->append(data, size);
+        }, &pprof);
+    }));
+
+    std::cout << "  folded " << folded.size() << " bytes, pprof " << pprof.size() << " bytes" << std::endl;
+}
+
+static void benchExceptions() {
+    // An exception creating a stack trace at the throw site
+    struct stacktrace_exception : std::runtime_error {
+        stacktrace trace;
+
+        stacktrace_exception() : std::runtime_error("error"), trace() {}
+    };
+
+    std::cout << "Throwing and catching 10000 exceptions at depth 16:" << std::endl;
+    print("  std::runtime_error", measure(5, [] {
+        for (int i = 0; i < 10000; i++) {
+            atDepth(16, [] {
+                try {
+                    throw std::runtime_error("error");
+                } catch (const std::exception &) {}
+            });
+        }
+    }));
+
+    print("  with a stacktrace member", measure(5, [] {
+        for (int i = 0; i < 10000; i++) {
+            atDepth(16, [] {
+                try {
+                    throw stacktrace_exception();
+                } catch (const std::exception &) {}
+            });
+        }
+    }));
+
+    print("  traced_exception", measure(5, [] {
+        for (int i = 0; i < 10000; i++) {
+            atDepth(16, [] {
+                try {
+                    throw traced_exception<std::runtime_error>("error");
+                } catch (const std::exception &) {}
+            });
+        }
+    }));
+}
+
+/**
+ * Lock and unlock a mutex from multiple threads
+ *
+ * @param mtx the mutex to lock
+ * @param threads the number of threads
+ * @param iterations the number of times every thread locks the mutex
+ */
+template<class Mutex>
+static void contend(Mutex &mtx, int threads, int iterations) {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&mtx, iterations] {
+            for (int j = 0; j < iterations; j++) {
+                std::lock_guard<Mutex> lock(mtx);
+            }
+        });
+    }
+
+    for (std::thread &t : workers) {
+        t.join();
+    }
+}
+
+static void benchContention() {
+    std::mutex plain;
+    traced_mutex traced("bench");
+
+    std::cout << "Locking a mutex 100000 times on 4 threads:" << std::endl;
+    print("  std::mutex", measure(5, [&plain] {
+        contend(plain, 4, 100000);
+    }));
+
+    print("  traced_mutex", measure(5, [&traced] {
+        contend(traced, 4, 100000);
+    }));
+
+    contention_profiler profiler;
+    profiler.start();
+    print("  traced_mutex while profiling", measure(5, [&traced] {
+        contend(traced, 4, 100000);
+    }));
+    profiler.stop();
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+static volatile double sink = 0;
+
+static void benchProfiler() {
+    auto work = [] {
+        for (int i = 0; i < 200000000; i++) {
+            sink = sink + i * 0.5;
+        }
+    };
+
+    // Compare the same cpu bound work with and without sampling at 100 Hz
+    std::cout << "Sampling 200M iterations:" << std::endl;
+    const double unprofiled = measure(3, work);
+    print("  without profiler", unprofiled);
+
+    sampling_profiler profiler;
+    profiler.start();
+    const double profiled = measure(3, work);
+    profiler.stop();
+
+    print("  profiler at 100 Hz", profiled);
+    std::cout << "  " << profiler.samples() << " samples, overhead " << (profiled / unprofiled - 1) * 100 << "%"
+              << std::endl;
+}
+
+static void benchWatchdog() {
+    watchdog dog;
+    dog.start();
+    watched_thread &watched = dog.addThread("bench");
+
+    std::cout << "Arming and disarming a watched thread 10M times:" << std::endl;
+    print("  arm and disarm", measure(3, [&watched] {
+        for (int i = 0; i < 10000000; i++) {
+            watched.arm(1000);
+            watched.disarm();
+        }
+    }));
+
+    dog.removeThread();
+    dog.stop();
+}
+
+static void benchThreadDump() {
+    std::atomic<bool> done(false);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < 16; i++) {
+        workers.emplace_back([&done] {
+            atDepth(32, [&done] {
+                while (!done) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            });
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    uint64_t maxPause = 0;
+    std::cout << "Dumping 17 threads at depth 32:" << std::endl;
+    print("  thread_dump", measure(5, [&maxPause] {
+        thread_dump dump;
+        maxPause = std::max(maxPause, dump.getMaxPause());
+    }));
+    std::cout << "  longest pause of a thread: " << maxPause / 1000 << " us" << std::endl;
+
+    done = true;
+    for (std::thread &t : workers) {
+        t.join();
+    }
+}
+
+static void benchFlightRecorder() {
+    flight_recorder recorder("stacktrace_bench.flight");
+
+    std::cout << "Capturing 100000 stacks at depth 16:" << std::endl;
+    print("  stacktrace::capture", measure(5, [] {
+        atDepth(16, [] {
+            void *buffer[32];
+            for (int i = 0; i < 100000; i++) {
+                sink = sink + (double) stacktrace::capture(buffer, 32);
+            }
+        });
+    }));
+
+    print("  flight_recorder::record", measure(5, [&recorder] {
+        atDepth(16, [&recorder] {
+            for (int i = 0; i < 100000; i++) {
+                recorder.record();
+            }
+        });
+    }));
+
+    std::remove(recorder.getPath().c_str());
+}
+
+static void benchSymbolizer() {
+    std::vector<stacktrace> traces;
+    for (int i = 0; i < 1000; i++) {
+        atDepth(i % 16, [&traces] { traces.emplace_back(); });
+    }
+
+    auto resolve = [&traces] {
+        stacktrace::clearCache();
+        symbol_table table = stacktrace::symbolize(traces);
+        sink = sink + (double) table.size();
+    };
+
+    std::cout << "Resolving 1000 traces (cold):" << std::endl;
+    print("  in this process", measure(5, resolve));
+
+    // The daemon runs in this process, so only the protocol overhead is measured
+    symbolizer_server server("stacktrace_bench.sock");
+    server.start();
+    stacktrace::setSymbolizer(server.getPath());
+    print("  using symbolizer_server", measure(5, resolve));
+    stacktrace::setSymbolizer("");
+}
+
+static void benchProcessDump() {
+    const pid_t child = fork();
+    if (child == 0) {
+        atDepth(32, [] {
+            for (;;) pause();
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    uint64_t maxPause = 0;
+    auto dump = [child, &maxPause](resolve_level level) {
+        process_dump_options options;
+        options.level = level;
+        return [child, &maxPause, options] {
+            process_dump dump(child, options);
+            maxPause = std::max(maxPause, dump.getPause());
+        };
+    };
+
+    std::cout << "Dumping another process at depth 32:" << std::endl;
+    print("  process_dump (raw)", measure(5, dump(resolve_level::raw)));
+    print("  process_dump (function_line)", measure(5, dump(resolve_level::function_line)));
+    std::cout << "  longest pause of the process: " << maxPause / 1000 << " us" << std::endl;
+
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+}
+
+static void benchAllocationProfiler() {
+    std::vector<void *> allocations(1000000);
+    auto work = [&allocations] {
+        for (void *&ptr : allocations) {
+            ptr = malloc(64);
+            allocation_profiler::onAllocation(ptr, 64);
+        }
+
+        for (void *ptr : allocations) {
+            allocation_profiler::onFree(ptr);
+            free(ptr);
+        }
+    };
+
+    // The hooks are called directly, as malloc is only replaced if the library is built to do so
+    std::cout << "1M allocations of 64 bytes:" << std::endl;
+    print("  without profiler", measure(3, work));
+
+    allocation_profiler profiler;
+    profiler.start();
+    print("  sampling every 512KB", measure(3, work));
+    profiler.stop();
+}
+#endif
+
+int main() {
+    benchResolveLevels();
+    benchSymbolize();
+    benchSerialize();
+    benchCopy();
+    benchStackTable();
+    benchExceptions();
+    benchContention();
+#if !defined(_WIN32) && !defined(__APPLE__)
+    benchProfiler();
+    benchWatchdog();
+    benchThreadDump();
+    benchFlightRecorder();
+    benchSymbolizer();
+    benchProcessDump();
+    benchAllocationProfiler();
+#endif
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include "stacktrace.hpp"
+#include "tools.hpp"
+#include <ctime>
+#include <iostream>
+
+using namespace markusjx::stacktrace;
+
+/**
+ * Print the usage of the tool
+ *
+ * @param name the name of the executable
+ */
+static void printUsage(const char *name) {
+    std::cerr << "Usage: " << name << " <file> [raw|module_offset|function|function_line|full]" << std::endl
+              << "Prints the records of a flight recorder file, the oldest first" << std::endl;
+}
+
+/**
+ * Format a timestamp as UTC date and time
+ *
+ * @param timestamp the nanoseconds since the epoch
+ * @return the formatted timestamp
+ */
+static std::string formatTimestamp(uint64_t timestamp) {
+    const auto seconds = (time_t) (timestamp / 1000000000);
+    tm utc{};
+    gmtime_r(&seconds, &utc);
+
+    char buffer[64];
+    const size_t len = strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &utc);
+    snprintf(buffer + len, sizeof(buffer) - len, ".%06u UTC", (unsigned) (timestamp % 1000000000 / 1000));
+    return buffer;
+}
+
+int main(int argc, char **argv) {
+    resolve_level level = resolve_level::function_line;
+    if (argc < 2 || argc > 3 || (argc == 3 && !tools::parseLevel(argv[2], level))) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    try {
+        const std::vector<flight_record> records = flight_recorder::read(argv[1], level);
+        for (const flight_record &record : records) {
+            std::cout << "Record " << record.sequence << " at " << formatTimestamp(record.timestamp) << ", thread "
+                      << record.thread << ", tag " << record.tag << ':' << std::endl << record.trace << std::endl;
+        }
+
+        std::cout << records.size() << " records" << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -70,12 +70,30 @@ function(initStacktrace target)
 
     target_sources(${target} PRIVATE stacktrace.hpp stacktrace.cpp ${ADDR2LINE_SRC})
 
+    # stacktrace::prewarmAsync uses std::async
+    find_package(Threads REQUIRED)
+    target_link_libraries(${target} PRIVATE Threads::Threads)
+
+    # Replace malloc and free, so every allocation is passed to the allocation_profiler.
+    # Public, so users know not to pass their allocations to the profiler themselves
+    if (STACKTRACE_INTERPOSE_MALLOC AND NOT WIN32 AND NOT APPLE)
+        target_compile_definitions(${target} PUBLIC STACKTRACE_INTERPOSE_MALLOC)
+        message(STATUS "Replacing malloc and free for the allocation_profiler")
+    endif ()
+
+    # Replace __cxa_throw, so the stack of every thrown exception is captured
+    if (STACKTRACE_INTERPOSE_CXA_THROW AND NOT WIN32)
+        target_compile_definitions(${target} PRIVATE STACKTRACE_INTERPOSE_CXA_THROW)
+        message(STATUS "Replacing __cxa_throw to capture the stacks of exceptions")
+    endif ()
+
+    # sampling_profiler uses timer_create, which is in librt on older glibc versions
     if (NOT WIN32 AND NOT APPLE)
         if (${BUILD_ADDR2LINE})
-            target_link_libraries(${target} PRIVATE bfd dl)
+            target_link_libraries(${target} PRIVATE bfd dl rt)
             message(STATUS "libbfd and libiberty found, linking libbfd")
         else ()
-            target_link_libraries(${target} PRIVATE dl)
+            target_link_libraries(${target} PRIVATE dl rt)
             message(STATUS "libbfd or libiberty not found, not linking libbfd")
             target_compile_definitions(${target} PRIVATE STACKTRACE_NO_ADDR2LINE)
         endif ()
@@ -27,10 +27,39 @@ void fn_1() {
 }
 
 int main() {
+    std::future<markusjx::stacktrace::prewarm_result> prewarm = markusjx::stacktrace::stacktrace::prewarmAsync();
+    markusjx::stacktrace::prewarm_result result = prewarm.get();
+    std::cout << "Prewarmed " << result.modules << " modules using " << result.bytes << " bytes" << std::endl;
+
     std::cout << "Call in main:" << std::endl << markusjx::stacktrace::stacktrace() << std::endl;
     fn_1();
     test_1();
     test::test_2();
+    test::test_partial(100);
+    test::test_symbolize();
+    test::test_format();
+    test::test_serialize();
+    test::test_copy();
+    test::test_hash();
+    test::test_stack_table();
+    test::test_aggregate();
+    test::test_call_tree();
+    test::test_exception();
+    test::test_contention();
+#if !defined(_WIN32) && !defined(__APPLE__)
+    test::test_profiler();
+    test::test_watchdog();
+    test::test_thread_dump();
+    test::test_flight_recorder();
+    test::test_symbolizer();
+    test::test_process_dump();
+    test::test_allocations();
+#endif
+
+    markusjx::stacktrace::cache_stats stats = markusjx::stacktrace::stacktrace::getCacheStats();
+    std::cout << "Symbol caches use " << stats.bytes << " bytes in " << stats.modules.size() << " modules, "
+              << stats.internedBytes << " bytes of interned names"
+              << std::endl;
 
     return 0;
 }
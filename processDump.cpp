@@ -0,0 +1,36 @@
+#include "stacktrace.hpp"
+#include "tools.hpp"
+#include <cstdlib>
+#include <iostream>
+
+using namespace markusjx::stacktrace;
+
+/**
+ * Print the usage of the tool
+ *
+ * @param name the name of the executable
+ */
+static void printUsage(const char *name) {
+    std::cerr << "Usage: " << name << " <pid> [raw|module_offset|function|function_line|full]" << std::endl
+              << "Prints the stacks of all threads of a process" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    process_dump_options options;
+    char *end = nullptr;
+    const long pid = argc >= 2 ? strtol(argv[1], &end, 10) : 0;
+    if (argc < 2 || argc > 3 || *end != '\0' || pid <= 0 || (argc == 3 && !tools::parseLevel(argv[2], options.level))) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    try {
+        const process_dump dump((pid_t) pid, options);
+        std::cout << dump << dump.size() << " threads, stopped for " << dump.getPause() / 1000 << "us" << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
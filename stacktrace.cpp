@@ -1,10 +1,58 @@
 #include "stacktrace.hpp"
 #ifndef STACKTRACE_NO_ADDR2LINE
 #   include "addr2lineLib/addr2line.hpp"
+#else
+typedef struct addr2line_file_s addr2line_file;
 #endif
 
 #include <algorithm>
-#include <iomanip>
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _MSC_VER
+#   include <intrin.h>
+#   define STACKTRACE_RETURN_ADDRESS() _ReturnAddress()
+#   define STACKTRACE_NOINLINE __declspec(noinline)
+#   define STACKTRACE_FORCEINLINE __forceinline
+#else
+#   define STACKTRACE_RETURN_ADDRESS() __builtin_return_address(0)
+#   define STACKTRACE_NOINLINE __attribute__((noinline))
+#   define STACKTRACE_FORCEINLINE inline __attribute__((always_inline))
+#endif //MSVC
+
+#if defined(STACKTRACE_UNIX) && !defined(__APPLE__)
+#   include <link.h>
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#   include <sys/ptrace.h>
+#   include <sys/uio.h>
+#   include <sys/user.h>
+#   include <sys/wait.h>
+#   include <ctime>
+#   include <cerrno>
+#   include <unistd.h>
+#   include <ucontext.h>
+#   include <sys/syscall.h>
+#   include <cmath>
+
+// Older glibc versions do not define this
+#   ifndef sigev_notify_thread_id
+#       define sigev_notify_thread_id _sigev_un._tid
+#   endif
+#endif //Unix && !Apple
 
 using namespace markusjx::stacktrace;
 
@@ -16,24 +64,132 @@ public:
     using std::exception::exception;
 };
 
-frame::frame(const void *address) : function(), fullFile(), file(), line(0), address(address) {}
+// string pool ======================
+
+/**
+ * A process-wide pool of interned strings. Strings are stored null-terminated
+ * in large chunks and never freed, so views into the pool stay valid forever.
+ */
+class string_pool {
+public:
+    /**
+     * Get the instance of the pool. The pool is never destroyed,
+     * so frames can still be used by static destructors.
+     *
+     * @return the pool
+     */
+    static string_pool &instance() {
+        static auto *pool = new string_pool();
+        return *pool;
+    }
+
+    /**
+     * Intern a string
+     *
+     * @param str the string to intern
+     * @return a view into the pool, equal to str
+     */
+    std::string_view intern(std::string_view str) {
+        if (str.empty()) return {"", 0};
+
+        std::unique_lock<std::mutex> lock(mtx);
+        auto it = strings.find(str);
+        if (it != strings.end()) return *it;
+
+        if (str.size() + 1 > remaining) {
+            size_t size = std::max(chunkSize, str.size() + 1);
+            chunks.emplace_back(new char[size]);
+            current = chunks.back().get();
+            remaining = size;
+            bytes += size;
+        }
+
+        memcpy(current, str.data(), str.size());
+        current[str.size()] = '\0';
+
+        std::string_view res(current, str.size());
+        current += str.size() + 1;
+        remaining -= str.size() + 1;
+        strings.insert(res);
+
+        return res;
+    }
+
+    /**
+     * Get the number of bytes used by the pool
+     *
+     * @return the size in bytes
+     */
+    size_t getBytes() {
+        std::unique_lock<std::mutex> lock(mtx);
+        return bytes + strings.size() * sizeof(std::string_view);
+    }
+
+private:
+    string_pool() : mtx(), strings(), chunks(), current(nullptr), remaining(0), bytes(0) {}
+
+    // The size of every chunk, unless a string is larger
+    static constexpr size_t chunkSize = 64 * 1024;
+
+    std::mutex mtx;
+    // Views of all interned strings
+    std::unordered_set<std::string_view> strings;
+    // The chunks storing the strings
+    std::vector<std::unique_ptr<char[]>> chunks;
+    // The next free byte in the last chunk
+    char *current;
+    // The number of free bytes in the last chunk
+    size_t remaining;
+    // The number of bytes allocated for the chunks
+    size_t bytes;
+};
+
+// hashing ============================
+
+/**
+ * Combine a hash with another value
+ *
+ * @param seed the hash to combine
+ * @param value the value to add to the hash
+ * @return the combined hash
+ */
+static size_t hashCombine(size_t seed, size_t value) noexcept {
+    return seed ^ (value + (size_t) 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2));
+}
+
+/**
+ * Check if two interned strings are equal
+ *
+ * @param a the first string
+ * @param b the second string
+ * @return true, if both are the same interned string
+ */
+static bool sameInterned(std::string_view a, std::string_view b) noexcept {
+    return a.data() == b.data() || (a.empty() && b.empty());
+}
 
-frame::frame(const frame &f) : function(f.getFunction()), fullFile(f.getFullFilePath()), file(f.getFile()),
-                               line(f.getLine()), address(f.getAddress()) {}
+// frame ==============================
 
-frame::frame(frame &&f) noexcept: function(std::move(f.function)), fullFile(std::move(f.fullFile)),
-                                  file(std::move(f.file)), line(f.getLine()), address(f.getAddress()) {}
+frame::frame() noexcept: function("", 0), fullFile("", 0), fileOffset(0), line(0), address(nullptr),
+                         inlined(false) {}
 
-STACKTRACE_NODISCARD const std::string &frame::getFunction() const noexcept {
+frame::frame(std::string_view function, std::string_view fullFile, size_t line, const void *address, bool inlined)
+        : function(string_pool::instance().intern(function)), fullFile(string_pool::instance().intern(fullFile)),
+          fileOffset(0), line(line), address(address), inlined(inlined) {
+    size_t slash = this->fullFile.rfind(STACKTRACE_SLASH);
+    if (slash != std::string_view::npos) fileOffset = slash + 1;
+}
+
+STACKTRACE_NODISCARD std::string_view frame::getFunction() const noexcept {
     return function;
 }
 
-STACKTRACE_NODISCARD const std::string &frame::getFullFilePath() const noexcept {
+STACKTRACE_NODISCARD std::string_view frame::getFullFilePath() const noexcept {
     return fullFile;
 }
 
-STACKTRACE_NODISCARD const std::string &frame::getFile() const noexcept {
-    return file;
+STACKTRACE_NODISCARD std::string_view frame::getFile() const noexcept {
+    return fullFile.substr(fileOffset);
 }
 
 STACKTRACE_NODISCARD size_t frame::getLine() const noexcept {
@@ -44,16 +200,183 @@ STACKTRACE_NODISCARD const void *frame::getAddress() const noexcept {
     return address;
 }
 
-frame::~frame() = default;
+STACKTRACE_NODISCARD bool frame::isInlined() const noexcept {
+    return inlined;
+}
+
+// formatting =========================
+
+/**
+ * Write a number in decimal to a buffer. The buffer must
+ * be large enough for 20 characters. Does not write a null terminator.
+ *
+ * @param buffer the buffer to write to
+ * @param value the value to write
+ * @return the number of characters written
+ */
+static size_t formatDecimal(char *buffer, size_t value) noexcept {
+    char tmp[20];
+    size_t len = 0;
+    do {
+        tmp[len++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = tmp[len - 1 - i];
+    }
+
+    return len;
+}
+
+/**
+ * Write a number in upper case hexadecimal, without a prefix, to a buffer.
+ * The buffer must be large enough for sizeof(uintptr_t) * 2 characters.
+ * Does not write a null terminator.
+ *
+ * @param buffer the buffer to write to
+ * @param value the value to write
+ * @param digits the min number of digits. The number is padded with zeros.
+ * @return the number of characters written
+ */
+static size_t formatHex(char *buffer, uintptr_t value, size_t digits = 1) noexcept {
+    const char *chars = "0123456789ABCDEF";
+    char tmp[sizeof(uintptr_t) * 2];
+    size_t len = 0;
+    do {
+        tmp[len++] = chars[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+
+    while (len < digits && len < sizeof(tmp)) {
+        tmp[len++] = '0';
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = tmp[len - 1 - i];
+    }
+
+    return len;
+}
+
+/**
+ * Convert an address to a hexadecimal string the length of intptr_t
+ *
+ * @param address the address to convert
+ * @return the address as a string
+ */
+STACKTRACE_UNUSED static std::string addressToString(const void *address) {
+    char buffer[2 + sizeof(uintptr_t) * 2] = {'0', 'x'};
+    size_t len = 2 + formatHex(buffer + 2, (uintptr_t) address, sizeof(uintptr_t) * 2);
+
+    return std::string(buffer, len);
+}
+
+/**
+ * Write a string to a frame_writer
+ *
+ * @param write the writer to write to
+ * @param ctx the writer's context
+ * @param str the string to write
+ */
+static inline void writeString(frame_writer write, void *ctx, std::string_view str) {
+    write(ctx, str.data(), str.size());
+}
 
 /**
- * Remove everything but the last part of a path. Used to get file names.
+ * Write a number in decimal to a frame_writer
  *
- * @param str the path
- * @return the file name
+ * @param write the writer to write to
+ * @param ctx the writer's context
+ * @param value the value to write
+ */
+static inline void writeDecimal(frame_writer write, void *ctx, size_t value) {
+    char buffer[20];
+    write(ctx, buffer, formatDecimal(buffer, value));
+}
+
+/**
+ * A frame_writer appending to a std::string
+ */
+static void appendToString(void *ctx, const char *data, size_t size) {
+    static_cast<std::string *>(ctx)->append(data, size);
+}
+
+/**
+ * The state of a frame_writer writing to a fixed size buffer
+ */
+struct buffer_writer {
+    // The buffer to write to
+    char *buffer;
+
+    // The size of the buffer
+    size_t size;
+
+    // The number of characters which were written or would have been written
+    size_t length;
+};
+
+/**
+ * A frame_writer writing to a buffer_writer. Silently
+ * drops everything which doesn't fit into the buffer.
+ */
+static void writeToBuffer(void *ctx, const char *data, size_t size) {
+    auto *writer = static_cast<buffer_writer *>(ctx);
+    if (writer->length + 1 < writer->size) {
+        size_t toCopy = std::min(size, writer->size - writer->length - 1);
+        memcpy(writer->buffer + writer->length, data, toCopy);
+    }
+
+    writer->length += size;
+}
+
+/**
+ * A frame_writer writing to a std::ostream
  */
-static inline std::string removeSlash(const std::string &str) {
-    return str.substr(str.rfind(STACKTRACE_SLASH) + 1);
+static void writeToStream(void *ctx, const char *data, size_t size) {
+    static_cast<std::ostream *>(ctx)->write(data, (std::streamsize) size);
+}
+
+void frame::formatTo(frame_writer write, void *ctx, bool fullPaths) const {
+    writeString(write, ctx, function);
+
+    std::string_view file = getFile();
+    if (file.empty()) return;
+
+    writeString(write, ctx, " in ");
+    writeString(write, ctx, fullPaths ? fullFile : file);
+
+    if (line != 0) {
+        writeString(write, ctx, ":");
+        writeDecimal(write, ctx, line);
+    }
+
+    if (inlined) writeString(write, ctx, " (inlined)");
+}
+
+STACKTRACE_NODISCARD std::string frame::toString(bool fullPaths) const {
+    std::string res;
+    formatTo(appendToString, &res, fullPaths);
+
+    return res;
+}
+
+STACKTRACE_NODISCARD size_t frame::hash() const noexcept {
+    size_t res = hashCombine(0, (uintptr_t) address);
+    res = hashCombine(res, function.empty() ? 0 : (uintptr_t) function.data());
+    res = hashCombine(res, fullFile.empty() ? 0 : (uintptr_t) fullFile.data());
+    res = hashCombine(res, line);
+
+    return hashCombine(res, inlined);
+}
+
+STACKTRACE_NODISCARD bool frame::operator==(const frame &other) const noexcept {
+    return address == other.address && line == other.line && inlined == other.inlined &&
+           sameInterned(function, other.function) && sameInterned(fullFile, other.fullFile);
+}
+
+STACKTRACE_NODISCARD bool frame::operator!=(const frame &other) const noexcept {
+    return !(*this == other);
 }
 
 #ifdef STACKTRACE_WINDOWS
@@ -79,17 +402,17 @@ symbol_info_ptr getSymbolInfo() {
     return symbol_info_ptr(symbol, free);
 }
 
-// win_frame ==========================
-
-win_frame::win_frame(const void *address) : frame(address) {}
+// windows frames =====================
 
-win_frame::win_frame(const win_frame &f) : frame(f) {}
-
-win_frame::win_frame(win_frame &&f) noexcept: frame(std::move(f)) {}
-
-// win_debug_frame ====================
-
-STACKTRACE_UNUSED win_debug_frame::win_debug_frame(const void *address, const handle_ptr &handle) : win_frame(address) {
+/**
+ * Resolve an address using the debug information of its module.
+ * Throws a frameCreationException if the address could not be resolved.
+ *
+ * @param address the address to resolve
+ * @param handle the handle of this process
+ * @return the resolved frame
+ */
+static frame createDebugFrame(const void *address, const handle_ptr &handle) {
     symbol_info_ptr symbol = getSymbolInfo();
     if (!symbol) {
         throw frameCreationException("Unable to allocate a SYMBOL_INFO struct");
@@ -100,8 +423,6 @@ STACKTRACE_UNUSED win_debug_frame::win_debug_frame(const void *address, const ha
         throw frameCreationException("Unable to get the function name from the address");
     }
 
-    function = symbol->Name;
-
     unsigned long dwDisplacement;
     IMAGEHLP_LINE64 line64;
     line64.SizeOfStruct = sizeof(IMAGEHLP_LINE64);
@@ -111,34 +432,9 @@ STACKTRACE_UNUSED win_debug_frame::win_debug_frame(const void *address, const ha
         throw frameCreationException("Unable to get information from the address");
     }
 
-    line = line64.LineNumber;
-    fullFile = line64.FileName;
-    file = removeSlash(fullFile);
-}
-
-win_debug_frame::win_debug_frame(const win_debug_frame &f) : win_frame(f) {}
-
-win_debug_frame::win_debug_frame(win_debug_frame &&f) noexcept: win_frame(std::move(f)) {}
-
-STACKTRACE_NODISCARD std::string win_debug_frame::toString(bool fullPaths) const {
-    std::string res = getFunction();
-    res.append(" in ");
-
-    if (fullPaths) res.append(this->getFullFilePath());
-    else res.append(this->getFile());
-
-    res.append(":").append(std::to_string(this->getLine()));
-    return res;
-}
-
-STACKTRACE_NODISCARD win_frame_type win_debug_frame::getType() const noexcept {
-    return win_frame_type::debug;
+    return frame(symbol->Name, line64.FileName, line64.LineNumber, address);
 }
 
-win_debug_frame::~win_debug_frame() = default;
-
-// win_release_frame ==================
-
 // A struct for storing information about a module
 struct module {
     // The module name
@@ -167,8 +463,15 @@ int __stdcall enumModules(const char *name, uint64_t baseAddr, void *ctx) {
     return true;
 }
 
-STACKTRACE_UNUSED win_release_frame::win_release_frame(const void *address, const handle_ptr &handle) : win_frame(
-        address) {
+/**
+ * Resolve an address using the symbol table only. The module name is used as the file name.
+ * Throws a frameCreationException if the address could not be resolved.
+ *
+ * @param address the address to resolve
+ * @param handle the handle of this process
+ * @return the resolved frame
+ */
+static frame createReleaseFrame(const void *address, const handle_ptr &handle) {
     // vec is static so it only has to be filled once.
     // It stores the modules retrieved by SymEnumerateModules64
     static std::vector<module> vec;
@@ -214,6 +517,7 @@ STACKTRACE_UNUSED win_release_frame::win_release_frame(const void *address, cons
     }
 
     // Try to use SymFromAddr(4) to get the function name
+    std::string function;
     symbol_info_ptr symbol = getSymbolInfo();
     if (symbol && SymFromAddr(handle.get(), (intptr_t) address, nullptr, symbol.get())) {
         function = symbol->Name;
@@ -223,34 +527,13 @@ STACKTRACE_UNUSED win_release_frame::win_release_frame(const void *address, cons
     // as a function name
     if (function.size() <= 1) {
         // Convert the function address to a hexadecimal string the length of intptr_t
-        std::stringstream ss;
-        ss << "0x" << std::uppercase << std::hex << std::setfill('0') << std::setw(sizeof(intptr_t) * 2)
-           << (intptr_t) address;
-
-        function = ss.str();
+        function = addressToString(address);
     }
 
     // We use the module name as the file name, no full file path exists.
-    file = m->name;
-}
-
-win_release_frame::win_release_frame(const win_release_frame &f) : win_frame(f) {}
-
-win_release_frame::win_release_frame(win_release_frame &&f) noexcept: win_frame(std::move(f)) {}
-
-STACKTRACE_NODISCARD std::string win_release_frame::toString(bool) const {
-    std::string res = getFunction();
-    res.append(" in ").append(getFile());
-
-    return res;
+    return frame(function, m->name, 0, address);
 }
 
-STACKTRACE_NODISCARD win_frame_type win_release_frame::getType() const noexcept {
-    return win_frame_type::release;
-}
-
-win_release_frame::~win_release_frame() = default;
-
 // getHandle ==========================
 
 /**
@@ -269,291 +552,6472 @@ handle_ptr getHandle() {
     return handle;
 }
 
-#endif //Windows
-
-#ifdef STACKTRACE_UNIX
+/**
+ * Get the handle of this process. The handle is shared by every
+ * stacktrace object and will be created if it does not exist.
+ *
+ * @return the handle_ptr
+ */
+const handle_ptr &getProcessHandle() {
+    static handle_ptr handle;
+    if (!handle) {
+        SymSetOptions(SYMOPT_LOAD_LINES);
+        handle = getHandle();
+    }
 
-// unix_frame =========================
-unix_frame::unix_frame(void *address) : frame(address) {
-    // Get the symbols using backtrace_symbols(2)
-    char **symbols = backtrace_symbols(&address, 1);
+    return handle;
+}
 
-    if (!init_using_addr2line(symbols[0])) {
-        // Init using addr2line failed.
-        // Try to use dladdr to get function name
-        Dl_info dli;
-        bool dladdr_ok = dladdr(address, &dli);
+#endif //Windows
 
-        // If dladdr returned a valid function name, use it
-        if (dladdr_ok && dli.dli_sname) {
-            // Demangle the function name
-            int status = -1;
-            char *demangled = abi::__cxa_demangle(dli.dli_sname, nullptr, nullptr, &status);
-            if (status == 0) {
-                function = demangled;
-            } else {
-                function = dli.dli_sname;
-            }
+#ifdef STACKTRACE_UNIX
 
-            // Set the file name
-            fullFile = dli.dli_fname;
-            file = removeSlash(fullFile);
-            free(demangled);
-        } else if (dladdr_ok && dli.dli_fname) { // dladdr failed to get the function name
-            // dladdr was able to get the file name, use it
-            std::stringstream ss;
-            ss << "0x" << std::uppercase << std::hex << std::setfill('0') << std::setw(sizeof(intptr_t) * 2)
-               << (intptr_t) address;
+// symbol cache =======================
 
-            function = ss.str();
-            fullFile = dli.dli_fname;
-            file = removeSlash(fullFile);
-        } else {
-            // dladdr failed, fall back to backtrace_symbols(2)
-            function = symbols[0];
-        }
-    }
-    free(symbols);
-}
+/**
+ * Get the module an address is in
+ *
+ * @param address the address
+ * @param dli the Dl_info struct to write the module information to
+ * @param bias will be set to the difference between the module's addresses and the addresses in the module file
+ * @return true, if the module was found
+ */
+static bool getModule(const void *address, Dl_info &dli, uintptr_t &bias) {
+#if defined(__GLIBC__)
+    link_map *map = nullptr;
+    if (!dladdr1(address, &dli, (void **) &map, RTLD_DL_LINKMAP)) return false;
+    bias = map ? map->l_addr : (uintptr_t) dli.dli_fbase;
+#else
+    if (!dladdr(address, &dli)) return false;
+    bias = (uintptr_t) dli.dli_fbase;
+#endif //glibc
 
-unix_frame::unix_frame(const std::string &function, const std::string &fullFile, const std::string &file, size_t line,
-                       const void *address) : frame(address) {
-    this->function = function;
-    this->fullFile = fullFile;
-    this->file = file;
-    this->line = line;
+    return true;
 }
 
 /**
- * Copy constructor
- *
- * @param f the frame to copy from
+ * A resolved frame stored in the symbol cache
  */
-unix_frame::unix_frame(const unix_frame &f) = default;
+struct cached_frame {
+    std::string function;
+    std::string fullFile;
+    size_t line = 0;
+    bool inlined = false;
+};
 
 /**
- * Move constructor
- *
- * @param f the frame to move
+ * A resolved address stored in the symbol cache
  */
-unix_frame::unix_frame(unix_frame &&f) noexcept: frame(std::move(f)) {}
+struct cached_address {
+    // The level the address was resolved with
+    resolve_level level = resolve_level::raw;
+
+    // The frames of the address. The inlined frames
+    // come first, the frame of the actual function last
+    std::vector<cached_frame> frames;
+
+    /**
+     * Get the estimated size of this address
+     *
+     * @return the size in bytes
+     */
+    STACKTRACE_NODISCARD size_t bytes() const noexcept {
+        size_t size = sizeof(std::pair<const void *, cached_address>);
+        for (const cached_frame &f : frames) {
+            size += sizeof(cached_frame) + f.function.capacity() + f.fullFile.capacity();
+        }
+
+        return size;
+    }
+};
 
 /**
- * Convert this to a string
- *
- * @param fullPath whether to use full paths
- * @return this frame as a string
+ * Everything cached for a single module
  */
-STACKTRACE_NODISCARD std::string unix_frame::toString(bool fullPath) const {
-    if (!file.empty()) {
-        std::string res = function;
-        res.append(" in ");
-        if (fullPath) res.append(fullFile);
-        else res.append(file);
+struct cached_module {
+    // The path of the module
+    std::string path;
 
-        if (line != 0) res.append(":").append(std::to_string(line));
+    // The file holding the symbol and line tables or null if they are not loaded.
+    // Paths to the same file share it, so its size is tracked by symbol_cache
+    addr2line_file *file = nullptr;
 
-        return res;
-    } else {
-        return function;
-    }
-}
+    // The resolved addresses of this module
+    std::unordered_map<const void *, cached_address> frames;
 
-bool unix_frame::init_using_addr2line(STACKTRACE_UNUSED const char *backtrace_sym) {
-#ifndef STACKTRACE_NO_ADDR2LINE
-    set_options(true, true, true, nullptr);
+    // The estimated size of the resolved addresses
+    size_t frameBytes = 0;
 
-    addr2line::addr2line_res res = addr2line::processAddress(backtrace_sym);
-    if (res.status == 0 && !res.info.empty()) {
-        this->function = res.info[0].name;
-        this->fullFile = res.info[0].filename;
-        this->file = res.info[0].basename;
-        this->line = res.info[0].line;
+    // The demangled names of this module, with the mangled names as keys
+    std::unordered_map<std::string, std::string> names;
 
-        return !function.empty() && !file.empty() && !fullFile.empty();
-    } else {
-        return false;
+    // The estimated size of the demangled names
+    size_t nameBytes = 0;
+
+    /**
+     * Get the estimated size of the frames and names cached for this module
+     *
+     * @return the size in bytes
+     */
+    STACKTRACE_NODISCARD size_t bytes() const noexcept {
+        return frameBytes + nameBytes;
     }
-#else
-    return false;
-#endif
-}
+};
 
-#endif //Unix
+/**
+ * An address waiting to be resolved
+ */
+struct pending_address {
+    // The address
+    void *address = nullptr;
 
-// stacktrace =========================
+    // The result of dladdr
+    Dl_info dli = {};
 
-stacktrace::stacktrace(STACKTRACE_UNUSED unsigned long framesToSkip, size_t maxFrames) : frames() {
-    std::vector<void *> raw_frames(maxFrames, nullptr);
-#ifdef STACKTRACE_WINDOWS
-    size_t captured = ::RtlCaptureStackBackTrace(framesToSkip, (u_long) raw_frames.size(),
-                                                 raw_frames.data(),
-                                                 nullptr);
+    // Whether dladdr succeeded
+    bool dladdrOk = false;
+
+    // The offset of the address in the module file
+    uintptr_t offset = 0;
+};
 
-    SymSetOptions(SYMOPT_LOAD_LINES);
+#ifndef __APPLE__
 
-    // A handle for windows. Static to be used by every stacktrace object.
-    // Will be created if it does not exist.
-    static handle_ptr handle;
-    if (!handle) {
-        handle = getHandle();
+/**
+ * The offsets in a module sent to a symbolizer daemon
+ */
+struct symbolizer_query {
+    // The absolute path of the module
+    std::string path;
+
+    // The build id of the module or an empty string if it has none
+    std::string buildId;
+
+    // The offsets in the module file
+    std::vector<uintptr_t> offsets;
+};
+
+// Defined in the symbolizer section
+static bool getModuleIdentity(const void *address, std::string &path, std::string &buildId);
+
+// Defined in the symbolizer section
+static bool symbolizeRemotely(const std::string &socketPath, size_t timeout,
+                              const std::vector<symbolizer_query> &queries, resolve_level level,
+                              std::vector<std::vector<std::vector<cached_frame>>> &res);
+
+#endif //!Apple
+
+/**
+ * A cache for all symbol data. All modules share a single memory limit,
+ * if it is exceeded, the least recently used modules are evicted.
+ */
+class symbol_cache {
+public:
+    /**
+     * Get the symbol cache instance
+     *
+     * @return the symbol cache
+     */
+    static symbol_cache &instance() {
+        static symbol_cache cache;
+        return cache;
     }
 
-    raw_frames.resize(captured);
-#else
-    size_t captured = backtrace(raw_frames.data(), raw_frames.size());
+    /**
+     * Resolve an address or get it from the cache.
+     * Only addresses resolved with at least resolve_level::function are cached.
+     *
+     * @param address the address to resolve
+     * @param level the level of detail to resolve the address with
+     * @return the resolved frames. The inlined frames come first, the frame of the actual function last
+     */
+    std::vector<cached_frame> resolve(void *address, resolve_level level) {
+        return resolve(std::vector<void *>{address}, level).begin()->second;
+    }
 
-    raw_frames.resize(captured);
+    /**
+     * Resolve many addresses at once. Every unique address is only resolved once
+     * and all addresses of a module are resolved using a single call to addr2line.
+     * If a symbolizer daemon is set, all addresses are sent to it in a single request.
+     *
+     * @param addresses the addresses to resolve
+     * @param level the level of detail to resolve the addresses with
+     * @param remote whether to use the symbolizer daemon, if one is set
+     * @return the resolved frames of every unique address
+     */
+    std::unordered_map<const void *, std::vector<cached_frame>>
+    resolve(std::vector<void *> addresses, resolve_level level, STACKTRACE_UNUSED bool remote = true) {
+        std::sort(addresses.begin(), addresses.end());
+        addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
 
-    for (void *ptr : raw_frames) {
-        if (ptr) {
-            try {
-                frames.push_back(new unix_frame(ptr));
-            } catch (...) {
-                // Ignore
+        std::unordered_map<const void *, std::vector<cached_frame>> res;
+        if (level == resolve_level::raw) {
+            for (void *address : addresses) {
+                cached_frame frame;
+                frame.function = addressToString(address);
+                res[address] = {frame};
             }
-        } else {
-            break;
+
+            return res;
         }
-    }
-#endif //Windows
 
-#ifdef STACKTRACE_WINDOWS
-#ifndef NDEBUG // Don't even try to use *_debug_frame in release builds
-    for (void *ptr : raw_frames) {
-        if (ptr) {
-            try {
-                frames.push_back(new win_debug_frame(ptr, handle));
-            } catch (std::exception &e) {
-#ifdef STACKTRACE_SHOW_ERRORS // Print errors if requested
-                std::cerr << "[stacktrace.hpp:" << __LINE__ << "] Exception thrown: " << e.what() << std::endl;
-#elif defined(UNREFERENCED_PARAMETER)
-                UNREFERENCED_PARAMETER(e);
-#endif //SHOW_ERRORS
-            } catch (...) {
-                // Ignore
-            }
-        } else {
-            // ptr = nullptr, all frames were converted
-            break;
+        // Group the addresses by module
+        std::map<std::string, std::vector<pending_address>> groups;
+        for (void *address : addresses) {
+            pending_address pending;
+            uintptr_t bias = 0;
+            pending.address = address;
+            pending.dladdrOk = getModule(address, pending.dli, bias);
+            pending.offset = (uintptr_t) address - bias;
+
+            groups[pending.dladdrOk && pending.dli.dli_fname ? pending.dli.dli_fname : ""].push_back(pending);
         }
-    }
-#endif //Debug
 
-    // If frames is empty, use win_release_frame
-    if (frames.empty()) {
-        for (void *ptr : raw_frames) {
-            if (ptr) {
-                try {
-                    frames.push_back(new win_release_frame(ptr, handle));
-                } catch (std::exception &e) {
-#ifdef STACKTRACE_SHOW_ERRORS // Print errors if requested
-                    std::cerr << "[stacktrace.hpp:" << __LINE__ << "] Exception thrown: " << e.what() << std::endl;
-#elif defined(UNREFERENCED_PARAMETER)
-                    UNREFERENCED_PARAMETER(e);
-#endif //SHOW_ERRORS
-                } catch (...) {
-                    // Ignore
+        if (level == resolve_level::module_offset) {
+            for (const auto &group : groups) {
+                for (const pending_address &pending : group.second) {
+                    cached_frame frame;
+                    if (!group.first.empty()) {
+                        char buffer[3 + sizeof(uintptr_t) * 2] = {'+', '0', 'x'};
+                        size_t len = 3 + formatHex(buffer + 3, pending.offset);
+
+                        frame.function.assign(buffer, len);
+                        frame.fullFile = group.first;
+                    } else {
+                        frame.function = addressToString(pending.address);
+                    }
+
+                    res[pending.address] = {frame};
                 }
-            } else {
-                // ptr = nullptr, all frames were converted
-                break;
             }
+
+            return res;
         }
-    }
-#endif //Windows
-}
 
-stacktrace::stacktrace(const stacktrace &trace) : frames() {
-    copyFrames(trace.getFrames());
-}
+        std::unique_lock<std::mutex> lock(mtx);
 
-stacktrace::stacktrace(stacktrace &&trace) noexcept: frames(std::move(trace.frames)) {}
+        // Only resolve the addresses not in the cache
+        std::vector<std::pair<std::string, std::vector<pending_address>>> missing;
+        for (const auto &group : groups) {
+            cached_module &m = touch(group.first);
 
-stacktrace &stacktrace::operator=(const stacktrace &trace) {
-    copyFrames(trace.getFrames());
-    return *this;
-}
+            std::vector<pending_address> pending;
+            for (const pending_address &p : group.second) {
+                auto it = m.frames.find(p.address);
+                if (it != m.frames.end() && it->second.level >= level) {
+                    res[p.address] = select(m, it->second, level);
+                } else {
+                    pending.push_back(p);
+                }
+            }
 
-stacktrace &stacktrace::operator=(stacktrace &&trace) noexcept {
-    frames = std::move(trace.frames);
-    return *this;
+            if (!pending.empty()) missing.emplace_back(group.first, std::move(pending));
+        }
+
+        // The frames resolved by the symbolizer daemon, by module
+        std::vector<std::vector<std::vector<cached_frame>>> remoteFrames;
+#ifndef __APPLE__
+        if (remote && !symbolizer.empty() && !missing.empty()) {
+            std::vector<symbolizer_query> queries(missing.size());
+            for (size_t i = 0; i < missing.size(); i++) {
+                if (missing[i].first.empty() ||
+                    !getModuleIdentity(missing[i].second.front().address, queries[i].path, queries[i].buildId)) {
+                    continue;
+                }
+
+                for (const pending_address &pending : missing[i].second) {
+                    queries[i].offsets.push_back(pending.offset);
+                }
+            }
+
+            // The daemon may run in this process, so the cache must not be locked while waiting for it
+            const std::string socketPath = symbolizer;
+            const size_t timeout = symbolizerTimeout;
+            lock.unlock();
+            if (!symbolizeRemotely(socketPath, timeout, queries, level, remoteFrames)) {
+                remoteFrames.clear();
+            }
+
+            lock.lock();
+        }
+#endif //!Apple
+
+        for (size_t i = 0; i < missing.size(); i++) {
+            cached_module &m = touch(missing[i].first);
+            const std::vector<pending_address> &pending = missing[i].second;
+
+            std::vector<cached_address> resolved =
+                    resolveAddresses(m, pending, level, remoteFrames.empty() ? nullptr : &remoteFrames[i]);
+            for (size_t j = 0; j < pending.size(); j++) {
+                res[pending[j].address] = select(m, resolved[j], level);
+                store(m, pending[j].address, std::move(resolved[j]));
+            }
+        }
+
+        evict();
+        return res;
+    }
+
+    /**
+     * Load the symbol and line tables of a module
+     *
+     * @param path the path of the module
+     * @param readLines whether to read the line tables
+     * @param maxBytes the max number of bytes the module may use or 0 for no limit
+     * @param loaded will be set to the number of bytes used by the module
+     * @return true, if the module was loaded
+     */
+    bool loadModule(STACKTRACE_UNUSED const std::string &path, STACKTRACE_UNUSED bool readLines,
+                    STACKTRACE_UNUSED size_t maxBytes, STACKTRACE_UNUSED size_t &loaded) {
+#ifndef STACKTRACE_NO_ADDR2LINE
+        std::unique_lock<std::mutex> lock(mtx);
+        cached_module &m = touch(path);
+        addr2line_file *file = nullptr;
+        if (addr2line::loadFile(path.c_str(), readLines, maxBytes, loaded, file) != 0) {
+            return false;
+        }
+
+        setTable(m, file, loaded);
+        evict();
+        return true;
+#else
+        return false;
+#endif //addr2line
+    }
+
+    /**
+     * Resolve offsets in a module file using addr2line. The file does not have to be loaded
+     * into this process. The results are not cached, as they have no address.
+     *
+     * @param path the path of the module
+     * @param offsets the offsets in the module
+     * @param level the level of detail to resolve the offsets with
+     * @return the frames of every offset, the inlined frames first. The frames
+     *         of offsets which could not be resolved are left empty
+     */
+    std::vector<std::vector<cached_frame>> lookupOffsets(STACKTRACE_UNUSED const std::string &path,
+                                                         const std::vector<uintptr_t> &offsets,
+                                                         STACKTRACE_UNUSED resolve_level level) {
+        std::vector<cached_address> resolved(offsets.size());
+#ifndef STACKTRACE_NO_ADDR2LINE
+        if (level > resolve_level::module_offset) {
+            std::vector<pending_address> pending(offsets.size());
+            for (size_t i = 0; i < offsets.size(); i++) {
+                pending[i].address = (void *) offsets[i];
+                pending[i].offset = offsets[i];
+            }
+
+            std::unique_lock<std::mutex> lock(mtx);
+            resolveUsingAddr2line(touch(path), pending, level, resolved);
+            evict();
+        }
+#endif //addr2line
+
+        std::vector<std::vector<cached_frame>> res(offsets.size());
+        for (size_t i = 0; i < offsets.size(); i++) {
+            res[i] = std::move(resolved[i].frames);
+        }
+
+        return res;
+    }
+
+    /**
+     * Resolve offsets in a module file, which does not have to be loaded into this process.
+     * Uses the symbolizer daemon if one is set, addr2line otherwise. The offsets which
+     * could not be resolved get a frame containing the offset.
+     *
+     * @param path the path of the module
+     * @param offsets the offsets in the module
+     * @param level the level of detail to resolve the offsets with
+     * @return the frames of every offset, the inlined frames first
+     */
+    std::vector<std::vector<cached_frame>> resolveOffsets(const std::string &path,
+                                                          const std::vector<uintptr_t> &offsets,
+                                                          resolve_level level) {
+        std::vector<std::vector<cached_frame>> res;
+#ifndef __APPLE__
+        std::unique_lock<std::mutex> lock(mtx);
+        const std::string socketPath = symbolizer;
+        const size_t timeout = symbolizerTimeout;
+        lock.unlock();
+
+        std::vector<std::vector<std::vector<cached_frame>>> remoteFrames;
+        if (!socketPath.empty() && level > resolve_level::module_offset &&
+            symbolizeRemotely(socketPath, timeout, {{path, "", offsets}}, level, remoteFrames)) {
+            res = std::move(remoteFrames.front());
+        }
+#endif //!Apple
+
+        if (res.empty()) {
+            res = lookupOffsets(path, offsets, level);
+        }
+
+        for (size_t i = 0; i < offsets.size(); i++) {
+            if (!res[i].empty()) continue;
+
+            char buffer[3 + sizeof(uintptr_t) * 2] = {'+', '0', 'x'};
+            size_t len = 3 + formatHex(buffer + 3, offsets[i]);
+
+            cached_frame frame;
+            frame.function.assign(buffer, len);
+            frame.fullFile = path;
+            res[i].push_back(std::move(frame));
+        }
+
+        return res;
+    }
+
+    /**
+     * Set the max number of bytes the cache may use
+     *
+     * @param max the limit or 0 for no limit
+     */
+    void setLimit(size_t max) {
+        std::unique_lock<std::mutex> lock(mtx);
+        limit = max;
+        evict();
+    }
+
+    /**
+     * Set the symbolizer daemon used to resolve addresses
+     *
+     * @param socketPath the path of the socket of the daemon or an empty string to resolve in this process
+     * @param timeout the max time to wait for the daemon in milliseconds
+     */
+    void setSymbolizer(const std::string &socketPath, size_t timeout) {
+        std::unique_lock<std::mutex> lock(mtx);
+        symbolizer = socketPath;
+        symbolizerTimeout = timeout;
+    }
+
+    /**
+     * Check if a symbolizer daemon is set
+     *
+     * @return true, if addresses are sent to a symbolizer daemon
+     */
+    bool hasSymbolizer() {
+        std::unique_lock<std::mutex> lock(mtx);
+        return !symbolizer.empty();
+    }
+
+    /**
+     * Remove everything from the cache
+     */
+    void clear() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!modules.empty()) {
+            remove(std::prev(modules.end()));
+        }
+    }
+
+    /**
+     * Get the cache statistics
+     *
+     * @return the statistics
+     */
+    cache_stats getStats() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cache_stats stats;
+        stats.bytes = bytes;
+        stats.maxBytes = limit;
+        stats.evictions = evictions;
+
+        for (const cached_module &m : modules) {
+            module_cache_stats module_stats;
+            module_stats.path = m.path;
+            auto table = tables.find(m.file);
+            module_stats.tableBytes = table != tables.end() ? table->second.bytes : 0;
+            module_stats.frameBytes = m.frameBytes;
+            module_stats.nameBytes = m.nameBytes;
+            module_stats.frames = m.frames.size();
+
+            stats.modules.push_back(module_stats);
+        }
+
+        return stats;
+    }
+
+private:
+    /**
+     * The symbol and line tables of a file, shared by all modules with a path to it
+     */
+    struct loaded_table {
+        // The estimated size of the tables
+        size_t bytes = 0;
+
+        // The number of modules using the tables
+        size_t users = 0;
+    };
+
+    symbol_cache() : mtx(), modules(), index(), tables(), bytes(0), limit(0), evictions(0), symbolizer(),
+                     symbolizerTimeout(0) {}
+
+    /**
+     * Get a module and mark it as the most recently used one.
+     * Creates the module if it does not exist.
+     *
+     * @param path the path of the module
+     * @return the module
+     */
+    cached_module &touch(const std::string &path) {
+        auto it = index.find(path);
+        if (it != index.end()) {
+            modules.splice(modules.begin(), modules, it->second);
+        } else {
+            modules.emplace_front();
+            modules.front().path = path;
+            index.emplace(path, modules.begin());
+        }
+
+        return modules.front();
+    }
+
+    /**
+     * Remove a module from the cache
+     *
+     * @param it the module to remove
+     */
+    void remove(std::list<cached_module>::iterator it) {
+        releaseTable(*it);
+        bytes -= it->bytes();
+        index.erase(it->path);
+        modules.erase(it);
+    }
+
+    /**
+     * Evict the least recently used modules until the limit is no longer exceeded
+     */
+    void evict() {
+        while (limit != 0 && bytes > limit && !modules.empty()) {
+            remove(std::prev(modules.end()));
+            evictions++;
+        }
+    }
+
+    /**
+     * Set the symbol and line tables of a module. The size of the tables
+     * is only counted once, no matter how many modules use them.
+     *
+     * @param m the module
+     * @param file the file holding the tables
+     * @param tableBytes the size of the tables
+     */
+    void setTable(cached_module &m, addr2line_file *file, size_t tableBytes) {
+        if (m.file != file) {
+            releaseTable(m);
+            m.file = file;
+            tables[file].users++;
+        }
+
+        loaded_table &table = tables[file];
+        bytes = bytes - table.bytes + tableBytes;
+        table.bytes = tableBytes;
+    }
+
+    /**
+     * Stop using the symbol and line tables of a module.
+     * The tables are unloaded once no module uses them anymore.
+     *
+     * @param m the module
+     */
+    void releaseTable(cached_module &m) {
+        auto it = tables.find(m.file);
+        m.file = nullptr;
+        if (it == tables.end() || --it->second.users > 0) return;
+
+        bytes -= it->second.bytes;
+#ifndef STACKTRACE_NO_ADDR2LINE
+        addr2line::unloadFile(it->first);
+#endif //addr2line
+        tables.erase(it);
+    }
+
+    /**
+     * Store a resolved address in the cache, replacing any previous value
+     *
+     * @param m the module the address is in
+     * @param address the address
+     * @param resolved the resolved address
+     */
+    void store(cached_module &m, const void *address, cached_address &&resolved) {
+        auto it = m.frames.find(address);
+        if (it != m.frames.end()) {
+            m.frameBytes -= it->second.bytes();
+            bytes -= it->second.bytes();
+            m.frames.erase(it);
+        }
+
+        size_t size = resolved.bytes();
+        m.frames.emplace(address, std::move(resolved));
+        m.frameBytes += size;
+        bytes += size;
+    }
+
+    /**
+     * Get the frames of a resolved address for a level of detail
+     * which may be lower than the one the address was resolved with
+     *
+     * @param m the module the address is in
+     * @param address the resolved address
+     * @param level the level to get the frames for
+     * @return the frames
+     */
+    static std::vector<cached_frame> select(const cached_module &m, const cached_address &address,
+                                            resolve_level level) {
+        if (level == address.level || address.frames.empty()) {
+            return address.frames;
+        }
+
+        // Only use the frame of the actual function
+        cached_frame frame = address.frames.back();
+        if (level == resolve_level::function && !m.path.empty()) {
+            // Use the module as file name, like the symbol table lookup does
+            frame.fullFile = m.path;
+            frame.line = 0;
+        }
+
+        return {frame};
+    }
+
+    /**
+     * Demangle a function name or get it from the cache
+     *
+     * @param m the module the function is in
+     * @param name the mangled name
+     * @return the demangled name or name if it could not be demangled
+     */
+    std::string demangle(cached_module &m, const char *name) {
+        auto it = m.names.find(name);
+        if (it != m.names.end()) {
+            return it->second;
+        }
+
+        int status = -1;
+        char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        std::string res = status == 0 ? demangled : name;
+        free(demangled);
+
+        size_t size = sizeof(std::pair<const std::string, std::string>) + res.capacity() + strlen(name);
+        m.names.emplace(name, res);
+        m.nameBytes += size;
+        bytes += size;
+
+        return res;
+    }
+
+#ifndef STACKTRACE_NO_ADDR2LINE
+
+    /**
+     * Try to get the file names, function names and lines using the addr2line tool.
+     * All addresses are resolved with a single call to addr2line.
+     *
+     * @param m the module the addresses are in
+     * @param addresses the addresses to resolve
+     * @param level the level of detail to resolve the addresses with
+     * @param resolved the resolved addresses to write the frames to. The frames
+     *                 of addresses which could not be resolved are left empty
+     */
+    void resolveUsingAddr2line(cached_module &m, const std::vector<pending_address> &addresses, resolve_level level,
+                               std::vector<cached_address> &resolved) {
+        if (m.path.empty()) return;
+
+        // Load the tables through the cache, so their size is known
+        size_t loaded = 0;
+        addr2line_file *file = nullptr;
+        if (m.file == nullptr && addr2line::loadFile(m.path.c_str(), false, 0, loaded, file) == 0) {
+            setTable(m, file, loaded);
+        }
+
+        std::vector<std::string> hex;
+        std::vector<const char *> addr;
+        for (const pending_address &pending : addresses) {
+            char buffer[2 + sizeof(uintptr_t) * 2] = {'0', 'x'};
+            size_t len = 2 + formatHex(buffer + 2, pending.offset);
+            hex.emplace_back(buffer, len);
+        }
+
+        for (const std::string &h : hex) addr.push_back(h.c_str());
+
+        // Only read the line tables if line numbers are requested
+        addr2line::options opts;
+        opts.readLines = level != resolve_level::function;
+        opts.collectInlines = level == resolve_level::full;
+
+        addr2line::addr2line_res res = addr2line::process(m.path.c_str(), addr.data(), (int) addr.size(), opts);
+
+        // Building the function index changes the size of the tables
+        if (!opts.readLines && addr2line::loadFile(m.path.c_str(), false, 0, loaded, file) == 0) {
+            setTable(m, file, loaded);
+        }
+
+        if (res.status != 0 || res.info.size() != addresses.size()) {
+            return;
+        }
+
+        // The inlined functions, mapped by the address they were inlined at
+        std::unordered_map<unsigned long, std::vector<const address_info *>> inlined;
+        for (const address_info &info : res.inlined) {
+            inlined[info.address].push_back(&info);
+        }
+
+        for (size_t i = 0; i < addresses.size(); i++) {
+            // addr2line stores the addresses in reverse order
+            const address_info &info = res.info[addresses.size() - 1 - i];
+
+            cached_frame frame;
+            frame.function = info.name;
+            if (level == resolve_level::function) {
+                frame.fullFile = m.path;
+
+                if (frame.function.empty()) continue;
+            } else {
+                frame.fullFile = info.filename;
+                frame.line = info.line;
+
+                if (frame.function.empty() || frame.fullFile.empty()) continue;
+            }
+
+            auto it = inlined.find(info.address);
+            if (it != inlined.end()) {
+                for (const address_info *inlined_info : it->second) {
+                    cached_frame inlined_frame;
+                    inlined_frame.function = inlined_info->name;
+                    inlined_frame.fullFile = inlined_info->filename;
+                    inlined_frame.line = inlined_info->line;
+                    inlined_frame.inlined = true;
+
+                    resolved[i].frames.push_back(std::move(inlined_frame));
+                }
+            }
+
+            resolved[i].frames.push_back(std::move(frame));
+        }
+    }
+
+#endif //addr2line
+
+    /**
+     * Resolve addresses of a module
+     *
+     * @param m the module the addresses are in
+     * @param addresses the addresses to resolve
+     * @param level the level of detail to resolve the addresses with
+     * @param remote the frames resolved by the symbolizer daemon or nullptr to use addr2line
+     * @return the resolved addresses, in the same order as addresses
+     */
+    std::vector<cached_address> resolveAddresses(cached_module &m, const std::vector<pending_address> &addresses,
+                                                 resolve_level level,
+                                                 const std::vector<std::vector<cached_frame>> *remote = nullptr) {
+        std::vector<cached_address> resolved(addresses.size());
+        for (cached_address &r : resolved) {
+            r.level = level;
+        }
+
+        if (remote != nullptr) {
+            for (size_t i = 0; i < addresses.size(); i++) {
+                resolved[i].frames = (*remote)[i];
+            }
+        } else {
+#ifndef STACKTRACE_NO_ADDR2LINE
+            resolveUsingAddr2line(m, addresses, level, resolved);
+#endif //addr2line
+        }
+
+        for (size_t i = 0; i < addresses.size(); i++) {
+            // Init using addr2line failed.
+            if (resolved[i].frames.empty()) {
+                resolved[i].frames.push_back(resolveUsingDladdr(m, addresses[i]));
+            }
+        }
+
+        return resolved;
+    }
+
+    /**
+     * Resolve an address using dladdr
+     *
+     * @param m the module the address is in
+     * @param pending the address to resolve
+     * @return the resolved frame
+     */
+    cached_frame resolveUsingDladdr(cached_module &m, const pending_address &pending) {
+        cached_frame frame;
+        const Dl_info &dli = pending.dli;
+
+        // Try to use dladdr to get function name
+        // If dladdr returned a valid function name, use it
+        if (pending.dladdrOk && dli.dli_sname) {
+            // Demangle the function name
+            frame.function = demangle(m, dli.dli_sname);
+
+            // Set the file name
+            frame.fullFile = dli.dli_fname;
+        } else if (pending.dladdrOk && dli.dli_fname) { // dladdr failed to get the function name
+            // dladdr was able to get the file name, use it
+            frame.function = addressToString(pending.address);
+            frame.fullFile = dli.dli_fname;
+        } else {
+            // dladdr failed, fall back to backtrace_symbols(2)
+            void *address = pending.address;
+            char **symbols = backtrace_symbols(&address, 1);
+            frame.function = symbols[0];
+            free(symbols);
+        }
+
+        return frame;
+    }
+
+    std::mutex mtx;
+    // All cached modules, the most recently used one first
+    std::list<cached_module> modules;
+    // The modules mapped by their path
+    std::unordered_map<std::string, std::list<cached_module>::iterator> index;
+    // The loaded symbol and line tables, mapped by their file
+    std::unordered_map<addr2line_file *, loaded_table> tables;
+    // The number of bytes used
+    size_t bytes;
+    // The max number of bytes to use or 0 for no limit
+    size_t limit;
+    // The number of evicted modules
+    size_t evictions;
+    // The socket path of the symbolizer daemon or an empty string
+    std::string symbolizer;
+    // The max time to wait for the symbolizer daemon in milliseconds
+    size_t symbolizerTimeout;
+};
+
+#ifndef __APPLE__
+
+// loaded modules =====================
+
+/**
+ * A module loaded into this process
+ */
+struct loaded_module {
+    // The path of the module, as returned by dladdr
+    std::string path;
+
+    // The address the module was loaded at
+    uintptr_t base;
+};
+
+/**
+ * Add the address of the first loaded segment of a module to
+ * a vector of addresses. This is called via dl_iterate_phdr.
+ */
+static int addModuleAddress(dl_phdr_info *info, size_t, void *data) {
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+            ((std::vector<uintptr_t> *) data)->push_back(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Get all modules loaded into this process.
+ * The module paths are retrieved using dladdr, so they
+ * equal the paths returned by backtrace_symbols(2).
+ *
+ * @return the loaded modules
+ */
+static std::vector<loaded_module> getLoadedModules() {
+    std::vector<uintptr_t> addresses;
+    dl_iterate_phdr(addModuleAddress, &addresses);
+
+    std::vector<loaded_module> modules;
+    for (uintptr_t address : addresses) {
+        Dl_info dli;
+        if (dladdr((void *) address, &dli) && dli.dli_fname && *dli.dli_fname) {
+            modules.push_back({dli.dli_fname, (uintptr_t) dli.dli_fbase});
+        }
+    }
+
+    return modules;
+}
+
+#endif //!Apple
+
+#endif //Unix
+
+// frame resolution =================
+
+/**
+ * Resolve the frames of an address
+ *
+ * @param ptr the address to resolve
+ * @param level the level of detail to resolve the address with
+ * @return the frames of the address. Empty if the address could not be resolved
+ */
+static std::vector<frame> resolveFrames(void *ptr, resolve_level level) {
+#ifdef STACKTRACE_WINDOWS
+    const handle_ptr &handle = getProcessHandle();
+
+#ifndef NDEBUG // Don't even try to use debug frames in release builds
+    // Only the debug frames have line numbers
+    if (level >= resolve_level::function_line) {
+        try {
+            return {createDebugFrame(ptr, handle)};
+        } catch (std::exception &e) {
+#ifdef STACKTRACE_SHOW_ERRORS // Print errors if requested
+            std::cerr << "[stacktrace.hpp:" << __LINE__ << "] Exception thrown: " << e.what() << std::endl;
+#elif defined(UNREFERENCED_PARAMETER)
+            UNREFERENCED_PARAMETER(e);
+#endif //SHOW_ERRORS
+        } catch (...) {
+            // Ignore
+        }
+    }
+#endif //Debug
+
+    // If the debug frame could not be created, use the symbol table only
+    try {
+        return {createReleaseFrame(ptr, handle)};
+    } catch (std::exception &e) {
+#ifdef STACKTRACE_SHOW_ERRORS // Print errors if requested
+        std::cerr << "[stacktrace.hpp:" << __LINE__ << "] Exception thrown: " << e.what() << std::endl;
+#elif defined(UNREFERENCED_PARAMETER)
+        UNREFERENCED_PARAMETER(e);
+#endif //SHOW_ERRORS
+    } catch (...) {
+        // Ignore
+    }
+
+    return {};
+#else
+    std::vector<frame> res;
+    try {
+        for (const cached_frame &f : symbol_cache::instance().resolve(ptr, level)) {
+            res.emplace_back(f.function, f.fullFile, f.line, ptr, f.inlined);
+        }
+    } catch (...) {
+        // Ignore
+        res.clear();
+    }
+
+    return res;
+#endif //Windows
+}
+
+/**
+ * Resolve the frames of many addresses
+ *
+ * @param addresses the addresses to resolve
+ * @param level the level of detail to resolve the addresses with
+ * @return the frames of every unique address which could be resolved
+ */
+static std::unordered_map<const void *, std::vector<frame>>
+resolveFrames(const std::vector<void *> &addresses, resolve_level level) {
+    std::unordered_map<const void *, std::vector<frame>> res;
+#ifdef STACKTRACE_WINDOWS
+    for (void *ptr : addresses) {
+        if (ptr && res.find(ptr) == res.end()) {
+            std::vector<frame> frames = resolveFrames(ptr, level);
+            if (!frames.empty()) res.emplace(ptr, std::move(frames));
+        }
+    }
+#else
+    std::vector<void *> valid;
+    std::copy_if(addresses.begin(), addresses.end(), std::back_inserter(valid), [](void *ptr) {
+        return ptr != nullptr;
+    });
+
+    try {
+        for (const auto &p : symbol_cache::instance().resolve(valid, level)) {
+            std::vector<frame> &frames = res[p.first];
+            for (const cached_frame &f : p.second) {
+                frames.emplace_back(f.function, f.fullFile, f.line, p.first, f.inlined);
+            }
+        }
+    } catch (...) {
+        // Ignore
+    }
+#endif //Windows
+
+    return res;
+}
+
+/**
+ * Get the frame of an address which is not resolved with resolve_level::full
+ *
+ * @param frames the frames of the address
+ * @param address the address
+ * @return the frame of the actual function or a frame only containing the address
+ */
+static frame selectFrame(const std::vector<frame> &frames, const void *address) {
+    if (frames.empty()) {
+        return frame(addressToString(address), std::string_view(), 0, address);
+    } else {
+        return frames.back();
+    }
+}
+
+// trace_format =======================
+
+/**
+ * Get the path of the module an address is in, without allocating any memory
+ *
+ * @param address the address
+ * @param buffer a buffer to write the path to, if required
+ * @param size the size of buffer
+ * @param base will be set to the address the module was loaded at, if not nullptr
+ * @return the path or nullptr if the module could not be found
+ */
+static const char *getModulePath(const void *address, STACKTRACE_UNUSED char *buffer,
+                                 STACKTRACE_UNUSED size_t size, uintptr_t *base = nullptr) {
+#ifdef STACKTRACE_WINDOWS
+    HMODULE module = nullptr;
+    if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                            (LPCSTR) address, &module)) {
+        return nullptr;
+    }
+
+    if (GetModuleFileNameA(module, buffer, (DWORD) size) == 0) {
+        return nullptr;
+    }
+
+    if (base) *base = (uintptr_t) module;
+    return buffer;
+#else
+    Dl_info info;
+    if (dladdr(address, &info) == 0 || info.dli_fname == nullptr || info.dli_fname[0] == '\0') {
+        return nullptr;
+    }
+
+    if (base) *base = (uintptr_t) info.dli_fbase;
+    return info.dli_fname;
+#endif //Windows
+}
+
+void trace_format::formatFrame(size_t index, const frame &f, frame_writer write, void *ctx) const {
+    // Only look up the module if it is used by this format
+    char buffer[260];
+    const char *module = nullptr;
+    if (usesModule) {
+        module = getModulePath(f.getAddress(), buffer, sizeof(buffer));
+        if (module != nullptr) {
+            const char *slash = strrchr(module, STACKTRACE_SLASH);
+            if (slash != nullptr) module = slash + 1;
+        }
+    }
+
+    // Remove the prefix from the full path, if it starts with it
+    std::string_view path = f.getFullFilePath();
+    size_t pathOffset = 0;
+    if (prefixSize > 0 && path.compare(0, prefixSize, prefix) == 0) {
+        pathOffset = prefixSize;
+    }
+
+    // Check whether a field has a value for this frame
+    auto present = [&](format_field field) -> bool {
+        switch (field) {
+            case format_field::module:
+                return module != nullptr;
+            case format_field::function:
+                return !f.getFunction().empty();
+            case format_field::file:
+                return !f.getFile().empty();
+            case format_field::path:
+                return path.size() > pathOffset;
+            case format_field::line:
+                return f.getLine() != 0;
+            case format_field::inlined:
+                return f.isInlined();
+            default:
+                return true;
+        }
+    };
+
+    for (size_t i = 0; i < count; i++) {
+        const format_segment &segment = segments[i];
+        switch (segment.field) {
+            case format_field::text:
+                write(ctx, segment.text, segment.size);
+                break;
+            case format_field::index:
+                writeDecimal(write, ctx, index);
+                break;
+            case format_field::address: {
+                char address[2 + sizeof(uintptr_t) * 2] = {'0', 'x'};
+                write(ctx, address, 2 + formatHex(address + 2, (uintptr_t) f.getAddress(), sizeof(uintptr_t) * 2));
+                break;
+            }
+            case format_field::module:
+                if (module != nullptr) writeString(write, ctx, module);
+                break;
+            case format_field::function:
+                writeString(write, ctx, f.getFunction());
+                break;
+            case format_field::file:
+                writeString(write, ctx, f.getFile());
+                break;
+            case format_field::path:
+                write(ctx, path.data() + pathOffset, path.size() - pathOffset);
+                break;
+            case format_field::line:
+                writeDecimal(write, ctx, f.getLine());
+                break;
+            case format_field::inlined:
+            case format_field::group_end:
+                break;
+            case format_field::group_begin: {
+                // Skip the group if any field directly in it is missing. Nested groups are checked on their own.
+                bool skip = false;
+                for (size_t j = i + 1; j < segment.size && !skip; j++) {
+                    if (segments[j].field == format_field::group_begin) {
+                        j = segments[j].size;
+                    } else {
+                        skip = !present(segments[j].field);
+                    }
+                }
+
+                if (skip) i = segment.size;
+                break;
+            }
+        }
+    }
+}
+
+// serialization ======================
+
+// The first bytes of a serialized stack trace
+static const char serializedMagic[] = {'S', 'T'};
+
+// The version of the serialization format
+static const char serializedVersion = 1;
+
+// The flag set if a serialized stack trace contains symbols
+static const char serializedSymbols = 1;
+
+/**
+ * Append an unsigned LEB128 varint to a string
+ *
+ * @param out the string to append to
+ * @param value the value to append
+ */
+static void writeVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char) (value | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back((char) value);
+}
+
+/**
+ * Read an unsigned LEB128 varint from a string.
+ * Throws std::invalid_argument if the data ends or the varint is too long.
+ *
+ * @param data the data to read from
+ * @param pos the position to read at. Will be moved past the varint
+ * @return the read value
+ */
+static uint64_t readVarint(const std::string &data, size_t &pos) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (pos >= data.size()) {
+            throw std::invalid_argument("Unexpected end of serialized stack trace");
+        }
+
+        auto byte = (uint8_t) data[pos++];
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return value;
+    }
+
+    throw std::invalid_argument("Invalid varint in serialized stack trace");
+}
+
+/**
+ * Append a length-prefixed string to a string
+ *
+ * @param out the string to append to
+ * @param str the string to append
+ */
+static void writeBytes(std::string &out, const std::string &str) {
+    writeVarint(out, str.size());
+    out.append(str);
+}
+
+/**
+ * Read a length-prefixed string from a string.
+ * Throws std::invalid_argument if the data ends.
+ *
+ * @param data the data to read from
+ * @param pos the position to read at. Will be moved past the string
+ * @return the read string
+ */
+static std::string readBytes(const std::string &data, size_t &pos) {
+    uint64_t size = readVarint(data, pos);
+    if (size > data.size() - pos) {
+        throw std::invalid_argument("Unexpected end of serialized stack trace");
+    }
+
+    std::string res = data.substr(pos, (size_t) size);
+    pos += (size_t) size;
+
+    return res;
+}
+
+/**
+ * Read a count from a string, which must not be larger
+ * than the number of remaining bytes in the data
+ *
+ * @param data the data to read from
+ * @param pos the position to read at. Will be moved past the count
+ * @return the read count
+ */
+static size_t readCount(const std::string &data, size_t &pos) {
+    uint64_t count = readVarint(data, pos);
+    if (count > data.size() - pos) {
+        throw std::invalid_argument("Invalid count in serialized stack trace");
+    }
+
+    return (size_t) count;
+}
+
+/**
+ * Get the id of a string, adding it to a table if it does not exist yet
+ *
+ * @tparam T the type of the strings
+ * @param ids the ids of the strings
+ * @param strings the strings in the order of their ids
+ * @param str the string to get the id of
+ * @return the id of the string
+ */
+template<class T>
+static size_t internString(std::unordered_map<T, size_t> &ids, std::vector<const T *> &strings, const T &str) {
+    auto it = ids.emplace(str, strings.size());
+    if (it.second) strings.push_back(&it.first->first);
+
+    return it.first->second;
+}
+
+/**
+ * A frame read from a serialized stack trace
+ */
+struct serialized_frame {
+    // The string id of the function
+    size_t function;
+
+    // The string id of the full file path
+    size_t fullFile;
+
+    // The line
+    size_t line;
+
+    // Whether the function was inlined
+    bool inlined;
+};
+
+/**
+ * Get the addresses the modules of a serialized stack trace
+ * are loaded at in this process
+ *
+ * @param modules the module paths
+ * @return the addresses of every module or 0 if the module is not loaded
+ */
+static std::vector<uintptr_t> findModuleBases(const std::vector<std::string> &modules) {
+    std::vector<uintptr_t> bases(modules.size(), 0);
+#ifdef STACKTRACE_WINDOWS
+    for (size_t i = 0; i < modules.size(); i++) {
+        bases[i] = (uintptr_t) GetModuleHandleA(modules[i].c_str());
+    }
+#elif !defined(__APPLE__)
+    std::vector<loaded_module> loaded = getLoadedModules();
+    for (size_t i = 0; i < modules.size(); i++) {
+        for (const loaded_module &m : loaded) {
+            if (m.path == modules[i]) {
+                bases[i] = m.base;
+                break;
+            }
+        }
+    }
+#endif //Windows
+
+    return bases;
+}
+
+/**
+ * Write a string as a JSON string, including the quotes
+ *
+ * @param write the writer to write to
+ * @param ctx the writer's context
+ * @param str the string to write
+ * @param size the size of str
+ */
+static void writeJsonString(frame_writer write, void *ctx, const char *str, size_t size) {
+    write(ctx, "\"", 1);
+
+    size_t start = 0;
+    for (size_t i = 0; i < size; i++) {
+        auto c = (unsigned char) str[i];
+        if (c != '"' && c != '\\' && c >= 0x20) continue;
+
+        write(ctx, str + start, i - start);
+        start = i + 1;
+
+        if (c == '"') {
+            write(ctx, "\\\"", 2);
+        } else if (c == '\\') {
+            write(ctx, "\\\\", 2);
+        } else if (c == '\n') {
+            write(ctx, "\\n", 2);
+        } else if (c == '\t') {
+            write(ctx, "\\t", 2);
+        } else {
+            char escaped[6] = {'\\', 'u', '0', '0'};
+            formatHex(escaped + 4, c, 2);
+            write(ctx, escaped, sizeof(escaped));
+        }
+    }
+
+    write(ctx, str + start, size - start);
+    write(ctx, "\"", 1);
+}
+
+/**
+ * Write a number as a hexadecimal JSON string
+ *
+ * @param write the writer to write to
+ * @param ctx the writer's context
+ * @param value the value to write
+ * @param digits the min number of digits
+ */
+static void writeJsonHex(frame_writer write, void *ctx, uintptr_t value, size_t digits) {
+    char buffer[3 + sizeof(uintptr_t) * 2 + 1] = {'"', '0', 'x'};
+    size_t len = 3 + formatHex(buffer + 3, value, digits);
+    buffer[len++] = '"';
+
+    write(ctx, buffer, len);
+}
+
+/**
+ * Write a frame as a JSON object
+ *
+ * @param write the writer to write to
+ * @param ctx the writer's context
+ * @param index the index of the captured address of the frame
+ * @param address the address of the frame
+ * @param module the path of the module the address is in or nullptr if unknown
+ * @param base the address the module was loaded at
+ * @param f the resolved frame or nullptr to only write the address
+ */
+static void writeJsonFrame(frame_writer write, void *ctx, size_t index, const void *address, const char *module,
+                           uintptr_t base, const frame *f) {
+    writeString(write, ctx, "{\"index\":");
+    writeDecimal(write, ctx, index);
+    writeString(write, ctx, ",\"address\":");
+    writeJsonHex(write, ctx, (uintptr_t) address, sizeof(uintptr_t) * 2);
+
+    writeString(write, ctx, ",\"module\":");
+    if (module != nullptr) {
+        writeJsonString(write, ctx, module, strlen(module));
+        writeString(write, ctx, ",\"offset\":");
+        writeJsonHex(write, ctx, (uintptr_t) address - base, 1);
+    } else {
+        writeString(write, ctx, "null,\"offset\":null");
+    }
+
+    if (f != nullptr) {
+        writeString(write, ctx, ",\"function\":");
+        writeJsonString(write, ctx, f->getFunction().data(), f->getFunction().size());
+        writeString(write, ctx, ",\"file\":");
+        writeJsonString(write, ctx, f->getFile().data(), f->getFile().size());
+        writeString(write, ctx, ",\"path\":");
+        writeJsonString(write, ctx, f->getFullFilePath().data(), f->getFullFilePath().size());
+        writeString(write, ctx, ",\"line\":");
+        writeDecimal(write, ctx, f->getLine());
+        writeString(write, ctx, f->isInlined() ? ",\"inlined\":true" : ",\"inlined\":false");
+    }
+
+    writeString(write, ctx, "}");
+}
+
+// symbol_table =======================
+
+symbol_table::symbol_table(resolve_level level) : level(level), table() {}
+
+symbol_table::symbol_table(const symbol_table &table) = default;
+
+symbol_table::symbol_table(symbol_table &&table) noexcept = default;
+
+symbol_table &symbol_table::operator=(const symbol_table &other) = default;
+
+symbol_table &symbol_table::operator=(symbol_table &&other) noexcept = default;
+
+STACKTRACE_NODISCARD const std::vector<frame> *symbol_table::find(const void *address) const {
+    auto it = table.find(address);
+    return it == table.end() ? nullptr : &it->second;
+}
+
+STACKTRACE_NODISCARD resolve_level symbol_table::getLevel() const noexcept {
+    return level;
+}
+
+STACKTRACE_NODISCARD size_t symbol_table::size() const noexcept {
+    return table.size();
+}
+
+symbol_table::~symbol_table() noexcept = default;
+
+// stacktrace =========================
+
+/**
+ * Hash captured addresses
+ *
+ * @param addresses the addresses to hash
+ * @param count the number of addresses
+ * @return the hash, 0 if there are no addresses
+ */
+static size_t hashAddresses(void *const *addresses, size_t count) noexcept {
+    size_t res = 0;
+    for (size_t i = 0; i < count; i++) {
+        res = hashCombine(res, (uintptr_t) addresses[i]);
+    }
+
+    return res;
+}
+
+/**
+ * Capture the addresses of the current stack. Always inlined, so the stack starts at the caller
+ *
+ * @param framesToSkip the number of frames to skip, only used on windows
+ * @param buffer the buffer to write the addresses to
+ * @param size the size of the buffer
+ * @return the number of captured addresses, up to the first null pointer
+ */
+STACKTRACE_FORCEINLINE static size_t captureAddresses(STACKTRACE_UNUSED unsigned long framesToSkip, void **buffer,
+                                                      size_t size) {
+#ifdef STACKTRACE_WINDOWS
+    size_t captured = ::RtlCaptureStackBackTrace(framesToSkip, (u_long) size, buffer, nullptr);
+#else
+    size_t captured = backtrace(buffer, (int) size);
+#endif //Windows
+
+    // Ignore everything after the first null pointer
+    return std::find(buffer, buffer + captured, nullptr) - buffer;
+}
+
+/**
+ * Capture the addresses of the current stack, starting at the frame of a caller
+ *
+ * @param caller the return address of the function to start after
+ * @param buffer the buffer to write the addresses to
+ * @param size the size of the buffer, at most 256
+ * @return the number of captured addresses
+ */
+static size_t captureFromCaller(const void *caller, void **buffer, size_t size) {
+    // Capture a few more frames, as the frames up to the caller are removed
+    void *captured[256 + 8];
+    const size_t count = captureAddresses(0, captured, std::min(size, (size_t) 256) + 8);
+
+    size_t first = 0;
+    while (first < count && captured[first] != caller) first++;
+    if (first == count) first = 0;
+
+    const size_t res = std::min(count - first, size);
+    std::copy(captured + first, captured + first + res, buffer);
+
+    return res;
+}
+
+stacktrace::stacktrace(unsigned long framesToSkip, size_t maxFrames, resolve_level level)
+        : data(std::make_shared<trace_data>()) {
+    std::vector<void *> &addresses = data->addresses;
+    addresses.resize(maxFrames, nullptr);
+    addresses.resize(captureAddresses(framesToSkip, addresses.data(), addresses.size()));
+
+    data->level = level;
+    data->isResolved.resize(addresses.size(), false);
+    data->hash = hashAddresses(addresses.data(), addresses.size());
+}
+
+stacktrace::stacktrace(std::vector<void *> addresses, resolve_level level) : data(std::make_shared<trace_data>()) {
+    data->addresses = std::move(addresses);
+    data->level = level;
+    data->isResolved.resize(data->addresses.size(), false);
+    data->hash = hashAddresses(data->addresses.data(), data->addresses.size());
+}
+
+stacktrace::stacktrace(const stacktrace &trace) noexcept = default;
+
+stacktrace::stacktrace(stacktrace &&trace) noexcept: data(std::move(trace.data)) {
+    trace.data = emptyData();
+}
+
+stacktrace &stacktrace::operator=(const stacktrace &trace) noexcept = default;
+
+stacktrace &stacktrace::operator=(stacktrace &&trace) noexcept {
+    if (&trace != this) {
+        // Release the old data, unless it is still used by a copy
+        data = std::move(trace.data);
+        trace.data = emptyData();
+    }
+
+    return *this;
+}
+
+STACKTRACE_NODISCARD STACKTRACE_UNUSED const std::vector<frame> &stacktrace::getFrames() const {
+    std::unique_lock<std::mutex> lock(data->mtx);
+    resolveAll();
+    return data->frames;
+}
+
+STACKTRACE_NODISCARD const std::vector<void *> &stacktrace::getAddresses() const noexcept {
+    return data->addresses;
+}
+
+STACKTRACE_NODISCARD std::pair<const frame *, const frame *> stacktrace::getAddressFrames(size_t index) const {
+    std::unique_lock<std::mutex> lock(data->mtx);
+    if (index >= data->addresses.size()) {
+        throw std::out_of_range("The address index is out of range");
+    }
+
+    return resolve(index);
+}
+
+STACKTRACE_NODISCARD resolve_level stacktrace::getLevel() const noexcept {
+    return data->level;
+}
+
+STACKTRACE_NODISCARD const frame &stacktrace::operator[](size_t index) const {
+    std::unique_lock<std::mutex> lock(data->mtx);
+    if (data->level == resolve_level::full) {
+        resolveAll();
+        return data->frames.at(index);
+    } else if (index >= data->addresses.size()) {
+        throw std::out_of_range("The frame index is out of range");
+    } else {
+        return *resolve(index).first;
+    }
+}
+
+STACKTRACE_NODISCARD std::vector<frame>::const_iterator stacktrace::begin() const {
+    return getFrames().begin();
+}
+
+STACKTRACE_NODISCARD std::vector<frame>::const_iterator stacktrace::end() const {
+    return getFrames().end();
+}
+
+STACKTRACE_NODISCARD size_t stacktrace::size() const {
+    if (data->level == resolve_level::full) {
+        return getFrames().size();
+    } else {
+        return data->addresses.size();
+    }
+}
+
+STACKTRACE_NODISCARD bool stacktrace::empty() const noexcept {
+    return data->addresses.empty();
+}
+
+STACKTRACE_NODISCARD stacktrace::operator bool() const noexcept {
+    return !data->addresses.empty();
+}
+
+STACKTRACE_NODISCARD size_t stacktrace::hash() const noexcept {
+    return data->hash;
+}
+
+STACKTRACE_NODISCARD bool stacktrace::operator==(const stacktrace &other) const noexcept {
+    // The addresses are never changed, so no lock is needed
+    return data == other.data || (data->hash == other.data->hash && data->level == other.data->level &&
+                                  data->addresses == other.data->addresses);
+}
+
+STACKTRACE_NODISCARD bool stacktrace::operator!=(const stacktrace &other) const noexcept {
+    return !(*this == other);
+}
+
+STACKTRACE_NODISCARD std::string stacktrace::toString(bool fullPaths) const {
+    return toString(fullPaths, 0, data->addresses.size());
+}
+
+STACKTRACE_NODISCARD std::string stacktrace::toString(bool fullPaths, size_t first, size_t count) const {
+    std::string res;
+    formatTo(appendToString, &res, fullPaths, first, count);
+
+    return res;
+}
+
+void stacktrace::formatTo(frame_writer write, void *ctx, bool fullPaths, size_t first, size_t count) const {
+    std::unique_lock<std::mutex> lock(data->mtx);
+    resolveForFormat(first, count);
+    for (size_t i = first; i < data->addresses.size() && i - first < count; i++) {
+        std::pair<const frame *, const frame *> range = resolve(i);
+        for (const frame *f = range.first; f != range.second; f++) {
+            writeString(write, ctx, " ");
+            writeDecimal(write, ctx, i);
+            writeString(write, ctx, "# ");
+            f->formatTo(write, ctx, fullPaths);
+            writeString(write, ctx, "\n");
+        }
+    }
+}
+
+std::ostream &stacktrace::printTo(std::ostream &os, bool fullPaths, bool flush, size_t first, size_t count) const {
+    {
+        std::unique_lock<std::mutex> lock(data->mtx);
+        resolveForFormat(first, count);
+    }
+
+    // Write every captured address on its own, so frames can
+    // be flushed before the next address is resolved
+    for (size_t i = first; i < data->addresses.size() && i - first < count && os; i++) {
+        formatTo(writeToStream, &os, fullPaths, i, 1);
+        if (flush) os.flush();
+    }
+
+    return os;
+}
+
+STACKTRACE_NODISCARD std::string stacktrace::toString(const trace_format &format, size_t first, size_t count) const {
+    std::string res;
+    formatTo(format, appendToString, &res, first, count);
+
+    return res;
+}
+
+void stacktrace::formatTo(const trace_format &format, frame_writer write, void *ctx, size_t first,
+                          size_t count) const {
+    std::unique_lock<std::mutex> lock(data->mtx);
+    resolveForFormat(first, count);
+    for (size_t i = first; i < data->addresses.size() && i - first < count; i++) {
+        std::pair<const frame *, const frame *> range = resolve(i);
+        for (const frame *f = range.first; f != range.second; f++) {
+            format.formatFrame(i, *f, write, ctx);
+        }
+    }
+}
+
+size_t stacktrace::formatTo(const trace_format &format, char *buffer, size_t size, size_t first,
+                            size_t count) const {
+    buffer_writer writer{buffer, size, 0};
+    formatTo(format, writeToBuffer, &writer, first, count);
+
+    if (size > 0) {
+        buffer[std::min(writer.length, size - 1)] = '\0';
+    }
+
+    return writer.length;
+}
+
+std::ostream &stacktrace::printTo(std::ostream &os, const trace_format &format, bool flush) const {
+    {
+        std::unique_lock<std::mutex> lock(data->mtx);
+        resolveForFormat(0, data->addresses.size());
+    }
+
+    for (size_t i = 0; i < data->addresses.size() && os; i++) {
+        formatTo(format, writeToStream, &os, i, 1);
+        if (flush) os.flush();
+    }
+
+    return os;
+}
+
+STACKTRACE_NODISCARD std::string stacktrace::serialize(bool withSymbols) const {
+    std::unique_lock<std::mutex> lock(data->mtx);
+    if (withSymbols) resolveForFormat(0, data->addresses.size());
+
+    // Map every address to a module and the offset in the module.
+    // Module id 0 is used for addresses without a module.
+    std::unordered_map<std::string, size_t> moduleIds;
+    std::vector<const std::string *> modules;
+    std::vector<std::pair<size_t, uint64_t>> entries;
+    entries.reserve(data->addresses.size());
+
+    char buffer[260];
+    for (void *address : data->addresses) {
+        uintptr_t base = 0;
+        const char *module = getModulePath(address, buffer, sizeof(buffer), &base);
+        if (module != nullptr) {
+            entries.emplace_back(internString<std::string>(moduleIds, modules, module) + 1,
+                                 (uintptr_t) address - base);
+        } else {
+            entries.emplace_back(0, (uintptr_t) address);
+        }
+    }
+
+    std::string res(serializedMagic, sizeof(serializedMagic));
+    res.push_back(serializedVersion);
+    res.push_back(withSymbols ? serializedSymbols : (char) 0);
+    res.push_back((char) data->level);
+
+    writeVarint(res, modules.size());
+    for (const std::string *module : modules) {
+        writeBytes(res, *module);
+    }
+
+    // Write the offsets as the difference to the last offset in the same module,
+    // which keeps them small as most frames of a trace are close to each other
+    std::vector<uint64_t> lastOffsets(modules.size() + 1, 0);
+    // The names of the frames are interned already, so their views can be used as keys
+    std::unordered_map<std::string_view, size_t> stringIds;
+    std::vector<const std::string_view *> strings;
+
+    writeVarint(res, entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        const size_t module = entries[i].first;
+        const uint64_t offset = entries[i].second;
+        const auto delta = (int64_t) (offset - lastOffsets[module]);
+        lastOffsets[module] = offset;
+
+        writeVarint(res, module);
+        writeVarint(res, ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));
+
+        if (withSymbols) {
+            std::pair<const frame *, const frame *> range = resolve(i);
+            writeVarint(res, range.second - range.first);
+            for (const frame *f = range.first; f != range.second; f++) {
+                writeVarint(res, internString(stringIds, strings, f->getFunction()));
+                writeVarint(res, internString(stringIds, strings, f->getFullFilePath()));
+                writeVarint(res, (uint64_t) f->getLine() << 1 | (f->isInlined() ? 1 : 0));
+            }
+        }
+    }
+
+    // The interned strings are written last, once all of them are known
+    if (withSymbols) {
+        writeVarint(res, strings.size());
+        for (const std::string_view *str : strings) {
+            writeVarint(res, str->size());
+            res.append(str->data(), str->size());
+        }
+    }
+
+    return res;
+}
+
+stacktrace stacktrace::deserialize(const std::string &data) {
+    if (data.size() < sizeof(serializedMagic) + 3 || data.compare(0, 2, serializedMagic, 2) != 0 ||
+        data[2] != serializedVersion) {
+        throw std::invalid_argument("The data is not a serialized stack trace");
+    }
+
+    const bool withSymbols = (data[3] & serializedSymbols) != 0;
+    const auto level = (resolve_level) data[4];
+    if (data[4] < (char) resolve_level::raw || data[4] > (char) resolve_level::full) {
+        throw std::invalid_argument("Invalid resolve level in serialized stack trace");
+    }
+
+    size_t pos = 5;
+    std::vector<std::string> modules(readCount(data, pos));
+    for (std::string &module : modules) {
+        module = readBytes(data, pos);
+    }
+
+    const size_t count = readCount(data, pos);
+    std::vector<std::pair<size_t, uint64_t>> entries(count);
+    std::vector<std::vector<serialized_frame>> symbols(withSymbols ? count : 0);
+    std::vector<uint64_t> lastOffsets(modules.size() + 1, 0);
+
+    for (size_t i = 0; i < count; i++) {
+        const uint64_t module = readVarint(data, pos);
+        if (module > modules.size()) {
+            throw std::invalid_argument("Invalid module id in serialized stack trace");
+        }
+
+        const uint64_t zigzag = readVarint(data, pos);
+        const auto delta = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+        lastOffsets[module] += (uint64_t) delta;
+        entries[i] = {(size_t) module, lastOffsets[module]};
+
+        if (withSymbols) {
+            symbols[i].resize(readCount(data, pos));
+            for (serialized_frame &f : symbols[i]) {
+                f.function = (size_t) readVarint(data, pos);
+                f.fullFile = (size_t) readVarint(data, pos);
+
+                const uint64_t line = readVarint(data, pos);
+                f.line = (size_t) (line >> 1);
+                f.inlined = (line & 1) != 0;
+            }
+        }
+    }
+
+    std::vector<std::string> strings(withSymbols ? readCount(data, pos) : 0);
+    for (std::string &str : strings) {
+        str = readBytes(data, pos);
+    }
+
+    if (pos != data.size()) {
+        throw std::invalid_argument("Unexpected data at the end of a serialized stack trace");
+    }
+
+    for (const std::vector<serialized_frame> &frames : symbols) {
+        for (const serialized_frame &f : frames) {
+            if (f.function >= strings.size() || f.fullFile >= strings.size()) {
+                throw std::invalid_argument("Invalid string id in serialized stack trace");
+            }
+        }
+    }
+
+    // Map the module offsets to addresses in this process
+    std::vector<uintptr_t> bases = findModuleBases(modules);
+    std::vector<void *> addresses(count);
+    for (size_t i = 0; i < count; i++) {
+        const size_t module = entries[i].first;
+        addresses[i] = (void *) (uintptr_t) (module != 0 ? bases[module - 1] + entries[i].second : entries[i].second);
+    }
+
+    stacktrace trace(std::move(addresses), level);
+
+    // Use the stored frames and the module offsets of modules which are not loaded
+    std::vector<std::vector<frame>> decoded(count);
+    std::vector<const std::vector<frame> *> known(count, nullptr);
+    for (size_t i = 0; i < count; i++) {
+        const size_t module = entries[i].first;
+        if (withSymbols) {
+            for (const serialized_frame &f : symbols[i]) {
+                decoded[i].emplace_back(strings[f.function], strings[f.fullFile], f.line, trace.data->addresses[i],
+                                        f.inlined);
+            }
+
+            known[i] = &decoded[i];
+        } else if (module != 0 && bases[module - 1] == 0) {
+            char buffer[3 + sizeof(uintptr_t) * 2] = {'+', '0', 'x'};
+            size_t len = 3 + formatHex(buffer + 3, (uintptr_t) entries[i].second);
+
+            decoded[i].emplace_back(std::string_view(buffer, len), modules[module - 1], 0, trace.data->addresses[i]);
+            known[i] = &decoded[i];
+        }
+    }
+
+    trace.resolveAll(known, false);
+    return trace;
+}
+
+void stacktrace::writeJson(frame_writer write, void *ctx, bool withSymbols) const {
+    std::unique_lock<std::mutex> lock(data->mtx);
+    if (withSymbols) resolveForFormat(0, data->addresses.size());
+    writeString(write, ctx, "{\"frames\":[");
+
+    char buffer[260];
+    bool first = true;
+    for (size_t i = 0; i < data->addresses.size(); i++) {
+        uintptr_t base = 0;
+        const char *module = getModulePath(data->addresses[i], buffer, sizeof(buffer), &base);
+
+        if (withSymbols) {
+            std::pair<const frame *, const frame *> range = resolve(i);
+            for (const frame *f = range.first; f != range.second; f++) {
+                if (!first) writeString(write, ctx, ",");
+                writeJsonFrame(write, ctx, i, data->addresses[i], module, base, f);
+                first = false;
+            }
+        } else {
+            if (!first) writeString(write, ctx, ",");
+            writeJsonFrame(write, ctx, i, data->addresses[i], module, base, nullptr);
+            first = false;
+        }
+    }
+
+    writeString(write, ctx, "]}");
+}
+
+std::ostream &stacktrace::writeJson(std::ostream &os, bool withSymbols) const {
+    writeJson(writeToStream, &os, withSymbols);
+    return os;
+}
+
+STACKTRACE_NODISCARD std::string stacktrace::toJson(bool withSymbols) const {
+    std::string res;
+    writeJson(appendToString, &res, withSymbols);
+
+    return res;
+}
+
+size_t stacktrace::formatTo(char *buffer, size_t size, bool fullPaths, size_t first, size_t count) const {
+    buffer_writer writer{buffer, size, 0};
+    formatTo(writeToBuffer, &writer, fullPaths, first, count);
+
+    if (size > 0) {
+        buffer[std::min(writer.length, size - 1)] = '\0';
+    }
+
+    return writer.length;
+}
+
+prewarm_result stacktrace::prewarm(STACKTRACE_UNUSED const prewarm_options &options) {
+    prewarm_result result;
+#ifdef STACKTRACE_WINDOWS
+    std::vector<module> modules;
+    const handle_ptr &handle = getProcessHandle();
+    if (handle && SymEnumerateModules64(handle.get(), enumModules, (void *) &modules)) {
+        result.modules = modules.size();
+    }
+#else
+    // backtrace(3) loads libgcc on its first call
+    void *buffer[1];
+    backtrace(buffer, 1);
+
+#   if !defined(__APPLE__) && !defined(STACKTRACE_NO_ADDR2LINE)
+    for (const loaded_module &m : getLoadedModules()) {
+        if (options.maxModules != 0 && result.modules >= options.maxModules) break;
+        if (options.maxBytes != 0 && result.bytes >= options.maxBytes) break;
+
+        if (!options.modules.empty() &&
+            std::none_of(options.modules.begin(), options.modules.end(), [&m](const std::string &name) {
+                return m.path.find(name) != std::string::npos;
+            })) {
+            continue;
+        }
+
+        // Only allow the module to use what is left of maxBytes
+        size_t limit = options.maxBytes == 0 ? 0 : options.maxBytes - result.bytes;
+        size_t bytes = 0;
+        if (symbol_cache::instance().loadModule(m.path, options.loadLines, limit, bytes)) {
+            result.modules++;
+            result.bytes += bytes;
+        }
+    }
+#   endif //!Apple && addr2line
+#endif //Windows
+
+    return result;
+}
+
+std::future<prewarm_result> stacktrace::prewarmAsync(const prewarm_options &options) {
+    return std::async(std::launch::async, &stacktrace::prewarm, options);
+}
+
+cache_stats stacktrace::getCacheStats() {
+#ifdef STACKTRACE_UNIX
+    cache_stats stats = symbol_cache::instance().getStats();
+#else
+    cache_stats stats;
+#endif //Unix
+
+    stats.internedBytes = string_pool::instance().getBytes();
+    return stats;
+}
+
+void stacktrace::setCacheLimit(STACKTRACE_UNUSED size_t maxBytes) {
+#ifdef STACKTRACE_UNIX
+    symbol_cache::instance().setLimit(maxBytes);
+#endif //Unix
+}
+
+void stacktrace::clearCache() {
+#ifdef STACKTRACE_UNIX
+    symbol_cache::instance().clear();
+#endif //Unix
+}
+
+void stacktrace::setSymbolizer(STACKTRACE_UNUSED const std::string &socketPath, STACKTRACE_UNUSED size_t timeout) {
+#if defined(STACKTRACE_UNIX) && !defined(__APPLE__)
+    symbol_cache::instance().setSymbolizer(socketPath, timeout);
+#endif //Unix && !Apple
+}
+
+void stacktrace::resolveFrom(const symbol_table &table) {
+    if (table.getLevel() != data->level) return;
+
+    std::vector<const std::vector<frame> *> known(data->addresses.size());
+    for (size_t i = 0; i < data->addresses.size(); i++) {
+        known[i] = table.find(data->addresses[i]);
+    }
+
+    std::unique_lock<std::mutex> lock(data->mtx);
+    resolveAll(known, false);
+}
+
+size_t stacktrace::capture(void **buffer, size_t size, unsigned long framesToSkip) {
+    return captureAddresses(framesToSkip, buffer, size);
+}
+
+symbol_table stacktrace::symbolize(void *const *addresses, size_t count, resolve_level level) {
+    symbol_table table(level);
+    table.table = resolveFrames(std::vector<void *>(addresses, addresses + count), level);
+
+    return table;
+}
+
+symbol_table stacktrace::symbolize(const std::vector<stacktrace> &traces, resolve_level level) {
+    std::vector<void *> addresses;
+    for (const stacktrace &trace : traces) {
+        addresses.insert(addresses.end(), trace.data->addresses.begin(), trace.data->addresses.end());
+    }
+
+    return symbolize(addresses.data(), addresses.size(), level);
+}
+
+stacktrace::~stacktrace() noexcept = default;
+
+const std::shared_ptr<stacktrace::trace_data> &stacktrace::emptyData() noexcept {
+    static const std::shared_ptr<trace_data> empty = std::make_shared<trace_data>();
+    return empty;
+}
+
+std::pair<const frame *, const frame *> stacktrace::resolve(size_t index) const {
+    const std::vector<void *> &addresses = data->addresses;
+    std::vector<frame> &frames = data->frames;
+
+    if (data->level == resolve_level::full) {
+        resolveAll();
+        const std::vector<size_t> &firstFrames = data->firstFrames;
+        return {frames.data() + firstFrames[index], frames.data() + firstFrames[index + 1]};
+    }
+
+    if (!data->isResolved[index]) {
+        if (frames.size() != addresses.size()) frames.resize(addresses.size());
+
+        frames[index] = selectFrame(resolveFrames(addresses[index], data->level), addresses[index]);
+        data->isResolved[index] = true;
+    }
+
+    return {&frames[index], &frames[index] + 1};
+}
+
+void stacktrace::resolveAll(const std::vector<const std::vector<frame> *> &known, bool resolveMissing) const {
+    const std::vector<void *> &addresses = data->addresses;
+    const resolve_level level = data->level;
+    std::vector<frame> &frames = data->frames;
+
+    if (level == resolve_level::full) {
+        std::vector<size_t> &firstFrames = data->firstFrames;
+        if (!firstFrames.empty()) return;
+
+        // Resolve every address which is not known at once
+        std::vector<void *> missing;
+        for (size_t i = 0; i < addresses.size(); i++) {
+            if (i >= known.size() || !known[i]) missing.push_back(addresses[i]);
+        }
+
+        std::unordered_map<const void *, std::vector<frame>> resolved = resolveFrames(missing, level);
+
+        firstFrames.reserve(addresses.size() + 1);
+        for (size_t i = 0; i < addresses.size(); i++) {
+            firstFrames.push_back(frames.size());
+
+            const std::vector<frame> *v = i < known.size() ? known[i] : nullptr;
+            if (!v) {
+                auto it = resolved.find(addresses[i]);
+                if (it != resolved.end()) v = &it->second;
+            }
+
+            if (v) frames.insert(frames.end(), v->begin(), v->end());
+        }
+
+        firstFrames.push_back(frames.size());
+        return;
+    }
+
+    std::vector<bool> &isResolved = data->isResolved;
+    if (frames.size() != addresses.size()) frames.resize(addresses.size());
+
+    std::vector<void *> missing;
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (isResolved[i]) continue;
+
+        if (i < known.size() && known[i]) {
+            frames[i] = selectFrame(*known[i], addresses[i]);
+            isResolved[i] = true;
+        } else {
+            missing.push_back(addresses[i]);
+        }
+    }
+
+    if (!resolveMissing || missing.empty()) return;
+
+    // Resolve all missing addresses at once
+    std::unordered_map<const void *, std::vector<frame>> resolved = resolveFrames(missing, level);
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (isResolved[i]) continue;
+
+        auto it = resolved.find(addresses[i]);
+        frames[i] = it != resolved.end() ? selectFrame(it->second, addresses[i]) : selectFrame({}, addresses[i]);
+        isResolved[i] = true;
+    }
+}
+
+void stacktrace::resolveForFormat(STACKTRACE_UNUSED size_t first, STACKTRACE_UNUSED size_t count) const {
+    // Every address resolved on its own would be a request to the daemon
+#if defined(STACKTRACE_UNIX) && !defined(__APPLE__)
+    const std::vector<void *> &addresses = data->addresses;
+    if (data->level == resolve_level::full || first >= addresses.size() ||
+        !symbol_cache::instance().hasSymbolizer()) {
+        return;
+    }
+
+    const size_t last = first + std::min(count, addresses.size() - first);
+    std::vector<void *> missing;
+    for (size_t i = first; i < last; i++) {
+        if (!data->isResolved[i]) missing.push_back(addresses[i]);
+    }
+
+    if (missing.empty()) return;
+
+    std::vector<frame> &frames = data->frames;
+    if (frames.size() != addresses.size()) frames.resize(addresses.size());
+
+    std::unordered_map<const void *, std::vector<frame>> resolved = resolveFrames(missing, data->level);
+    for (size_t i = first; i < last; i++) {
+        if (data->isResolved[i]) continue;
+
+        auto it = resolved.find(addresses[i]);
+        frames[i] = it != resolved.end() ? selectFrame(it->second, addresses[i]) : selectFrame({}, addresses[i]);
+        data->isResolved[i] = true;
+    }
+#endif //Unix && !Apple
+}
+
+// exception_trace ====================
+
+#if defined(STACKTRACE_INTERPOSE_CXA_THROW) && defined(STACKTRACE_UNIX)
+// The stack of the exception thrown last on the current thread
+static thread_local void *lastThrownAddresses[exception_trace::maxFrames] __attribute__((tls_model("initial-exec")));
+
+// The number of addresses in lastThrownAddresses
+static thread_local size_t lastThrownCount __attribute__((tls_model("initial-exec"))) = 0;
+
+extern "C" {
+// The signature of __cxa_throw, the type info is passed as void *, like the compiler declares it
+using cxa_throw_type = void (*)(void *, void *, void (*)(void *));
+
+void __cxa_throw(void *thrown, void *type, void (*destructor)(void *)) {
+    static const auto original = (cxa_throw_type) dlsym(RTLD_NEXT, "__cxa_throw");
+
+    lastThrownCount = captureFromCaller(STACKTRACE_RETURN_ADDRESS(), lastThrownAddresses, exception_trace::maxFrames);
+    original(thrown, type, destructor);
+    __builtin_unreachable();
+}
+}
+#endif //STACKTRACE_INTERPOSE_CXA_THROW && Unix
+
+STACKTRACE_NOINLINE exception_trace::exception_trace() noexcept: addresses(), count(0) {
+    count = captureFromCaller(STACKTRACE_RETURN_ADDRESS(), addresses, maxFrames);
+}
+
+STACKTRACE_NODISCARD stacktrace exception_trace::getStacktrace(resolve_level level) const {
+    return stacktrace(std::vector<void *>(addresses, addresses + count), level);
+}
+
+STACKTRACE_NODISCARD void *const *exception_trace::getAddresses() const noexcept {
+    return addresses;
+}
+
+STACKTRACE_NODISCARD size_t exception_trace::size() const noexcept {
+    return count;
+}
+
+STACKTRACE_NODISCARD stacktrace exception_trace::lastThrown(resolve_level level) {
+#if defined(STACKTRACE_INTERPOSE_CXA_THROW) && defined(STACKTRACE_UNIX)
+    return stacktrace(std::vector<void *>(lastThrownAddresses, lastThrownAddresses + lastThrownCount), level);
+#else
+    return stacktrace(std::vector<void *>(), level);
+#endif //STACKTRACE_INTERPOSE_CXA_THROW && Unix
+}
+
+// stack_table ========================
+
+stack_table::stack_table(size_t capacity) : maxTraces(capacity), mask(0), slots(), traces(), numTraces(0), mtx() {
+    if (capacity == 0 || capacity >= invalidId / 2) {
+        throw std::invalid_argument("The capacity of a stack_table must be between 1 and 2^31");
+    }
+
+    // Keep the load factor below 0.5, so probes stay short
+    size_t numSlots = 1;
+    while (numSlots < capacity * 2) numSlots <<= 1;
+
+    mask = numSlots - 1;
+    slots.reset(new std::atomic<uint32_t>[numSlots]);
+    for (size_t i = 0; i < numSlots; i++) {
+        slots[i].store(0, std::memory_order_relaxed);
+    }
+
+    traces.reset(new std::unique_ptr<const stacktrace>[capacity]);
+}
+
+uint32_t stack_table::intern(const stacktrace &trace) {
+    const std::vector<void *> &addresses = trace.getAddresses();
+    size_t slot = 0;
+    uint32_t id = find(trace.hash(), addresses.data(), addresses.size(), trace.getLevel(), slot);
+    if (id != invalidId) return id;
+
+    std::unique_lock<std::mutex> lock(mtx);
+
+    // Another thread may have added the trace in the mean time
+    id = find(trace.hash(), addresses.data(), addresses.size(), trace.getLevel(), slot);
+    if (id != invalidId) return id;
+
+    const size_t next = numTraces.load(std::memory_order_relaxed);
+    if (next >= maxTraces) return invalidId;
+
+    // Store a copy sharing the frames of trace
+    traces[next].reset(new stacktrace(trace));
+    slots[slot].store((uint32_t) next + 1, std::memory_order_release);
+    numTraces.store(next + 1, std::memory_order_release);
+
+    return (uint32_t) next;
+}
+
+uint32_t stack_table::intern(void *const *addresses, size_t count, resolve_level level) {
+    const size_t hash = hashAddresses(addresses, count);
+    size_t slot = 0;
+    uint32_t id = find(hash, addresses, count, level, slot);
+    if (id != invalidId) return id;
+
+    return intern(stacktrace(std::vector<void *>(addresses, addresses + count), level));
+}
+
+uint32_t stack_table::capture(unsigned long framesToSkip, size_t maxFrames, resolve_level level) {
+    void *addresses[256];
+    size_t captured = captureAddresses(framesToSkip, addresses,
+                                       std::min(maxFrames, sizeof(addresses) / sizeof(void *)));
+
+    return intern(addresses, captured, level);
+}
+
+STACKTRACE_NODISCARD const stacktrace &stack_table::get(uint32_t id) const {
+    if (id >= numTraces.load(std::memory_order_acquire)) {
+        throw std::out_of_range("The stack id is not in this table");
+    }
+
+    return *traces[id];
+}
+
+STACKTRACE_NODISCARD size_t stack_table::size() const noexcept {
+    return numTraces.load(std::memory_order_acquire);
+}
+
+STACKTRACE_NODISCARD size_t stack_table::capacity() const noexcept {
+    return maxTraces;
+}
+
+stack_table::~stack_table() noexcept = default;
+
+uint32_t stack_table::find(size_t hash, void *const *addresses, size_t count, resolve_level level,
+                           size_t &slot) const noexcept {
+    for (slot = hash & mask;; slot = (slot + 1) & mask) {
+        const uint32_t id = slots[slot].load(std::memory_order_acquire);
+        if (id == 0) return invalidId;
+
+        const stacktrace &trace = *traces[id - 1];
+        const std::vector<void *> &other = trace.getAddresses();
+        if (trace.hash() == hash && trace.getLevel() == level && other.size() == count &&
+            std::equal(other.begin(), other.end(), addresses)) {
+            return id - 1;
+        }
+    }
+}
+
+// export =============================
+
+/**
+ * Write stacks in the folded format used by flame graph tools: the function
+ * names from the outermost frame down, separated by semicolons, and the count.
+ * The stacks must be resolved already.
+ *
+ * @param stacks the stacks to write
+ * @param write the function to write to
+ * @param ctx the context passed to write
+ */
+static void writeFoldedStacks(const std::vector<stack_count> &stacks, frame_writer write, void *ctx) {
+    for (const stack_count &c : stacks) {
+        const std::vector<frame> &frames = c.trace.getFrames();
+        for (size_t i = frames.size(); i-- > 0;) {
+            writeString(write, ctx, frames[i].getFunction());
+            if (i > 0) writeString(write, ctx, ";");
+        }
+
+        writeString(write, ctx, " ");
+        writeDecimal(write, ctx, c.count);
+        writeString(write, ctx, "\n");
+    }
+}
+
+/**
+ * Writes stacks in the pprof profile.proto format. Every string, function and
+ * location is only written once, when it is first used. As the names of frames are
+ * interned, they are identified by their address.
+ */
+class pprof_writer {
+public:
+    /**
+     * Create a pprof_writer and write the sample types
+     *
+     * @param write the function to write to
+     * @param ctx the context passed to write
+     * @param period the cpu time per sample in nanoseconds or 0 if the samples are not timed
+     */
+    pprof_writer(frame_writer write, void *ctx, uint64_t period)
+            : write(write), ctx(ctx), period(period), strings(), functions(), locations(), message(), line() {
+        // The first string must be empty
+        stringId("");
+
+        writeValueType(1, "samples", "count");
+        if (period != 0) {
+            writeValueType(1, "cpu", "nanoseconds");
+            writeValueType(11, "cpu", "nanoseconds");
+
+            message.clear();
+            writeVarint(message, 12 << 3);
+            writeVarint(message, period);
+            writeString(write, ctx, message);
+        }
+    }
+
+    /**
+     * Write a stack. The stack must be resolved already.
+     *
+     * @param stack the stack to write
+     */
+    void writeSample(const stack_count &stack) {
+        // Collect the location ids first, as the locations are written before the sample.
+        // Every captured address is one location, recursive calls have equal addresses
+        std::vector<uint64_t> ids;
+        const std::vector<void *> &addresses = stack.trace.getAddresses();
+        for (size_t i = 0; i < addresses.size(); i++) {
+            const std::pair<const frame *, const frame *> range = stack.trace.getAddressFrames(i);
+            ids.push_back(locationId(addresses[i], range.first, range.second));
+        }
+
+        std::string packed;
+        for (uint64_t id : ids) {
+            writeVarint(packed, id);
+        }
+
+        std::string values;
+        writeVarint(values, stack.count);
+        if (period != 0) writeVarint(values, stack.count * period);
+
+        message.clear();
+        writeVarint(message, 1 << 3 | 2);
+        writeBytes(message, packed);
+        writeVarint(message, 2 << 3 | 2);
+        writeBytes(message, values);
+        writeMessage(2, message);
+    }
+
+private:
+    /**
+     * Write a length delimited field of the profile
+     *
+     * @param field the field number
+     * @param data the data of the field
+     */
+    void writeMessage(uint64_t field, const std::string &data) {
+        std::string header;
+        writeVarint(header, field << 3 | 2);
+        writeVarint(header, data.size());
+
+        writeString(write, ctx, header);
+        writeString(write, ctx, data);
+    }
+
+    /**
+     * Write a ValueType
+     *
+     * @param field the field number of the value type
+     * @param type the type
+     * @param unit the unit
+     */
+    void writeValueType(uint64_t field, std::string_view type, std::string_view unit) {
+        const size_t typeId = stringId(type), unitId = stringId(unit);
+
+        message.clear();
+        writeVarint(message, 1 << 3);
+        writeVarint(message, typeId);
+        writeVarint(message, 2 << 3);
+        writeVarint(message, unitId);
+        writeMessage(field, message);
+    }
+
+    /**
+     * Get the id of a string, write it to the string table if it is new
+     *
+     * @param str the interned string or a string literal
+     * @return the id of the string
+     */
+    size_t stringId(std::string_view str) {
+        auto it = strings.emplace(str.empty() ? "" : str.data(), strings.size());
+        if (it.second) {
+            std::string data(str);
+            writeMessage(6, data);
+        }
+
+        return it.first->second;
+    }
+
+    /**
+     * Get the id of the function of a frame, write it if it is new
+     *
+     * @param f the frame
+     * @return the id of the function
+     */
+    uint64_t functionId(const frame &f) {
+        const std::pair<const char *, const char *> key(f.getFunction().data(), f.getFullFilePath().data());
+        auto it = functions.find(key);
+        if (it != functions.end()) return it->second;
+
+        const uint64_t id = functions.size() + 1;
+        functions.emplace(key, id);
+
+        const size_t name = stringId(f.getFunction()), file = stringId(f.getFullFilePath());
+        std::string function;
+        writeVarint(function, 1 << 3);
+        writeVarint(function, id);
+        writeVarint(function, 2 << 3);
+        writeVarint(function, name);
+        writeVarint(function, 3 << 3);
+        writeVarint(function, name);
+        writeVarint(function, 4 << 3);
+        writeVarint(function, file);
+        writeMessage(5, function);
+
+        return id;
+    }
+
+    /**
+     * Get the id of the location of a captured address, write it if it is new
+     *
+     * @param address the captured address
+     * @param first the first frame of the address, the inlined frames come first
+     * @param last the end of the frames of the address
+     * @return the id of the location
+     */
+    uint64_t locationId(const void *address, const frame *first, const frame *last) {
+        auto it = locations.find(address);
+        if (it != locations.end()) return it->second;
+
+        const uint64_t id = locations.size() + 1;
+        locations.emplace(address, id);
+
+        std::string location;
+        writeVarint(location, 1 << 3);
+        writeVarint(location, id);
+        writeVarint(location, 3 << 3);
+        writeVarint(location, (uintptr_t) address);
+
+        // The caller comes last, after the functions inlined into it
+        for (const frame *f = first; f != last; f++) {
+            line.clear();
+            writeVarint(line, 1 << 3);
+            writeVarint(line, functionId(*f));
+            writeVarint(line, 2 << 3);
+            writeVarint(line, f->getLine());
+
+            writeVarint(location, 4 << 3 | 2);
+            writeBytes(location, line);
+        }
+
+        writeMessage(4, location);
+        return id;
+    }
+
+    // The function to write to
+    frame_writer write;
+
+    // The context passed to write
+    void *ctx;
+
+    // The cpu time per sample in nanoseconds or 0
+    uint64_t period;
+
+    // The ids of all written strings
+    std::unordered_map<const char *, size_t> strings;
+
+    // The ids of all written functions by their name and file
+    std::map<std::pair<const char *, const char *>, uint64_t> functions;
+
+    // The ids of all written locations by their captured address
+    std::unordered_map<const void *, uint64_t> locations;
+
+    // Buffers reused for the messages
+    std::string message, line;
+};
+
+// stack_aggregator ===================
+
+/**
+ * Resolve the unique addresses of many stack traces at once
+ *
+ * @param traces the traces to resolve
+ * @param level the level of detail to resolve the traces with
+ */
+static void resolveTogether(std::vector<stacktrace> &traces, resolve_level level) {
+    if (traces.empty()) return;
+
+    symbol_table symbols = stacktrace::symbolize(traces, level);
+    for (stacktrace &trace : traces) {
+        trace.resolveFrom(symbols);
+    }
+}
+
+/**
+ * Get the n stacks with the largest weight, the largest one first. Equal weights are
+ * ordered by their key. Only the returned stacks are sorted and resolved, all at once.
+ *
+ * @tparam T the type of the returned stacks, must have a stacktrace member named trace
+ * @param entries the usage of every stack as key/value pairs. Will be reordered
+ * @param n the max number of stacks to return
+ * @param level the level of detail to resolve the stacks with
+ * @param weight get the weight of a value
+ * @param make create a returned stack from an entry
+ * @return the stacks with the largest weight
+ */
+template<class T, class K, class V, class Weight, class Make>
+static std::vector<T> topStacks(std::vector<std::pair<K, V>> &entries, size_t n, resolve_level level,
+                                Weight weight, Make make) {
+    n = std::min(n, entries.size());
+    std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+                      [&weight](const std::pair<K, V> &a, const std::pair<K, V> &b) {
+                          return weight(a.second) > weight(b.second) ||
+                                 (weight(a.second) == weight(b.second) && a.first < b.first);
+                      });
+
+    std::vector<T> res;
+    std::vector<stacktrace> traces;
+    res.reserve(n);
+    traces.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        res.push_back(make(entries[i]));
+        traces.push_back(res.back().trace);
+    }
+
+    // The copies share their frames with the returned stacks
+    resolveTogether(traces, level);
+    return res;
+}
+
+struct stack_aggregator::thread_buffer {
+    // The counts of every stack by its id.
+    // Only locked by the owning thread and while merging.
+    std::unordered_map<uint32_t, size_t> counts;
+
+    // A mutex guarding counts
+    std::mutex mtx;
+};
+
+/**
+ * A buffer of the current thread, owned by its aggregator
+ */
+struct local_buffer {
+    // The buffer, only valid while owner is not expired
+    void *buffer;
+
+    // The owning pointer of the aggregator
+    std::weak_ptr<void> owner;
+};
+
+/**
+ * Get the buffers of the current thread by the id of their aggregator
+ *
+ * @return the buffers of the current thread
+ */
+static std::unordered_map<uint64_t, local_buffer> &threadBuffers() {
+    thread_local std::unordered_map<uint64_t, local_buffer> buffers;
+    return buffers;
+}
+
+/**
+ * Get a new unique id for a stack_aggregator. Ids are never
+ * reused, so buffers of destroyed aggregators are never found.
+ *
+ * @return the new id
+ */
+static uint64_t nextAggregatorId() {
+    static std::atomic<uint64_t> nextId(0);
+    return nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+stack_aggregator::stack_aggregator(size_t capacity, resolve_level level)
+        : table(capacity), level(level), id(nextAggregatorId()), buffers(), counts(), droppedCount(0), mtx() {}
+
+void stack_aggregator::record(unsigned long framesToSkip, size_t maxFrames) {
+    count(table.capture(framesToSkip, maxFrames, level));
+}
+
+void stack_aggregator::record(const stacktrace &trace) {
+    const std::vector<void *> &addresses = trace.getAddresses();
+    count(table.intern(addresses.data(), addresses.size(), level));
+}
+
+void stack_aggregator::record(void *const *addresses, size_t size) {
+    count(table.intern(addresses, size, level));
+}
+
+STACKTRACE_NODISCARD std::vector<stack_count> stack_aggregator::top(size_t n) {
+    std::vector<std::pair<uint32_t, size_t>> sorted;
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        merge();
+        sorted.assign(counts.begin(), counts.end());
+    }
+
+    return topStacks<stack_count>(sorted, n, level, [](size_t count) { return count; },
+                                  [this](const std::pair<uint32_t, size_t> &entry) {
+                                      return stack_count{table.get(entry.first), entry.second};
+                                  });
+}
+
+STACKTRACE_NODISCARD size_t stack_aggregator::total() {
+    std::unique_lock<std::mutex> lock(mtx);
+    merge();
+
+    size_t res = droppedCount.load(std::memory_order_relaxed);
+    for (const auto &p : counts) {
+        res += p.second;
+    }
+
+    return res;
+}
+
+STACKTRACE_NODISCARD size_t stack_aggregator::dropped() const noexcept {
+    return droppedCount.load(std::memory_order_relaxed);
+}
+
+void stack_aggregator::writeFolded(frame_writer write, void *ctx) {
+    writeFoldedStacks(top(SIZE_MAX), write, ctx);
+}
+
+std::ostream &stack_aggregator::writeFolded(std::ostream &os) {
+    writeFolded(writeToStream, &os);
+    return os;
+}
+
+void stack_aggregator::writePprof(frame_writer write, void *ctx) {
+    pprof_writer writer(write, ctx, 0);
+    for (const stack_count &c : top(SIZE_MAX)) {
+        writer.writeSample(c);
+    }
+}
+
+std::ostream &stack_aggregator::writePprof(std::ostream &os) {
+    writePprof(writeToStream, &os);
+    return os;
+}
+
+void stack_aggregator::clear() {
+    std::unique_lock<std::mutex> lock(mtx);
+    for (const std::shared_ptr<thread_buffer> &buffer : buffers) {
+        std::unique_lock<std::mutex> bufferLock(buffer->mtx);
+        buffer->counts.clear();
+    }
+
+    counts.clear();
+    droppedCount.store(0, std::memory_order_relaxed);
+}
+
+stack_aggregator::~stack_aggregator() noexcept {
+    // Remove the buffer of the current thread, the entries of other
+    // threads are removed once they record into another aggregator
+    threadBuffers().erase(id);
+}
+
+stack_aggregator::thread_buffer &stack_aggregator::localBuffer() {
+    // The aggregator owns its buffers, so the buffer is alive while it is used
+    std::unordered_map<uint64_t, local_buffer> &local = threadBuffers();
+    auto it = local.find(id);
+    if (it != local.end()) return *static_cast<thread_buffer *>(it->second.buffer);
+
+    // Remove the buffers of destroyed aggregators, so long-lived threads don't keep them
+    for (auto entry = local.begin(); entry != local.end();) {
+        entry = entry->second.owner.expired() ? local.erase(entry) : std::next(entry);
+    }
+
+    auto created = std::make_shared<thread_buffer>();
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        buffers.push_back(created);
+    }
+
+    local.emplace(id, local_buffer{created.get(), created});
+    return *created;
+}
+
+void stack_aggregator::count(uint32_t stackId) {
+    if (stackId == stack_table::invalidId) {
+        droppedCount.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    thread_buffer &buffer = localBuffer();
+    std::unique_lock<std::mutex> lock(buffer.mtx);
+    buffer.counts[stackId]++;
+}
+
+void stack_aggregator::merge() {
+    for (const std::shared_ptr<thread_buffer> &buffer : buffers) {
+        std::unique_lock<std::mutex> lock(buffer->mtx);
+        for (auto &p : buffer->counts) {
+            if (p.second == 0) continue;
+
+            // Keep the entry, so recording the stack again does not allocate
+            counts[p.first] += p.second;
+            p.second = 0;
+        }
+    }
+}
+
+// call_tree ==========================
+
+call_tree::call_tree(resolve_level level) : level(level), nodes(), resolvedNodes(0), frames(), addressFrames() {
+    nodes.push_back({nullptr, npos, npos, npos, 0, 0});
+}
+
+void call_tree::insert(const stacktrace &trace, size_t count) {
+    const std::vector<void *> &addresses = trace.getAddresses();
+    insert(addresses.data(), addresses.size(), count);
+}
+
+void call_tree::insert(void *const *addresses, size_t size, size_t count) {
+    size_t current = 0;
+    nodes[current].inclusive += count;
+
+    // Walk down from the outermost frame
+    for (size_t i = size; i-- > 0;) {
+        size_t child = nodes[current].firstChild;
+        while (child != npos && nodes[child].address != addresses[i]) {
+            child = nodes[child].nextSibling;
+        }
+
+        if (child == npos) {
+            child = nodes.size();
+            nodes.push_back({addresses[i], current, npos, nodes[current].firstChild, 0, 0});
+            nodes[current].firstChild = child;
+        }
+
+        nodes[child].inclusive += count;
+        current = child;
+    }
+
+    nodes[current].exclusive += count;
+}
+
+STACKTRACE_NODISCARD const std::vector<call_tree_node> &call_tree::getNodes() const noexcept {
+    return nodes;
+}
+
+std::pair<const frame *, const frame *> call_tree::getFrames(size_t node) {
+    if (node == 0) return {nullptr, nullptr};
+
+    resolve();
+    const std::pair<size_t, size_t> &range = addressFrames.at(nodes.at(node).address);
+    return {frames.data() + range.first, frames.data() + range.first + range.second};
+}
+
+void call_tree::resolve() {
+    std::vector<void *> missing;
+    for (size_t i = std::max(resolvedNodes, (size_t) 1); i < nodes.size(); i++) {
+        if (addressFrames.find(nodes[i].address) == addressFrames.end()) {
+            missing.push_back(const_cast<void *>(nodes[i].address));
+            addressFrames.emplace(nodes[i].address, std::make_pair(0, 0));
+        }
+    }
+
+    resolvedNodes = nodes.size();
+    if (missing.empty()) return;
+
+    // Resolve every new address once
+    std::unordered_map<const void *, std::vector<frame>> resolved = resolveFrames(missing, level);
+    for (void *address : missing) {
+        std::pair<size_t, size_t> &range = addressFrames[address];
+        range.first = frames.size();
+
+        auto it = resolved.find(address);
+        if (it == resolved.end() || it->second.empty()) {
+            frames.push_back(selectFrame({}, address));
+        } else if (level == resolve_level::full) {
+            frames.insert(frames.end(), it->second.begin(), it->second.end());
+        } else {
+            frames.push_back(selectFrame(it->second, address));
+        }
+
+        range.second = frames.size() - range.first;
+    }
+}
+
+void call_tree::writeFolded(frame_writer write, void *ctx) {
+    // Different addresses in the same function have the same path, merge them
+    std::map<std::string, size_t> paths;
+    forEachPath([&paths](const std::string &path, size_t count) {
+        paths[path] += count;
+    });
+
+    for (const auto &p : paths) {
+        writeString(write, ctx, p.first);
+        writeString(write, ctx, " ");
+        writeDecimal(write, ctx, p.second);
+        writeString(write, ctx, "\n");
+    }
+}
+
+STACKTRACE_NODISCARD std::string call_tree::toFolded() {
+    std::string res;
+    writeFolded(appendToString, &res);
+
+    return res;
+}
+
+void call_tree::writeFoldedDiff(call_tree &before, call_tree &after, frame_writer write, void *ctx) {
+    // Sort the paths, so equal paths of both trees are next to each other
+    std::map<std::string, std::pair<size_t, size_t>> paths;
+    before.forEachPath([&paths](const std::string &path, size_t count) {
+        paths[path].first += count;
+    });
+
+    after.forEachPath([&paths](const std::string &path, size_t count) {
+        paths[path].second += count;
+    });
+
+    for (const auto &p : paths) {
+        writeString(write, ctx, p.first);
+        writeString(write, ctx, " ");
+        writeDecimal(write, ctx, p.second.first);
+        writeString(write, ctx, " ");
+        writeDecimal(write, ctx, p.second.second);
+        writeString(write, ctx, "\n");
+    }
+}
+
+STACKTRACE_NODISCARD size_t call_tree::size() const noexcept {
+    return nodes.size();
+}
+
+void call_tree::forEachPath(const std::function<void(const std::string &, size_t)> &fn) {
+    resolve();
+
+    // Depth first, the path always contains the names of the current node and its parents
+    std::string path;
+    std::vector<std::pair<size_t, size_t>> stack; // The node and the length of the path of its parent
+    for (size_t child = nodes[0].firstChild; child != npos; child = nodes[child].nextSibling) {
+        stack.emplace_back(child, 0);
+    }
+
+    while (!stack.empty()) {
+        const size_t node = stack.back().first;
+        path.resize(stack.back().second);
+        stack.pop_back();
+
+        // The actual function first, as inlined frames come before it
+        const std::pair<size_t, size_t> &range = addressFrames[nodes[node].address];
+        for (size_t i = range.first + range.second; i-- > range.first;) {
+            if (!path.empty()) path += ';';
+            path += frames[i].getFunction();
+        }
+
+        if (nodes[node].exclusive > 0) fn(path, nodes[node].exclusive);
+
+        for (size_t child = nodes[node].firstChild; child != npos; child = nodes[child].nextSibling) {
+            stack.emplace_back(child, path.size());
+        }
+    }
+}
+
+// contention_profiler ================
+
+// The running contention_profiler or nullptr
+static std::atomic<contention_profiler *> activeContentionProfiler(nullptr);
+
+// The number of hooks currently using activeContentionProfiler
+static std::atomic<size_t> contentionHooksInFlight(0);
+
+// The id of the next lock
+static std::atomic<uint32_t> nextLockId(1);
+
+// The number of short waits the current thread may do until the next one is sampled
+static thread_local size_t waitsUntilSample = 0;
+
+/**
+ * Get the nanoseconds passed since a point in time
+ *
+ * @param start the point in time
+ * @return the nanoseconds passed
+ */
+static uint64_t nanosSince(std::chrono::steady_clock::time_point start) noexcept {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+contention_profiler::contention_profiler(const contention_options &options)
+        : options(options), table(options.maxStacks), usage(), names(), droppedWaits(0), running(false), mtx() {
+    if (options.maxFrames == 0 || options.maxFrames > 256) {
+        throw std::invalid_argument("Invalid contention_profiler options");
+    }
+}
+
+void contention_profiler::start() {
+    if (running) return;
+
+    contention_profiler *expected = nullptr;
+    if (!activeContentionProfiler.compare_exchange_strong(expected, this)) {
+        throw std::runtime_error("Another contention_profiler is already running");
+    }
+
+    running = true;
+}
+
+void contention_profiler::stop() {
+    if (!running) return;
+
+    running = false;
+    activeContentionProfiler = nullptr;
+
+    // Wait for all hooks which may still use this profiler
+    while (contentionHooksInFlight.load() != 0) {
+        std::this_thread::yield();
+    }
+}
+
+STACKTRACE_NODISCARD bool contention_profiler::isRunning() const noexcept {
+    return running;
+}
+
+STACKTRACE_NODISCARD std::vector<contention_stats> contention_profiler::top(size_t n) {
+    std::vector<std::pair<uint64_t, wait_usage>> sorted;
+    std::unordered_map<uint32_t, std::string> lockNames;
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        sorted.assign(usage.begin(), usage.end());
+        lockNames = names;
+    }
+
+    return topStacks<contention_stats>(
+            sorted, n, options.level, [](const wait_usage &u) { return u.totalWait; },
+            [this, &lockNames](const std::pair<uint64_t, wait_usage> &entry) {
+                const uint32_t lockId = (uint32_t) (entry.first >> 32);
+                const wait_usage &u = entry.second;
+                return contention_stats{table.get((uint32_t) entry.first), lockId, lockNames[lockId], u.waits,
+                                        u.totalWait, u.maxWait};
+            });
+}
+
+void contention_profiler::writeReport(std::ostream &out, size_t n) {
+    for (const contention_stats &s : top(n)) {
+        out << "Lock ";
+        if (!s.name.empty()) out << '\'' << s.name << "' ";
+        out << '#' << s.lock << ": " << s.waits << " waits, " << s.totalWait / 1000 << " us total, "
+            << s.maxWait / 1000 << " us max" << std::endl << s.trace << std::endl;
+    }
+}
+
+STACKTRACE_NODISCARD size_t contention_profiler::dropped() const noexcept {
+    return droppedWaits.load(std::memory_order_relaxed);
+}
+
+STACKTRACE_NODISCARD uint32_t contention_profiler::newLockId() noexcept {
+    return nextLockId.fetch_add(1, std::memory_order_relaxed);
+}
+
+STACKTRACE_NOINLINE void contention_profiler::onWait(uint32_t lock, std::string_view name, uint64_t nanos) noexcept {
+    waited(lock, name, nanos, STACKTRACE_RETURN_ADDRESS());
+}
+
+contention_profiler::~contention_profiler() noexcept {
+    stop();
+}
+
+void contention_profiler::waited(uint32_t lock, std::string_view name, uint64_t nanos, const void *caller) noexcept {
+    contentionHooksInFlight.fetch_add(1);
+    contention_profiler *profiler = activeContentionProfiler.load();
+    if (profiler != nullptr) {
+        // Waits over the threshold are always recorded, one of sampleRate shorter waits
+        // is recorded for all of them. The counter is shared by all locks of a thread.
+        const size_t sampleRate = profiler->options.sampleRate;
+        size_t waits = 0;
+        if (nanos >= profiler->options.threshold) {
+            waits = 1;
+        } else if (sampleRate > 0 && waitsUntilSample-- == 0) {
+            waitsUntilSample = sampleRate - 1;
+            waits = sampleRate;
+        }
+
+        if (waits > 0) {
+            try {
+                profiler->record(lock, name, nanos * waits, waits, caller);
+            } catch (...) {
+                profiler->droppedWaits.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    contentionHooksInFlight.fetch_sub(1);
+}
+
+void contention_profiler::record(uint32_t lock, std::string_view name, uint64_t nanos, size_t waits,
+                                 const void *caller) {
+    // Remove the frames of the profiler, the function which waited comes first
+    void *buffer[256];
+    const size_t captured = captureFromCaller(caller, buffer, options.maxFrames);
+
+    const uint32_t id = table.intern(buffer, captured, options.level);
+    if (id == stack_table::invalidId) {
+        droppedWaits.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    std::unique_lock<std::mutex> guard(mtx);
+    wait_usage &u = usage[((uint64_t) lock << 32) | id];
+    u.waits += waits;
+    u.totalWait += nanos;
+    u.maxWait = std::max(u.maxWait, nanos / waits);
+
+    if (names.find(lock) == names.end()) {
+        names.emplace(lock, std::string(name));
+    }
+}
+
+// traced_mutex =======================
+
+traced_mutex::traced_mutex(std::string name) : mtx(), id(contention_profiler::newLockId()), name(std::move(name)) {}
+
+STACKTRACE_NOINLINE void traced_mutex::lock() {
+    if (activeContentionProfiler.load(std::memory_order_relaxed) == nullptr) {
+        mtx.lock();
+    } else if (!mtx.try_lock()) {
+        const auto start = std::chrono::steady_clock::now();
+        mtx.lock();
+        contention_profiler::waited(id, name, nanosSince(start), STACKTRACE_RETURN_ADDRESS());
+    }
+}
+
+bool traced_mutex::try_lock() {
+    return mtx.try_lock();
+}
+
+void traced_mutex::unlock() {
+    mtx.unlock();
+}
+
+STACKTRACE_NODISCARD uint32_t traced_mutex::getId() const noexcept {
+    return id;
+}
+
+traced_shared_mutex::traced_shared_mutex(std::string name)
+        : mtx(), id(contention_profiler::newLockId()), name(std::move(name)) {}
+
+STACKTRACE_NOINLINE void traced_shared_mutex::lock() {
+    if (activeContentionProfiler.load(std::memory_order_relaxed) == nullptr) {
+        mtx.lock();
+    } else if (!mtx.try_lock()) {
+        const auto start = std::chrono::steady_clock::now();
+        mtx.lock();
+        contention_profiler::waited(id, name, nanosSince(start), STACKTRACE_RETURN_ADDRESS());
+    }
+}
+
+bool traced_shared_mutex::try_lock() {
+    return mtx.try_lock();
+}
+
+void traced_shared_mutex::unlock() {
+    mtx.unlock();
+}
+
+STACKTRACE_NOINLINE void traced_shared_mutex::lock_shared() {
+    if (activeContentionProfiler.load(std::memory_order_relaxed) == nullptr) {
+        mtx.lock_shared();
+    } else if (!mtx.try_lock_shared()) {
+        const auto start = std::chrono::steady_clock::now();
+        mtx.lock_shared();
+        contention_profiler::waited(id, name, nanosSince(start), STACKTRACE_RETURN_ADDRESS());
+    }
+}
+
+bool traced_shared_mutex::try_lock_shared() {
+    return mtx.try_lock_shared();
+}
+
+void traced_shared_mutex::unlock_shared() {
+    mtx.unlock_shared();
+}
+
+STACKTRACE_NODISCARD uint32_t traced_shared_mutex::getId() const noexcept {
+    return id;
+}
+
+#if defined(STACKTRACE_UNIX) && !defined(__APPLE__)
+
+// signal handlers ====================
+
+/**
+ * Install a signal handler receiving a siginfo_t
+ *
+ * @param signal the signal to handle
+ * @param handler the handler to install
+ * @param previous will be set to the action of the signal before the handler was installed
+ * @return true, if the handler was installed
+ */
+static bool installSignalHandler(int signal, void (*handler)(int, siginfo_t *, void *), struct sigaction &previous) {
+    struct sigaction action{};
+    action.sa_sigaction = handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(signal, &action, &previous) == 0;
+}
+
+/**
+ * Restore the action of a signal replaced by installSignalHandler.
+ * If the signal had its default action, the handler stays installed
+ * to catch signals which are still pending, it must do nothing once
+ * its owner stopped. Unlike SIG_IGN, a handler is reset on exec,
+ * so processes started later still get the default action.
+ *
+ * @param signal the signal
+ * @param previous the action of the signal before the handler was installed
+ */
+static void restoreSignalHandler(int signal, const struct sigaction &previous) {
+    if (previous.sa_handler != SIG_DFL) {
+        sigaction(signal, &previous, nullptr);
+    }
+}
+
+// sampling_profiler ==================
+
+// The max number of frames of the signal handler captured with every sample
+static constexpr size_t signalFrames = 8;
+
+// Whether a sampling_profiler is running
+static std::atomic<bool> profilerActive(false);
+
+// The SIGPROF action before the profiler was started
+static struct sigaction previousAction;
+
+/**
+ * Get the id of the calling thread
+ *
+ * @return the thread id
+ */
+static pid_t currentThreadId() {
+    return (pid_t) syscall(SYS_gettid);
+}
+
+/**
+ * Capture the stack of a thread interrupted by a signal, without
+ * the frames of the signal handler. Must not allocate or lock.
+ *
+ * @param pc the address the thread was interrupted at or nullptr if unknown
+ * @param buffer the buffer to write the addresses to
+ * @param size the max number of addresses to capture, at most 256
+ * @return the number of captured addresses
+ */
+static size_t captureInterrupted(const void *pc, void **buffer, size_t size) noexcept {
+    void *captured[256 + signalFrames];
+    const size_t count = std::max(backtrace(captured, (int) (size + signalFrames)), 0);
+
+    // Remove the frames of the signal handler, the interrupted frame comes first
+    size_t first = 0;
+    while (first < count && first < signalFrames && captured[first] != pc) first++;
+    if (first == count || first == signalFrames) first = 0;
+
+    const size_t res = std::min(count - first, size);
+    std::copy(captured + first, captured + first + res, buffer);
+
+    return res;
+}
+
+struct sampling_profiler::sample_ring {
+    sample_ring(size_t capacity, size_t maxFrames, pid_t thread)
+            : capacity(capacity), maxFrames(maxFrames), frames(new void *[capacity * maxFrames]),
+              sizes(new size_t[capacity]), head(0), tail(0), droppedSamples(0), timer(), thread(thread),
+              active(false) {}
+
+    /**
+     * Capture the current stack into the next slot. Called
+     * by the signal handler, must not allocate or lock.
+     *
+     * @param pc the address the thread was interrupted at or nullptr if unknown
+     */
+    void push(const void *pc) noexcept {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= capacity) {
+            droppedSamples.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        const size_t slot = h % capacity;
+        sizes[slot] = captureInterrupted(pc, frames.get() + slot * maxFrames, maxFrames);
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    // The max number of samples
+    const size_t capacity;
+
+    // The max number of frames of a sample
+    const size_t maxFrames;
+
+    // The frames of all samples, maxFrames per sample
+    std::unique_ptr<void *[]> frames;
+
+    // The number of frames of every sample
+    std::unique_ptr<size_t[]> sizes;
+
+    // The number of samples pushed by the signal handler
+    std::atomic<size_t> head;
+
+    // The number of samples taken by the collector
+    std::atomic<size_t> tail;
+
+    // The number of samples dropped as the ring was full
+    std::atomic<size_t> droppedSamples;
+
+    // The timer sending the signals to the thread
+    timer_t timer;
+
+    // The id of the profiled thread
+    pid_t thread;
+
+    // Whether the timer exists
+    bool active;
+};
+
+/**
+ * Get the address a thread was interrupted at by a signal
+ *
+ * @param context the context passed to the signal handler
+ * @return the address or nullptr if not supported on this platform
+ */
+static const void *interruptedAddress(void *context) noexcept {
+    STACKTRACE_UNUSED const ucontext_t *ctx = static_cast<const ucontext_t *>(context);
+#if defined(__x86_64__)
+    return (const void *) ctx->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return (const void *) ctx->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+    return (const void *) ctx->uc_mcontext.pc;
+#elif defined(__arm__)
+    return (const void *) ctx->uc_mcontext.arm_pc;
+#else
+    return nullptr;
+#endif
+}
+
+void sampling_profiler::onSignal(int, siginfo_t *info, void *context) {
+    const int savedErrno = errno;
+    if (info->si_code == SI_TIMER && info->si_value.sival_ptr != nullptr && profilerActive.load()) {
+        static_cast<sample_ring *>(info->si_value.sival_ptr)->push(interruptedAddress(context));
+    }
+
+    errno = savedErrno;
+}
+
+sampling_profiler::sampling_profiler(const profiler_options &options)
+        : options(options), aggregator(options.maxStacks, options.level), rings(), collector(), stopped(),
+          running(false), mtx() {
+    if (options.frequency == 0 || options.maxFrames == 0 || options.maxFrames > 256 || options.bufferSize == 0) {
+        throw std::invalid_argument("Invalid sampling_profiler options");
+    }
+}
+
+void sampling_profiler::start() {
+    if (running) return;
+
+    bool expected = false;
+    if (!profilerActive.compare_exchange_strong(expected, true)) {
+        throw std::runtime_error("Another sampling_profiler is already running");
+    }
+
+    // Load the unwinder now, backtrace may allocate on the first call
+    void *buffer[1];
+    backtrace(buffer, 1);
+
+    if (!installSignalHandler(SIGPROF, onSignal, previousAction)) {
+        profilerActive = false;
+        throw std::runtime_error(std::string("Could not install the SIGPROF handler: ") + strerror(errno));
+    }
+
+    running = true;
+    collector = std::thread([this] {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (running) {
+            stopped.wait_for(lock, std::chrono::milliseconds(options.collectInterval));
+            drain();
+        }
+    });
+
+    try {
+        addThread();
+    } catch (...) {
+        stop();
+        throw;
+    }
+}
+
+void sampling_profiler::stop() {
+    if (!running) return;
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        for (const std::unique_ptr<sample_ring> &ring : rings) {
+            if (ring->active) timer_delete(ring->timer);
+            ring->active = false;
+        }
+
+        running = false;
+    }
+
+    stopped.notify_all();
+    collector.join();
+
+    restoreSignalHandler(SIGPROF, previousAction);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    drain();
+    profilerActive = false;
+}
+
+void sampling_profiler::addThread() {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (!running) {
+        throw std::runtime_error("The sampling_profiler is not running");
+    }
+
+    const pid_t thread = currentThreadId();
+    for (const std::unique_ptr<sample_ring> &ring : rings) {
+        if (ring->thread == thread && ring->active) return;
+    }
+
+    auto ring = std::make_unique<sample_ring>(options.bufferSize, options.maxFrames, thread);
+
+    struct sigevent event{};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_value.sival_ptr = ring.get();
+    event.sigev_notify_thread_id = thread;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &ring->timer) != 0) {
+        throw std::runtime_error(std::string("Could not create the profiling timer: ") + strerror(errno));
+    }
+
+    const long interval = (long) (1000000000 / options.frequency);
+    struct itimerspec spec{};
+    spec.it_interval.tv_sec = interval / 1000000000;
+    spec.it_interval.tv_nsec = interval % 1000000000;
+    spec.it_value = spec.it_interval;
+
+    // Keep the ring, so pending signals never use a freed ring
+    ring->active = true;
+    rings.push_back(std::move(ring));
+    if (timer_settime(rings.back()->timer, 0, &spec, nullptr) != 0) {
+        timer_delete(rings.back()->timer);
+        rings.back()->active = false;
+        throw std::runtime_error(std::string("Could not start the profiling timer: ") + strerror(errno));
+    }
+}
+
+void sampling_profiler::removeThread() {
+    std::unique_lock<std::mutex> lock(mtx);
+    const pid_t thread = currentThreadId();
+    for (const std::unique_ptr<sample_ring> &ring : rings) {
+        if (ring->thread == thread && ring->active) {
+            timer_delete(ring->timer);
+            ring->active = false;
+        }
+    }
+}
+
+STACKTRACE_NODISCARD bool sampling_profiler::isRunning() const noexcept {
+    return running;
+}
+
+void sampling_profiler::collect() {
+    std::unique_lock<std::mutex> lock(mtx);
+    drain();
+}
+
+STACKTRACE_NODISCARD std::vector<stack_count> sampling_profiler::top(size_t n) {
+    collect();
+    return aggregator.top(n);
+}
+
+STACKTRACE_NODISCARD size_t sampling_profiler::samples() {
+    collect();
+    return aggregator.total() + dropped() - aggregator.dropped();
+}
+
+void sampling_profiler::writeFolded(frame_writer write, void *ctx) {
+    collect();
+    aggregator.writeFolded(write, ctx);
+}
+
+std::ostream &sampling_profiler::writeFolded(std::ostream &os) {
+    writeFolded(writeToStream, &os);
+    return os;
+}
+
+void sampling_profiler::writePprof(frame_writer write, void *ctx) {
+    collect();
+
+    pprof_writer writer(write, ctx, 1000000000 / options.frequency);
+    for (const stack_count &c : aggregator.top(SIZE_MAX)) {
+        writer.writeSample(c);
+    }
+}
+
+std::ostream &sampling_profiler::writePprof(std::ostream &os) {
+    writePprof(writeToStream, &os);
+    return os;
+}
+
+STACKTRACE_NODISCARD size_t sampling_profiler::dropped() const {
+    std::unique_lock<std::mutex> lock(mtx);
+    size_t res = aggregator.dropped();
+    for (const std::unique_ptr<sample_ring> &ring : rings) {
+        res += ring->droppedSamples.load(std::memory_order_relaxed);
+    }
+
+    return res;
+}
+
+sampling_profiler::~sampling_profiler() noexcept {
+    stop();
+}
+
+void sampling_profiler::drain() {
+    for (const std::unique_ptr<sample_ring> &ring : rings) {
+        const size_t h = ring->head.load(std::memory_order_acquire);
+        for (size_t t = ring->tail.load(std::memory_order_relaxed); t != h; t++) {
+            const size_t slot = t % ring->capacity;
+            aggregator.record(ring->frames.get() + slot * ring->maxFrames, ring->sizes[slot]);
+        }
+
+        ring->tail.store(h, std::memory_order_release);
+    }
+}
+
+// allocation_profiler ================
+
+// The running allocation_profiler or nullptr
+static std::atomic<allocation_profiler *> activeAllocationProfiler(nullptr);
+
+// The number of hooks currently using activeAllocationProfiler
+static std::atomic<size_t> allocationHooksInFlight(0);
+
+// The number of live sampled allocations by the hash of their address.
+// Used by onFree to skip the lookup of allocations which were never sampled.
+static std::atomic<uint32_t> sampledAllocations[1 << 14];
+
+// The mean number of bytes between two samples of the running profiler
+static std::atomic<size_t> allocationSampleInterval(0);
+
+// Whether the current thread is inside the profiler. Allocations made by the
+// profiler itself are not sampled. Initial exec, so accessing it never allocates.
+static thread_local bool inAllocationProfiler __attribute__((tls_model("initial-exec"))) = false;
+
+// The number of bytes the current thread may allocate until the next sample
+static thread_local int64_t bytesUntilSample __attribute__((tls_model("initial-exec"))) = 0;
+
+// The state of the random number generator of the current thread
+static thread_local uint64_t sampleRandomState __attribute__((tls_model("initial-exec"))) = 0;
+
+/**
+ * Marks the current thread as inside the profiler while it exists
+ */
+class allocation_guard {
+public:
+    allocation_guard() noexcept: previous(inAllocationProfiler) {
+        inAllocationProfiler = true;
+    }
+
+    ~allocation_guard() noexcept {
+        inAllocationProfiler = previous;
+    }
+
+private:
+    // Whether the thread was inside the profiler before
+    bool previous;
+};
+
+/**
+ * Get the slot of an allocation in sampledAllocations
+ *
+ * @param ptr the allocated memory
+ * @return the slot
+ */
+static std::atomic<uint32_t> &sampledSlot(const void *ptr) noexcept {
+    const uintptr_t value = (uintptr_t) ptr >> 4;
+    return sampledAllocations[(value ^ (value >> 14)) & ((1 << 14) - 1)];
+}
+
+/**
+ * Get the number of bytes until the next sample. The intervals are exponentially
+ * distributed, so every allocated byte has the same chance of being sampled.
+ *
+ * @param mean the mean interval
+ * @return the number of bytes
+ */
+static int64_t nextSampleInterval(size_t mean) noexcept {
+    if (sampleRandomState == 0) {
+        sampleRandomState = (uintptr_t) &sampleRandomState ^ (uint64_t) time(nullptr) ^ 0x9E3779B97F4A7C15ULL;
+    }
+
+    // xorshift64
+    sampleRandomState ^= sampleRandomState << 13;
+    sampleRandomState ^= sampleRandomState >> 7;
+    sampleRandomState ^= sampleRandomState << 17;
+
+    const double uniform = ((sampleRandomState >> 11) + 1) * (1.0 / 9007199254740993.0);
+    return (int64_t) (-std::log(uniform) * (double) mean) + 1;
+}
+
+allocation_profiler::allocation_profiler(const allocation_options &options)
+        : options(options), table(options.maxStacks), usage(options.maxStacks), live(), droppedSamples(0),
+          running(false), mtx() {
+    if (options.sampleInterval == 0 || options.maxFrames == 0 || options.maxFrames > 256) {
+        throw std::invalid_argument("Invalid allocation_profiler options");
+    }
+}
+
+void allocation_profiler::start() {
+    if (running) return;
+
+    // Load the unwinder now, backtrace may allocate on the first call
+    void *buffer[1];
+    backtrace(buffer, 1);
+
+    allocation_profiler *expected = nullptr;
+    allocationSampleInterval = options.sampleInterval;
+    if (!activeAllocationProfiler.compare_exchange_strong(expected, this)) {
+        throw std::runtime_error("Another allocation_profiler is already running");
+    }
+
+    running = true;
+}
+
+void allocation_profiler::stop() {
+    if (!running) return;
+
+    running = false;
+    activeAllocationProfiler = nullptr;
+
+    // Wait for all hooks which may still use this profiler
+    while (allocationHooksInFlight.load() != 0) {
+        std::this_thread::yield();
+    }
+
+    // Allocations freed from now on are not tracked anymore
+    allocation_guard guard;
+    std::unique_lock<std::mutex> lock(mtx);
+    for (const auto &p : live) {
+        sampledSlot(p.first).fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    live.clear();
+}
+
+STACKTRACE_NODISCARD bool allocation_profiler::isRunning() const noexcept {
+    return running;
+}
+
+STACKTRACE_NODISCARD std::vector<allocation_stats> allocation_profiler::top(size_t n) {
+    allocation_guard guard;
+    std::vector<std::pair<uint32_t, stack_usage>> sorted;
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        for (size_t i = 0; i < table.size(); i++) {
+            if (usage[i].totalAllocations > 0) sorted.emplace_back((uint32_t) i, usage[i]);
+        }
+    }
+
+    return topStacks<allocation_stats>(
+            sorted, n, options.level, [](const stack_usage &u) { return u.liveBytes; },
+            [this](const std::pair<uint32_t, stack_usage> &entry) {
+                const stack_usage &u = entry.second;
+                return allocation_stats{table.get(entry.first), u.liveBytes, u.liveAllocations, u.totalBytes,
+                                        u.totalAllocations};
+            });
+}
+
+STACKTRACE_NODISCARD size_t allocation_profiler::dropped() const noexcept {
+    return droppedSamples.load(std::memory_order_relaxed);
+}
+
+STACKTRACE_NOINLINE void allocation_profiler::onAllocation(void *ptr, size_t size) noexcept {
+    const size_t interval = allocationSampleInterval.load(std::memory_order_relaxed);
+    if (ptr == nullptr || inAllocationProfiler || activeAllocationProfiler.load(std::memory_order_relaxed) == nullptr) {
+        return;
+    }
+
+    // Only sample about one allocation per interval bytes
+    bytesUntilSample -= (int64_t) size;
+    if (bytesUntilSample > 0) return;
+
+    allocation_guard guard;
+    bytesUntilSample = nextSampleInterval(interval);
+
+    allocationHooksInFlight.fetch_add(1);
+    allocation_profiler *profiler = activeAllocationProfiler.load();
+    if (profiler != nullptr) {
+        try {
+            profiler->record(ptr, size, STACKTRACE_RETURN_ADDRESS());
+        } catch (...) {
+            profiler->droppedSamples.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    allocationHooksInFlight.fetch_sub(1);
+}
+
+void allocation_profiler::onFree(void *ptr) noexcept {
+    if (ptr == nullptr || inAllocationProfiler || sampledSlot(ptr).load(std::memory_order_relaxed) == 0) return;
+
+    allocation_guard guard;
+    allocationHooksInFlight.fetch_add(1);
+    allocation_profiler *profiler = activeAllocationProfiler.load();
+    if (profiler != nullptr) {
+        profiler->release(ptr);
+    }
+
+    allocationHooksInFlight.fetch_sub(1);
+}
+
+allocation_profiler::~allocation_profiler() noexcept {
+    stop();
+}
+
+void allocation_profiler::record(void *ptr, size_t size, const void *caller) {
+    // Remove the frames of the profiler, the caller of onAllocation comes first
+    void *buffer[256];
+    const size_t captured = captureFromCaller(caller, buffer, options.maxFrames);
+
+    const uint32_t id = table.intern(buffer, captured, options.level);
+    if (id == stack_table::invalidId) {
+        droppedSamples.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Every sample represents about interval bytes, smaller
+    // allocations are less likely to be sampled
+    const double interval = (double) options.sampleInterval;
+    const size_t bytes = (size_t) ((double) size / (1 - std::exp(-(double) size / interval)));
+    const size_t allocations = size > 0 ? std::max(bytes / size, (size_t) 1) : 1;
+
+    // Allocations reported twice are only counted once, as they are only released once
+    std::unique_lock<std::mutex> lock(mtx);
+    if (!live.emplace(ptr, sampled_allocation{id, bytes, allocations}).second) return;
+
+    sampledSlot(ptr).fetch_add(1, std::memory_order_relaxed);
+    stack_usage &u = usage[id];
+    u.liveBytes += bytes;
+    u.liveAllocations += allocations;
+    u.totalBytes += bytes;
+    u.totalAllocations += allocations;
+}
+
+void allocation_profiler::release(void *ptr) {
+    std::unique_lock<std::mutex> lock(mtx);
+    auto it = live.find(ptr);
+    if (it == live.end()) return;
+
+    stack_usage &u = usage[it->second.stack];
+    u.liveBytes -= it->second.bytes;
+    u.liveAllocations -= it->second.allocations;
+    sampledSlot(ptr).fetch_sub(1, std::memory_order_relaxed);
+    live.erase(it);
+}
+
+#   ifdef STACKTRACE_INTERPOSE_MALLOC
+// malloc interposition ===============
+
+extern "C" {
+// The allocator functions of glibc
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) noexcept {
+    void *ptr = __libc_malloc(size);
+    allocation_profiler::onAllocation(ptr, size);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+    void *ptr = __libc_calloc(count, size);
+    allocation_profiler::onAllocation(ptr, count * size);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+    void *res = __libc_realloc(ptr, size);
+
+    // A failed realloc keeps the old block, realloc to size 0 frees it
+    if (res != nullptr || size == 0) {
+        allocation_profiler::onFree(ptr);
+        allocation_profiler::onAllocation(res, size);
+    }
+
+    return res;
+}
+
+void free(void *ptr) noexcept {
+    allocation_profiler::onFree(ptr);
+    __libc_free(ptr);
+}
+}
+#   endif //STACKTRACE_INTERPOSE_MALLOC
+
+// watchdog ===========================
+
+// The running watchdog or nullptr
+static std::atomic<watchdog *> activeWatchdog(nullptr);
+
+// The number of signal handlers currently capturing a stack for the watchdog
+static std::atomic<size_t> watchdogHandlersInFlight(0);
+
+// The signal action before the watchdog was started
+static struct sigaction previousWatchdogAction;
+
+// The watched_thread of the current thread or nullptr
+static thread_local watched_thread *currentWatchedThread = nullptr;
+
+// The states of a stack capture of a watched_thread
+static constexpr int captureIdle = 0, captureRequested = 1, captureRunning = 2, captureDone = 3;
+
+/**
+ * Get the nanoseconds of the steady clock
+ *
+ * @return the current time
+ */
+static uint64_t steadyNanos() noexcept {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+watched_thread::watched_thread(std::string name, pid_t thread, size_t maxFrames)
+        : deadline(0), reported(0), frames(new void *[maxFrames]), maxFrames(maxFrames), size(0),
+          state(captureIdle), thread(thread), name(std::move(name)) {}
+
+/**
+ * Get the nanoseconds of the coarse monotonic clock, which is read without a system call.
+ * It is behind the steady clock by up to its resolution.
+ *
+ * @return the current time at the resolution of the coarse clock
+ */
+static uint64_t coarseNanos() noexcept {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Get the resolution of the coarse monotonic clock
+ *
+ * @return the resolution in nanoseconds
+ */
+static uint64_t coarseResolution() noexcept {
+    timespec ts{};
+    if (clock_getres(CLOCK_MONOTONIC_COARSE, &ts) != 0) return 10000000;
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+void watched_thread::arm(uint64_t timeout) noexcept {
+    // The coarse clock may be up to one tick behind, so the deadline never passes early
+    static const uint64_t resolution = coarseResolution();
+    deadline.store(coarseNanos() + resolution + timeout * 1000000, std::memory_order_relaxed);
+}
+
+void watched_thread::disarm() noexcept {
+    deadline.store(0, std::memory_order_relaxed);
+}
+
+STACKTRACE_NODISCARD const std::string &watched_thread::getName() const noexcept {
+    return name;
+}
+
+STACKTRACE_NODISCARD pid_t watched_thread::getThreadId() const noexcept {
+    return thread;
+}
+
+void watchdog::onSignal(int, siginfo_t *, void *context) {
+    const int savedErrno = errno;
+    watchdogHandlersInFlight.fetch_add(1);
+
+    watched_thread *watched = currentWatchedThread;
+    int expected = captureRequested;
+    if (activeWatchdog.load() != nullptr && watched != nullptr &&
+        watched->state.compare_exchange_strong(expected, captureRunning)) {
+        watched->size = captureInterrupted(interruptedAddress(context), watched->frames.get(), watched->maxFrames);
+        watched->state.store(captureDone, std::memory_order_release);
+    }
+
+    watchdogHandlersInFlight.fetch_sub(1);
+    errno = savedErrno;
+}
+
+watchdog::watchdog(const watchdog_options &options, stall_handler handler)
+        : options(options), handler(std::move(handler)), threads(), checker(), stopped(), running(false),
+          numStalls(0), mtx() {
+    if (options.checkInterval == 0 || options.maxFrames == 0 || options.maxFrames > 256) {
+        throw std::invalid_argument("Invalid watchdog options");
+    }
+}
+
+void watchdog::start() {
+    if (running) return;
+
+    watchdog *expected = nullptr;
+    if (!activeWatchdog.compare_exchange_strong(expected, this)) {
+        throw std::runtime_error("Another watchdog is already running");
+    }
+
+    // Load the unwinder now, backtrace may allocate on the first call
+    void *buffer[1];
+    backtrace(buffer, 1);
+
+    if (!installSignalHandler(options.signal, onSignal, previousWatchdogAction)) {
+        activeWatchdog = nullptr;
+        throw std::runtime_error(std::string("Could not install the watchdog signal handler: ") + strerror(errno));
+    }
+
+    running = true;
+    checker = std::thread([this] {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (running) {
+            stopped.wait_for(lock, std::chrono::milliseconds(options.checkInterval));
+            if (!running) break;
+
+            std::vector<stall_report> reports = check();
+            if (reports.empty()) continue;
+
+            // Call the handler without holding the lock, it may register threads
+            lock.unlock();
+            for (const stall_report &report : reports) {
+                if (handler) {
+                    handler(report);
+                } else {
+                    std::cerr << "Thread ";
+                    if (!report.name.empty()) std::cerr << '\'' << report.name << "' ";
+                    std::cerr << '#' << report.thread << " exceeded its deadline by " << report.overrun << "ms:"
+                              << std::endl << report.trace << std::endl;
+                }
+            }
+
+            lock.lock();
+        }
+    });
+}
+
+void watchdog::stop() {
+    if (!running) return;
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        running = false;
+    }
+
+    stopped.notify_all();
+    checker.join();
+
+    activeWatchdog = nullptr;
+    restoreSignalHandler(options.signal, previousWatchdogAction);
+
+    // Wait for all handlers which may still capture a stack
+    while (watchdogHandlersInFlight.load() != 0) {
+        std::this_thread::yield();
+    }
+}
+
+watched_thread &watchdog::addThread(const std::string &name) {
+    std::unique_lock<std::mutex> lock(mtx);
+    const pid_t thread = currentThreadId();
+    for (const std::unique_ptr<watched_thread> &watched : threads) {
+        if (watched->thread == thread) return *watched;
+    }
+
+    threads.push_back(std::unique_ptr<watched_thread>(new watched_thread(name, thread, options.maxFrames)));
+    currentWatchedThread = threads.back().get();
+    return *threads.back();
+}
+
+void watchdog::removeThread() {
+    std::unique_lock<std::mutex> lock(mtx);
+    const pid_t thread = currentThreadId();
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        if ((*it)->thread == thread) {
+            if (currentWatchedThread == it->get()) currentWatchedThread = nullptr;
+            threads.erase(it);
+            return;
+        }
+    }
+}
+
+STACKTRACE_NODISCARD bool watchdog::isRunning() const noexcept {
+    return running;
+}
+
+STACKTRACE_NODISCARD size_t watchdog::stalls() const noexcept {
+    return numStalls.load(std::memory_order_relaxed);
+}
+
+watchdog::~watchdog() noexcept {
+    stop();
+}
+
+std::vector<stall_report> watchdog::check() {
+    const uint64_t now = steadyNanos();
+    std::vector<watched_thread *> stalled;
+    for (const std::unique_ptr<watched_thread> &watched : threads) {
+        const uint64_t deadline = watched->deadline.load(std::memory_order_relaxed);
+        if (deadline == 0 || deadline == watched->reported || deadline > now) continue;
+
+        // Ask the thread to capture its own stack
+        watched->reported = deadline;
+        watched->state.store(captureRequested);
+        if (syscall(SYS_tgkill, getpid(), watched->thread, options.signal) == 0) {
+            stalled.push_back(watched.get());
+        } else {
+            watched->state.store(captureIdle);
+        }
+    }
+
+    std::vector<stall_report> reports;
+    std::vector<stacktrace> traces;
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.captureTimeout);
+    for (watched_thread *watched : stalled) {
+        while (watched->state.load(std::memory_order_acquire) != captureDone &&
+               std::chrono::steady_clock::now() < timeout) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        // Give up if the thread did not start capturing its stack in time
+        int expected = captureRequested;
+        if (!watched->state.compare_exchange_strong(expected, captureIdle)) {
+            while (watched->state.load(std::memory_order_acquire) != captureDone) {
+                std::this_thread::yield();
+            }
+
+            traces.emplace_back(std::vector<void *>(watched->frames.get(), watched->frames.get() + watched->size),
+                                options.level);
+            watched->state.store(captureIdle);
+        } else {
+            traces.emplace_back(std::vector<void *>(), options.level);
+        }
+
+        const uint64_t deadline = watched->reported;
+        reports.push_back({traces.back(), watched->name, watched->thread, (steadyNanos() - deadline) / 1000000});
+    }
+
+    // Resolve the stacks of all stalled threads at once
+    resolveTogether(traces, options.level);
+
+    numStalls.fetch_add(reports.size(), std::memory_order_relaxed);
+    return reports;
+}
+
+// thread_dump ========================
+
+/**
+ * The storage of the stack of a thread in a thread_dump
+ */
+struct dump_slot {
+    // The id of the thread
+    pid_t thread = 0;
+
+    // The captured frames
+    std::unique_ptr<void *[]> frames;
+
+    // The max number of frames to capture
+    size_t maxFrames = 0;
+
+    // The number of captured frames
+    size_t size = 0;
+
+    // The nanoseconds the thread spent capturing its stack
+    uint64_t pause = 0;
+
+    // Whether a capture is idle, requested, running or done
+    std::atomic<int> state{captureIdle};
+};
+
+// Only one dump is created at a time
+static std::mutex threadDumpMutex;
+
+// The slots of the dump which is created or nullptr
+static std::atomic<dump_slot *> dumpSlots(nullptr);
+
+// The number of slots in dumpSlots
+static std::atomic<size_t> dumpSlotCount(0);
+
+// The number of signal handlers currently using dumpSlots
+static std::atomic<size_t> dumpHandlersInFlight(0);
+
+/**
+ * The signal handler of thread dumps. Captures the stack
+ * of the calling thread into its slot of the running dump.
+ *
+ * @param context the interrupted context
+ */
+static void onDumpSignal(int, siginfo_t *, void *context) {
+    const int savedErrno = errno;
+    const uint64_t start = steadyNanos();
+    dumpHandlersInFlight.fetch_add(1);
+
+    dump_slot *slots = dumpSlots.load();
+    if (slots != nullptr) {
+        const pid_t thread = currentThreadId();
+        const size_t count = dumpSlotCount.load();
+        for (size_t i = 0; i < count; i++) {
+            if (slots[i].thread != thread) continue;
+
+            int expected = captureRequested;
+            if (slots[i].state.compare_exchange_strong(expected, captureRunning)) {
+                slots[i].size = captureInterrupted(interruptedAddress(context), slots[i].frames.get(),
+                                                   slots[i].maxFrames);
+                slots[i].pause = steadyNanos() - start;
+                slots[i].state.store(captureDone, std::memory_order_release);
+            }
+
+            break;
+        }
+    }
+
+    dumpHandlersInFlight.fetch_sub(1);
+    errno = savedErrno;
+}
+
+/**
+ * Get the ids of all threads of a process
+ *
+ * @param process the id of the process
+ * @return the thread ids, ordered
+ */
+static std::vector<pid_t> listThreads(pid_t process) {
+    DIR *dir = opendir(("/proc/" + std::to_string(process) + "/task").c_str());
+    if (dir == nullptr) {
+        throw std::runtime_error(std::string("Could not list the threads: ") + strerror(errno));
+    }
+
+    std::vector<pid_t> res;
+    while (const dirent *entry = readdir(dir)) {
+        char *end = nullptr;
+        const long id = strtol(entry->d_name, &end, 10);
+        if (*end == '\0' && id > 0) res.push_back((pid_t) id);
+    }
+
+    closedir(dir);
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+/**
+ * Get the name of a thread
+ *
+ * @param process the id of the process the thread belongs to
+ * @param thread the id of the thread
+ * @return the name or an empty string if the thread does not exist anymore
+ */
+static std::string threadName(pid_t process, pid_t thread) {
+    std::ifstream in("/proc/" + std::to_string(process) + "/task/" + std::to_string(thread) + "/comm");
+    std::string res;
+    std::getline(in, res);
+    return res;
+}
+
+STACKTRACE_NOINLINE thread_dump::thread_dump(const thread_dump_options &options) : threads(), duration(0) {
+    if (options.maxFrames == 0 || options.maxFrames > 256) {
+        throw std::invalid_argument("Invalid thread_dump options");
+    }
+
+    const uint64_t start = steadyNanos();
+    std::unique_lock<std::mutex> lock(threadDumpMutex);
+
+    // Allocate the slots of all threads before any thread is interrupted
+    const std::vector<pid_t> ids = listThreads(getpid());
+    const pid_t self = currentThreadId();
+    std::unique_ptr<dump_slot[]> slots(new dump_slot[ids.size()]);
+    for (size_t i = 0; i < ids.size(); i++) {
+        slots[i].thread = ids[i];
+        slots[i].frames.reset(new void *[options.maxFrames]);
+        slots[i].maxFrames = options.maxFrames;
+        slots[i].state = ids[i] == self ? captureIdle : captureRequested;
+    }
+
+    // Load the unwinder now, backtrace may allocate on the first call
+    void *buffer[1];
+    backtrace(buffer, 1);
+
+    struct sigaction previous{};
+    if (!installSignalHandler(options.signal, onDumpSignal, previous)) {
+        throw std::runtime_error(std::string("Could not install the thread dump signal handler: ") + strerror(errno));
+    }
+
+    dumpSlotCount = ids.size();
+    dumpSlots = slots.get();
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (ids[i] == self) {
+            slots[i].size = captureFromCaller(STACKTRACE_RETURN_ADDRESS(), slots[i].frames.get(), options.maxFrames);
+            slots[i].state = captureDone;
+        } else if (syscall(SYS_tgkill, getpid(), ids[i], options.signal) != 0) {
+            // The thread exited
+            slots[i].state = captureIdle;
+        }
+    }
+
+    // Wait for all threads, give up on the threads which did not start capturing their stack in time
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.timeout);
+    for (size_t i = 0; i < ids.size(); i++) {
+        while (slots[i].state.load(std::memory_order_acquire) == captureRequested &&
+               std::chrono::steady_clock::now() < timeout) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+
+        int expected = captureRequested;
+        slots[i].state.compare_exchange_strong(expected, captureIdle);
+        while (slots[i].state.load(std::memory_order_acquire) == captureRunning) {
+            std::this_thread::yield();
+        }
+    }
+
+    dumpSlots = nullptr;
+    restoreSignalHandler(options.signal, previous);
+
+    while (dumpHandlersInFlight.load() != 0) {
+        std::this_thread::yield();
+    }
+
+    std::vector<stacktrace> traces;
+    threads.reserve(ids.size());
+    traces.reserve(ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        const dump_slot &slot = slots[i];
+        const bool captured = slot.state.load() == captureDone;
+        std::vector<void *> addresses;
+        if (captured) addresses.assign(slot.frames.get(), slot.frames.get() + slot.size);
+
+        traces.emplace_back(std::move(addresses), options.level);
+        threads.push_back({slot.thread, threadName(getpid(), slot.thread), traces.back(), captured, slot.pause});
+    }
+
+    // Resolve the unique addresses of all threads at once
+    resolveTogether(traces, options.level);
+
+    duration = steadyNanos() - start;
+}
+
+STACKTRACE_NODISCARD const std::vector<thread_stack> &thread_dump::getThreads() const noexcept {
+    return threads;
+}
+
+STACKTRACE_NODISCARD size_t thread_dump::size() const noexcept {
+    return threads.size();
+}
+
+STACKTRACE_NODISCARD uint64_t thread_dump::getMaxPause() const noexcept {
+    uint64_t res = 0;
+    for (const thread_stack &t : threads) {
+        res = std::max(res, t.pause);
+    }
+
+    return res;
+}
+
+STACKTRACE_NODISCARD uint64_t thread_dump::getDuration() const noexcept {
+    return duration;
+}
+
+std::ostream &thread_dump::printTo(std::ostream &os, bool fullPaths) const {
+    for (const thread_stack &t : threads) {
+        os << "Thread ";
+        if (!t.name.empty()) os << '\'' << t.name << "' ";
+        os << '#' << t.thread;
+        if (t.captured) {
+            os << " (paused " << t.pause / 1000 << "us):" << std::endl;
+            t.trace.printTo(os, fullPaths);
+        } else {
+            os << ": stack not captured" << std::endl;
+        }
+
+        os << std::endl;
+    }
+
+    return os;
+}
+
+STACKTRACE_NODISCARD std::string thread_dump::toString(bool fullPaths) const {
+    std::stringstream ss;
+    printTo(ss, fullPaths);
+    return ss.str();
+}
+
+// flight_recorder ====================
+
+// The first bytes of a flight recorder file
+static const char recorderMagic[] = {'S', 'T', 'F', 'R'};
+
+// The version of the flight recorder file format
+static constexpr uint32_t recorderVersion = 2;
+
+// The max number of bytes of a build id stored in a flight recorder file, longer ones are truncated
+static constexpr size_t recorderBuildIdSize = 40;
+
+// The number of low bits of a recorded frame storing the offset, the module id is stored above them.
+// Frames with module id 0 are not in a known module and store their address.
+static constexpr unsigned recorderOffsetBits = 48;
+
+/**
+ * The header of a flight recorder file. It is followed by the module table at
+ * recorderModulesOffset and the record slots. The file uses the byte order of the writer.
+ */
+struct recorder_header {
+    // recorderMagic
+    char magic[4];
+
+    // recorderVersion
+    uint32_t version;
+
+    // The number of record slots
+    uint64_t slots;
+
+    // The max number of frames of a record
+    uint64_t maxFrames;
+
+    // The max number of modules in the module table
+    uint64_t maxModules;
+
+    // The number of modules in the module table
+    std::atomic<uint64_t> modules;
+
+    // The number of records which were started
+    std::atomic<uint64_t> next;
+
+    // The id of the process writing the file
+    uint64_t process;
+};
+
+/**
+ * A module in a flight recorder file
+ */
+struct recorder_module {
+    // The address the module is loaded at, the offsets of its frames are relative to it
+    uint64_t base;
+
+    // The end of the last segment of the module
+    uint64_t end;
+
+    // The number of bytes of the build id, 0 if the module has none
+    uint64_t buildIdSize;
+
+    // The build id of the module, truncated to recorderBuildIdSize bytes
+    char buildId[recorderBuildIdSize];
+
+    // The null terminated path of the module
+    char path[448];
+};
+
+/**
+ * The header of a record slot in a flight recorder file, followed by the frames of the record
+ */
+struct recorder_slot {
+    // 0 if never written, odd while written and 2 * (sequence + 1) once written
+    std::atomic<uint64_t> state;
+
+    // The time the record was written at in nanoseconds since the epoch
+    uint64_t timestamp;
+
+    // The checksum of the record, see recorderChecksum
+    uint64_t checksum;
+
+    // The id of the thread which wrote the record
+    uint32_t thread;
+
+    // The tag of the record
+    uint32_t tag;
+
+    // The number of frames
+    uint32_t count;
+
+    // Unused, keeps the frames aligned
+    uint32_t reserved;
+};
+
+// The offset of the module table in a flight recorder file
+static constexpr size_t recorderModulesOffset = 64;
+
+static_assert(sizeof(recorder_header) <= recorderModulesOffset, "The flight recorder header is too large");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The flight recorder requires lock free atomics");
+
+// The id of the current thread, cached as getting it is a syscall
+static thread_local pid_t recorderThreadId = 0;
+
+/**
+ * Get the offset of the first record slot in a flight recorder file
+ *
+ * @param maxModules the max number of modules of the file
+ * @return the offset
+ */
+static size_t recorderSlotsOffset(uint64_t maxModules) noexcept {
+    return recorderModulesOffset + (size_t) maxModules * sizeof(recorder_module);
+}
+
+/**
+ * Get the size of a record slot in a flight recorder file
+ *
+ * @param maxFrames the max number of frames of a record
+ * @return the size in bytes
+ */
+static size_t recorderSlotSize(uint64_t maxFrames) noexcept {
+    return sizeof(recorder_slot) + (size_t) maxFrames * sizeof(uint64_t);
+}
+
+/**
+ * Get a record slot of a mapped flight recorder file
+ *
+ * @param header the header of the file
+ * @param index the index of the slot
+ * @return the slot
+ */
+static recorder_slot *recorderSlot(const recorder_header *header, uint64_t index) noexcept {
+    auto *base = (char *) header + recorderSlotsOffset(header->maxModules);
+    return (recorder_slot *) (base + index * recorderSlotSize(header->maxFrames));
+}
+
+/**
+ * Get the checksum of a record, which detects records
+ * overwritten by another writer while they were written
+ *
+ * @param sequence the sequence number of the record
+ * @param timestamp the timestamp of the record
+ * @param thread the thread of the record
+ * @param tag the tag of the record
+ * @param frames the frames of the record
+ * @param count the number of frames
+ * @return the checksum
+ */
+static uint64_t recorderChecksum(uint64_t sequence, uint64_t timestamp, uint32_t thread, uint32_t tag,
+                                 const uint64_t *frames, uint32_t count) noexcept {
+    size_t res = hashCombine((size_t) sequence, (size_t) timestamp);
+    res = hashCombine(res, thread);
+    res = hashCombine(res, tag);
+    res = hashCombine(res, count);
+    for (uint32_t i = 0; i < count; i++) {
+        res = hashCombine(res, (size_t) frames[i]);
+    }
+
+    return res;
+}
+
+/**
+ * Find the build id in the notes of a module
+ *
+ * @param notes the notes of a PT_NOTE segment
+ * @param size the size of the segment
+ * @param align the alignment of the segment
+ * @return the build id or an empty string if the notes contain none
+ */
+static std::string findBuildId(const char *notes, size_t size, size_t align) {
+    // The name and description of a note are padded to the alignment of the segment
+    align = align == 8 ? 8 : 4;
+    const char *note = notes;
+    const char *end = notes + size;
+    while (note + sizeof(ElfW(Nhdr)) <= end) {
+        const auto *header = (const ElfW(Nhdr) *) note;
+        const char *name = note + sizeof(ElfW(Nhdr));
+        const char *desc = name + (header->n_namesz + align - 1) / align * align;
+        if (desc > end || header->n_descsz > (size_t) (end - desc)) break;
+
+        if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+            return std::string(desc, header->n_descsz);
+        }
+
+        note = desc + (header->n_descsz + align - 1) / align * align;
+    }
+
+    return "";
+}
+
+/**
+ * Get the build id of a module loaded into this process
+ *
+ * @param info the module
+ * @return the build id or an empty string if the module has none
+ */
+static std::string readBuildId(const dl_phdr_info *info) {
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+        if (phdr.p_type != PT_NOTE) continue;
+
+        std::string res = findBuildId((const char *) (info->dlpi_addr + phdr.p_vaddr), phdr.p_memsz, phdr.p_align);
+        if (!res.empty()) return res;
+    }
+
+    return "";
+}
+
+/**
+ * Get the build id of a module file
+ *
+ * @param path the path of the module
+ * @return the build id or an empty string if the file has none or could not be read
+ */
+static std::string readFileBuildId(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    ElfW(Ehdr) header{};
+    if (!in.read((char *) &header, sizeof(header)) || memcmp(header.e_ident, ELFMAG, SELFMAG) != 0 ||
+        header.e_phentsize != sizeof(ElfW(Phdr))) {
+        return "";
+    }
+
+    std::vector<ElfW(Phdr)> phdrs(header.e_phnum);
+    if (!in.seekg((std::streamoff) header.e_phoff) ||
+        !in.read((char *) phdrs.data(), (std::streamsize) (phdrs.size() * sizeof(ElfW(Phdr))))) {
+        return "";
+    }
+
+    for (const ElfW(Phdr) &phdr : phdrs) {
+        if (phdr.p_type != PT_NOTE || phdr.p_filesz > 4096) continue;
+
+        std::string notes(phdr.p_filesz, '\0');
+        if (in.seekg((std::streamoff) phdr.p_offset) && in.read(&notes[0], (std::streamsize) notes.size())) {
+            std::string res = findBuildId(notes.data(), notes.size(), phdr.p_align);
+            if (!res.empty()) return res;
+        }
+    }
+
+    return "";
+}
+
+/**
+ * A module loaded into this process and the addresses it is loaded at
+ */
+struct module_range {
+    // The path of the module
+    std::string path;
+
+    // The load bias of the module, which is added to the addresses in the module file
+    uintptr_t base;
+
+    // The end of the last segment of the module
+    uintptr_t end;
+
+    // The build id of the module or an empty string
+    std::string buildId;
+};
+
+/**
+ * Add the range of a module to a vector of module_range. This is called via dl_iterate_phdr.
+ */
+static int addModuleRange(dl_phdr_info *info, size_t, void *data) {
+    uintptr_t end = 0;
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+            const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+            end = std::max(end, (uintptr_t) (info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz));
+        }
+    }
+
+    if (end == 0) return 0;
+
+    // The main program has no name, use the path of the executable
+    std::string path;
+    if (info->dlpi_name != nullptr && *info->dlpi_name != '\0') {
+        path = info->dlpi_name;
+    } else {
+        char buffer[4096];
+        const ssize_t len = readlink("/proc/self/exe", buffer, sizeof(buffer));
+        if (len > 0) path.assign(buffer, (size_t) len);
+    }
+
+    ((std::vector<module_range> *) data)->push_back({std::move(path), (uintptr_t) info->dlpi_addr, end,
+                                                     readBuildId(info)});
+    return 0;
+}
+
+/**
+ * Get the address ranges of all modules loaded into this process
+ *
+ * @return the loaded modules
+ */
+static std::vector<module_range> getModuleRanges() {
+    std::vector<module_range> modules;
+    dl_iterate_phdr(addModuleRange, &modules);
+    return modules;
+}
+
+flight_recorder::flight_recorder(std::string path, const flight_recorder_options &options)
+        : mapping(nullptr), mappingSize(0), path(std::move(path)), mtx() {
+    if (options.slots == 0 || options.maxFrames == 0 || options.maxFrames > 256 || options.maxModules == 0 ||
+        options.maxModules >= ((size_t) 1 << (64 - recorderOffsetBits))) {
+        throw std::invalid_argument("Invalid flight_recorder options");
+    }
+
+    mappingSize = recorderSlotsOffset(options.maxModules) + options.slots * recorderSlotSize(options.maxFrames);
+    const int fd = open(this->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Could not create the flight recorder file " + this->path + ": " + strerror(errno));
+    }
+
+    // The new file is filled with zeros, so all slots are empty
+    if (ftruncate(fd, (off_t) mappingSize) != 0) {
+        const int error = errno;
+        close(fd);
+        throw std::runtime_error("Could not resize the flight recorder file " + this->path + ": " + strerror(error));
+    }
+
+    mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw std::runtime_error("Could not map the flight recorder file " + this->path + ": " + strerror(error));
+    }
+
+    auto *header = new(mapping) recorder_header();
+    std::copy(recorderMagic, recorderMagic + sizeof(recorderMagic), header->magic);
+    header->version = recorderVersion;
+    header->slots = options.slots;
+    header->maxFrames = options.maxFrames;
+    header->maxModules = options.maxModules;
+    header->process = (uint64_t) getpid();
+
+    // Load the unwinder now, backtrace may allocate on the first call
+    void *buffer[1];
+    backtrace(buffer, 1);
+
+    refreshModules();
+}
+
+STACKTRACE_NOINLINE void flight_recorder::record(uint32_t tag) noexcept {
+    void *buffer[256];
+    const size_t count = captureFromCaller(STACKTRACE_RETURN_ADDRESS(), buffer,
+                                           (size_t) static_cast<recorder_header *>(mapping)->maxFrames);
+    record(buffer, count, tag);
+}
+
+void flight_recorder::record(void *const *addresses, size_t count, uint32_t tag) noexcept {
+    auto *header = static_cast<recorder_header *>(mapping);
+    if (recorderThreadId == 0) recorderThreadId = currentThreadId();
+
+    // Take the next slot, overwriting the oldest record
+    const uint64_t sequence = header->next.fetch_add(1, std::memory_order_relaxed);
+    recorder_slot *slot = recorderSlot(header, sequence % header->slots);
+    slot->state.store(2 * sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // Store every frame as its module id and offset. Most frames are
+    // in the same module as the frame before, so that one is checked first.
+    const auto *modules = (const recorder_module *) ((char *) mapping + recorderModulesOffset);
+    const uint64_t moduleCount = header->modules.load(std::memory_order_acquire);
+    auto *frames = (uint64_t *) (slot + 1);
+    count = std::min(count, (size_t) header->maxFrames);
+
+    uint64_t last = 0;
+    for (size_t i = 0; i < count; i++) {
+        const auto address = (uint64_t) (uintptr_t) addresses[i];
+        if (last >= moduleCount || address < modules[last].base || address >= modules[last].end) {
+            last = 0;
+            while (last < moduleCount && (address < modules[last].base || address >= modules[last].end)) last++;
+        }
+
+        if (last < moduleCount) {
+            frames[i] = (last + 1) << recorderOffsetBits | (address - modules[last].base);
+        } else {
+            frames[i] = address & (((uint64_t) 1 << recorderOffsetBits) - 1);
+        }
+    }
+
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    slot->timestamp = (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+    slot->thread = (uint32_t) recorderThreadId;
+    slot->tag = tag;
+    slot->count = (uint32_t) count;
+    slot->checksum = recorderChecksum(sequence, slot->timestamp, slot->thread, tag, frames, slot->count);
+
+    // Only mark the record as written if no other writer took the slot in the meantime
+    uint64_t expected = 2 * sequence + 1;
+    slot->state.compare_exchange_strong(expected, 2 * sequence + 2, std::memory_order_release,
+                                        std::memory_order_relaxed);
+}
+
+void flight_recorder::refreshModules() {
+    std::unique_lock<std::mutex> lock(mtx);
+    auto *header = static_cast<recorder_header *>(mapping);
+    auto *modules = (recorder_module *) ((char *) mapping + recorderModulesOffset);
+
+    uint64_t count = header->modules.load();
+    for (const module_range &m : getModuleRanges()) {
+        bool known = false;
+        for (uint64_t i = 0; i < count && !known; i++) {
+            known = modules[i].base == m.base && m.path.compare(0, sizeof(modules[i].path) - 1, modules[i].path) == 0;
+        }
+
+        if (known) continue;
+        if (count == header->maxModules) break;
+
+        // Write the module before it is counted, so writers only see complete modules
+        recorder_module &module = modules[count];
+        module.base = m.base;
+        module.end = m.end;
+        module.buildIdSize = std::min(m.buildId.size(), recorderBuildIdSize);
+        std::copy(m.buildId.begin(), m.buildId.begin() + (std::ptrdiff_t) module.buildIdSize, module.buildId);
+        const size_t len = std::min(m.path.size(), sizeof(module.path) - 1);
+        std::copy(m.path.begin(), m.path.begin() + (std::ptrdiff_t) len, module.path);
+        module.path[len] = '\0';
+
+        header->modules.store(++count, std::memory_order_release);
+    }
+}
+
+STACKTRACE_NODISCARD uint64_t flight_recorder::size() const noexcept {
+    return static_cast<recorder_header *>(mapping)->next.load(std::memory_order_relaxed);
+}
+
+STACKTRACE_NODISCARD const std::string &flight_recorder::getPath() const noexcept {
+    return path;
+}
+
+flight_recorder::~flight_recorder() noexcept {
+    if (mapping != nullptr) munmap(mapping, mappingSize);
+}
+
+/**
+ * A module read from a flight recorder file
+ */
+struct recorded_module {
+    // The path of the module
+    std::string path;
+
+    // The build id of the module, truncated to recorderBuildIdSize bytes
+    std::string buildId;
+};
+
+/**
+ * A record copied from a flight recorder file
+ */
+struct raw_record {
+    // The sequence number of the record
+    uint64_t sequence;
+
+    // The time the record was written at in nanoseconds since the epoch
+    uint64_t timestamp;
+
+    // The checksum of the record
+    uint64_t checksum;
+
+    // The id of the thread which wrote the record
+    uint32_t thread;
+
+    // The tag of the record
+    uint32_t tag;
+
+    // The frames of the record
+    std::vector<uint64_t> frames;
+};
+
+std::vector<flight_record> flight_recorder::read(const std::string &path, resolve_level level) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open the flight recorder file " + path + ": " + strerror(errno));
+    }
+
+    struct stat st{};
+    void *mapped = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mapped = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+
+    const int error = errno;
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Could not map the flight recorder file " + path + ": " + strerror(error));
+    }
+
+    // The file may still be written to, so only complete records with a valid checksum are read
+    const auto size = (size_t) st.st_size;
+    const auto *header = (const recorder_header *) mapped;
+    std::vector<recorded_module> modules;
+    std::vector<raw_record> records;
+    bool valid = size >= recorderModulesOffset && std::equal(recorderMagic, recorderMagic + 4, header->magic) &&
+                 header->version == recorderVersion && header->slots > 0 && header->maxFrames > 0 &&
+                 header->maxFrames <= 256 && header->maxModules > 0 &&
+                 header->maxModules < ((uint64_t) 1 << (64 - recorderOffsetBits)) &&
+                 header->slots <= (size - recorderSlotsOffset(header->maxModules)) /
+                                  recorderSlotSize(header->maxFrames) &&
+                 recorderSlotsOffset(header->maxModules) + header->slots * recorderSlotSize(header->maxFrames) == size;
+
+    if (valid) {
+        const auto *table = (const recorder_module *) ((const char *) mapped + recorderModulesOffset);
+        const uint64_t moduleCount = std::min(header->modules.load(std::memory_order_acquire), header->maxModules);
+        for (uint64_t i = 0; i < moduleCount; i++) {
+            const size_t buildIdSize = std::min(table[i].buildIdSize, (uint64_t) recorderBuildIdSize);
+            modules.push_back({std::string(table[i].path, strnlen(table[i].path, sizeof(table[i].path))),
+                               std::string(table[i].buildId, buildIdSize)});
+        }
+
+        for (uint64_t i = 0; i < header->slots; i++) {
+            const recorder_slot *slot = recorderSlot(header, i);
+            const uint64_t state = slot->state.load(std::memory_order_acquire);
+            if (state == 0 || (state & 1) != 0) continue;
+
+            const uint32_t count = slot->count;
+            if (count > header->maxFrames) continue;
+
+            const auto *frames = (const uint64_t *) (slot + 1);
+            raw_record record{state / 2 - 1, slot->timestamp, slot->checksum, slot->thread, slot->tag,
+                              std::vector<uint64_t>(frames, frames + count)};
+
+            // Skip records which were overwritten while they were copied
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->state.load(std::memory_order_relaxed) != state ||
+                recorderChecksum(record.sequence, record.timestamp, record.thread, record.tag, record.frames.data(),
+                                 count) != record.checksum) {
+                continue;
+            }
+
+            records.push_back(std::move(record));
+        }
+    }
+
+    const bool sameProcess = valid && header->process == (uint64_t) getpid();
+    munmap(mapped, size);
+    if (!valid) {
+        throw std::invalid_argument("The file " + path + " is not a flight recorder file");
+    }
+
+    std::sort(records.begin(), records.end(), [](const raw_record &a, const raw_record &b) {
+        return a.sequence < b.sequence;
+    });
+
+    // Map the modules loaded into this process to their addresses in this process.
+    // A module with another build id is a different version of the recorded one.
+    std::vector<uintptr_t> bases(modules.size(), 0);
+    std::vector<bool> loaded(modules.size(), false);
+    for (const module_range &m : getModuleRanges()) {
+        for (size_t i = 0; i < modules.size(); i++) {
+            if (!loaded[i] && modules[i].path == m.path &&
+                modules[i].buildId == m.buildId.substr(0, recorderBuildIdSize)) {
+                bases[i] = m.base;
+                loaded[i] = true;
+            }
+        }
+    }
+
+    // Collect the addresses in this process and the offsets in the modules which are not loaded
+    std::vector<void *> local;
+    std::vector<std::vector<uintptr_t>> offsets(modules.size());
+    for (const raw_record &record : records) {
+        for (uint64_t value : record.frames) {
+            const uint64_t module = value >> recorderOffsetBits;
+            const uint64_t offset = value & (((uint64_t) 1 << recorderOffsetBits) - 1);
+            if (module == 0 || module > modules.size()) {
+                if (sameProcess) local.push_back((void *) (uintptr_t) offset);
+            } else if (loaded[module - 1]) {
+                local.push_back((void *) (bases[module - 1] + offset));
+            } else {
+                offsets[module - 1].push_back(offset);
+            }
+        }
+    }
+
+    // Resolve every unique address and offset once
+    symbol_table symbols = stacktrace::symbolize(local.data(), local.size(), level);
+    std::vector<std::unordered_map<uintptr_t, std::vector<frame>>> offline(modules.size());
+    for (size_t i = 0; i < modules.size() && level != resolve_level::raw; i++) {
+        std::sort(offsets[i].begin(), offsets[i].end());
+        offsets[i].erase(std::unique(offsets[i].begin(), offsets[i].end()), offsets[i].end());
+        if (offsets[i].empty()) continue;
+
+        // Only the module and the offsets are known if the file was replaced since it was recorded
+        const bool sameFile = readFileBuildId(modules[i].path).substr(0, recorderBuildIdSize) == modules[i].buildId;
+        std::vector<std::vector<cached_frame>> resolved = symbol_cache::instance().resolveOffsets(
+                modules[i].path, offsets[i], sameFile ? level : resolve_level::module_offset);
+        for (size_t j = 0; j < offsets[i].size(); j++) {
+            std::vector<frame> &frames = offline[i][offsets[i][j]];
+            for (const cached_frame &f : resolved[j]) {
+                frames.emplace_back(f.function, f.fullFile, f.line, (const void *) offsets[i][j], f.inlined);
+            }
+        }
+    }
+
+    std::vector<flight_record> res;
+    res.reserve(records.size());
+    for (const raw_record &record : records) {
+        std::vector<void *> addresses(record.frames.size());
+        std::vector<const std::vector<frame> *> known(record.frames.size(), nullptr);
+        for (size_t i = 0; i < record.frames.size(); i++) {
+            const uint64_t module = record.frames[i] >> recorderOffsetBits;
+            const uint64_t offset = record.frames[i] & (((uint64_t) 1 << recorderOffsetBits) - 1);
+            if (module == 0 || module > modules.size() || loaded[module - 1]) {
+                addresses[i] = (void *) (uintptr_t) (module == 0 || module > modules.size() ? offset :
+                                                     bases[module - 1] + offset);
+                known[i] = symbols.find(addresses[i]);
+            } else {
+                addresses[i] = (void *) (uintptr_t) offset;
+                auto it = offline[module - 1].find(offset);
+                if (it != offline[module - 1].end()) known[i] = &it->second;
+            }
+        }
+
+        stacktrace trace(std::move(addresses), level);
+        trace.resolveAll(known, false);
+        res.push_back({record.sequence, record.timestamp, (pid_t) record.thread, record.tag, std::move(trace)});
+    }
+
+    return res;
+}
+
+// symbolizer =========================
+
+// The magic bytes starting every symbolizer request and response
+static constexpr char symbolizerMagic[4] = {'S', 'T', 'S', 'Y'};
+
+// The version of the symbolizer protocol
+static constexpr uint64_t symbolizerVersion = 1;
+
+// The max size of a response of a symbolizer daemon
+static constexpr size_t maxSymbolizerResponse = 256 * 1024 * 1024;
+
+/**
+ * The module containing an address. Used with dl_iterate_phdr.
+ */
+struct module_identity {
+    // The address to find the module of
+    uintptr_t address;
+
+    // Set to the path of the module
+    std::string path;
+
+    // Set to the build id of the module
+    std::string buildId;
+
+    // Set to true, if the module was found
+    bool found;
+};
+
+/**
+ * Find the module containing an address. This is called via dl_iterate_phdr.
+ */
+static int findModuleIdentity(dl_phdr_info *info, size_t, void *data) {
+    auto *identity = (module_identity *) data;
+    bool contains = false;
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum && !contains; i++) {
+        const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+        const uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+        contains = phdr.p_type == PT_LOAD && identity->address >= start && identity->address < start + phdr.p_memsz;
+    }
+
+    if (!contains) return 0;
+
+    // The main program has no name, use the path of the executable
+    if (info->dlpi_name != nullptr && *info->dlpi_name != '\0') {
+        identity->path = info->dlpi_name;
+    } else {
+        char buffer[4096];
+        const ssize_t len = readlink("/proc/self/exe", buffer, sizeof(buffer));
+        if (len > 0) identity->path.assign(buffer, (size_t) len);
+    }
+
+    identity->buildId = readBuildId(info);
+    identity->found = !identity->path.empty();
+    return 1;
+}
+
+/**
+ * Get the absolute path and the build id of the module an address is in
+ *
+ * @param address the address
+ * @param path set to the path of the module
+ * @param buildId set to the build id of the module or an empty string if it has none
+ * @return true, if the module was found
+ */
+static bool getModuleIdentity(const void *address, std::string &path, std::string &buildId) {
+    module_identity identity{(uintptr_t) address, "", "", false};
+    dl_iterate_phdr(findModuleIdentity, &identity);
+    if (!identity.found) return false;
+
+    path = std::move(identity.path);
+    buildId = std::move(identity.buildId);
+    return true;
+}
+
+/**
+ * Set the max time a socket may wait when sending and receiving
+ *
+ * @param fd the socket
+ * @param timeout the timeout in milliseconds
+ * @return true, if the timeout was set
+ */
+static bool setSocketTimeout(int fd, size_t timeout) {
+    timeval tv{};
+    tv.tv_sec = (time_t) (timeout / 1000);
+    tv.tv_usec = (suseconds_t) (timeout % 1000 * 1000);
+    return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0 &&
+           setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+/**
+ * Send all bytes to a socket
+ *
+ * @param fd the socket
+ * @param data the data to send
+ * @param size the number of bytes to send
+ * @return true, if all bytes were sent
+ */
+static bool sendAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+
+        data += sent;
+        size -= (size_t) sent;
+    }
+
+    return true;
+}
+
+/**
+ * Receive a number of bytes from a socket
+ *
+ * @param fd the socket
+ * @param data the buffer to write the bytes to
+ * @param size the number of bytes to receive
+ * @return true, if all bytes were received
+ */
+static bool receiveAll(int fd, char *data, size_t size) {
+    while (size > 0) {
+        const ssize_t received = recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+
+        data += received;
+        size -= (size_t) received;
+    }
+
+    return true;
+}
+
+/**
+ * Send a message to a socket, prefixed with its size as 32 bit little endian integer
+ *
+ * @param fd the socket
+ * @param message the message
+ * @return true, if the message was sent
+ */
+static bool writeMessage(int fd, const std::string &message) {
+    if (message.size() > UINT32_MAX) return false;
+
+    char header[4];
+    for (size_t i = 0; i < sizeof(header); i++) {
+        header[i] = (char) (message.size() >> (i * 8));
+    }
+
+    return sendAll(fd, header, sizeof(header)) && sendAll(fd, message.data(), message.size());
+}
+
+/**
+ * Receive a message written by writeMessage from a socket
+ *
+ * @param fd the socket
+ * @param message set to the message
+ * @param maxSize the max size of the message
+ * @return true, if a message was received
+ */
+static bool readMessage(int fd, std::string &message, size_t maxSize) {
+    char header[4];
+    if (!receiveAll(fd, header, sizeof(header))) return false;
+
+    size_t size = 0;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        size |= (size_t) (uint8_t) header[i] << (i * 8);
+    }
+
+    if (size > maxSize) return false;
+
+    message.resize(size);
+    return receiveAll(fd, &message[0], size);
+}
+
+/**
+ * Write the header of a symbolizer request or response
+ *
+ * @param out the string to write to
+ */
+static void writeSymbolizerHeader(std::string &out) {
+    out.append(symbolizerMagic, sizeof(symbolizerMagic));
+    writeVarint(out, symbolizerVersion);
+}
+
+/**
+ * Read the header of a symbolizer request or response.
+ * Throws std::invalid_argument if the header is invalid.
+ *
+ * @param data the message
+ * @param pos set to the position after the header
+ */
+static void readSymbolizerHeader(const std::string &data, size_t &pos) {
+    if (data.size() < sizeof(symbolizerMagic) ||
+        !std::equal(symbolizerMagic, symbolizerMagic + sizeof(symbolizerMagic), data.begin())) {
+        throw std::invalid_argument("Not a symbolizer message");
+    }
+
+    pos = sizeof(symbolizerMagic);
+    if (readVarint(data, pos) != symbolizerVersion) {
+        throw std::invalid_argument("Unsupported symbolizer protocol version");
+    }
+}
+
+/**
+ * Resolve offsets in modules using a symbolizer daemon. All offsets are sent in a single request.
+ *
+ * @param socketPath the path of the socket of the daemon
+ * @param timeout the max time to wait for the daemon in milliseconds
+ * @param queries the offsets to resolve, by module
+ * @param level the level of detail to resolve the offsets with
+ * @param res set to the frames of every offset, by module. The frames
+ *            of offsets which could not be resolved are left empty
+ * @return true, if the daemon answered
+ */
+static bool symbolizeRemotely(const std::string &socketPath, size_t timeout,
+                              const std::vector<symbolizer_query> &queries, resolve_level level,
+                              std::vector<std::vector<std::vector<cached_frame>>> &res) {
+    sockaddr_un address{};
+    if (socketPath.size() >= sizeof(address.sun_path)) return false;
+
+    address.sun_family = AF_UNIX;
+    std::copy(socketPath.begin(), socketPath.end(), address.sun_path);
+
+    std::string request;
+    writeSymbolizerHeader(request);
+    writeVarint(request, (uint64_t) level);
+    writeVarint(request, queries.size());
+    for (const symbolizer_query &query : queries) {
+        writeBytes(request, query.path);
+        writeBytes(request, query.buildId);
+        writeVarint(request, query.offsets.size());
+        for (uintptr_t offset : query.offsets) {
+            writeVarint(request, offset);
+        }
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+
+    std::string response;
+    const bool answered = setSocketTimeout(fd, timeout) && connect(fd, (sockaddr *) &address, sizeof(address)) == 0 &&
+                          writeMessage(fd, request) && readMessage(fd, response, maxSymbolizerResponse);
+    close(fd);
+    if (!answered) return false;
+
+    try {
+        size_t pos = 0;
+        readSymbolizerHeader(response, pos);
+        if (readCount(response, pos) != queries.size()) return false;
+
+        res.assign(queries.size(), {});
+        for (size_t i = 0; i < queries.size(); i++) {
+            if (readCount(response, pos) != queries[i].offsets.size()) return false;
+
+            res[i].resize(queries[i].offsets.size());
+            for (std::vector<cached_frame> &frames : res[i]) {
+                frames.resize(readCount(response, pos));
+                for (cached_frame &f : frames) {
+                    f.function = readBytes(response, pos);
+                    f.fullFile = readBytes(response, pos);
+
+                    const uint64_t line = readVarint(response, pos);
+                    f.line = (size_t) (line >> 1);
+                    f.inlined = (line & 1) != 0;
+                }
+            }
+        }
+    } catch (const std::invalid_argument &) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Get the separate debug file of a module from /usr/lib/debug/.build-id
+ *
+ * @param path the path of the module
+ * @param buildId the build id of the module
+ * @return the path of the debug file or path if it does not exist
+ */
+static std::string findDebugFile(const std::string &path, const std::string &buildId) {
+    if (buildId.size() < 2) return path;
+
+    std::string hex;
+    for (char c : buildId) {
+        hex.push_back("0123456789abcdef"[(uint8_t) c >> 4]);
+        hex.push_back("0123456789abcdef"[(uint8_t) c & 0xF]);
+    }
+
+    const std::string file = "/usr/lib/debug/.build-id/" + hex.substr(0, 2) + '/' + hex.substr(2) + ".debug";
+    struct stat st{};
+    return stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode) ? file : path;
+}
+
+/**
+ * Resolve offsets in a module, which does not have to be loaded into this process, e.g. for
+ * a client of a symbolizer daemon. Uses addr2line on the module or its debug file. If that fails
+ * and the same module is loaded into this process, the offsets with a symbol are resolved like any address.
+ *
+ * @param path the path of the module
+ * @param buildId the build id of the module or an empty string
+ * @param offsets the offsets in the module
+ * @param level the level of detail to resolve the offsets with
+ * @param loaded the modules loaded into this process
+ * @return the frames of every offset, the frames of offsets which could not be resolved are left empty
+ */
+static std::vector<std::vector<cached_frame>> resolveModuleOffsets(const std::string &path,
+                                                                   const std::string &buildId,
+                                                                   const std::vector<uintptr_t> &offsets,
+                                                                   resolve_level level,
+                                                                   const std::vector<module_range> &loaded) {
+    symbol_cache &cache = symbol_cache::instance();
+    const std::string file = findDebugFile(path, buildId);
+    std::vector<std::vector<cached_frame>> res = cache.lookupOffsets(file, offsets, level);
+
+    // Functions resolved without line tables use the module as file name
+    if (file != path && level == resolve_level::function) {
+        for (std::vector<cached_frame> &frames : res) {
+            for (cached_frame &f : frames) f.fullFile = path;
+        }
+    }
+
+    // The paths of the same file may differ, e.g. /lib and /usr/lib if /lib is a symlink
+    struct stat moduleStat{}, loadedStat{};
+    const bool found = stat(path.c_str(), &moduleStat) == 0;
+    auto module = std::find_if(loaded.begin(), loaded.end(), [&](const module_range &m) {
+        return m.path == path || (found && stat(m.path.c_str(), &loadedStat) == 0 &&
+                                  loadedStat.st_dev == moduleStat.st_dev && loadedStat.st_ino == moduleStat.st_ino);
+    });
+
+    if (module == loaded.end() || level <= resolve_level::module_offset) return res;
+
+    std::vector<void *> addresses;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        Dl_info dli;
+        auto *address = (void *) (module->base + offsets[i]);
+        if (res[i].empty() && (uintptr_t) address < module->end && dladdr(address, &dli) && dli.dli_sname) {
+            addresses.push_back(address);
+            indices.push_back(i);
+        }
+    }
+
+    // A different version of the module may be loaded into this process
+    std::string loadedPath, loadedBuildId;
+    if (addresses.empty() || !getModuleIdentity(addresses.front(), loadedPath, loadedBuildId) ||
+        loadedBuildId != buildId) {
+        return res;
+    }
+
+    std::unordered_map<const void *, std::vector<cached_frame>> resolved = cache.resolve(addresses, level, false);
+    for (size_t i = 0; i < addresses.size(); i++) {
+        res[indices[i]] = std::move(resolved[addresses[i]]);
+    }
+
+    return res;
+}
+
+/**
+ * Answer a request of a symbolizer client.
+ * Throws std::invalid_argument if the request is invalid.
+ *
+ * @param request the request
+ * @return the response
+ */
+static std::string answerSymbolizerRequest(const std::string &request) {
+    size_t pos = 0;
+    readSymbolizerHeader(request, pos);
+
+    const uint64_t level = readVarint(request, pos);
+    if (level > (uint64_t) resolve_level::full) {
+        throw std::invalid_argument("Invalid resolve level in symbolizer request");
+    }
+
+    const size_t count = readCount(request, pos);
+    const std::vector<module_range> loaded = getModuleRanges();
+
+    std::string response;
+    writeSymbolizerHeader(response);
+    writeVarint(response, count);
+    for (size_t i = 0; i < count; i++) {
+        const std::string path = readBytes(request, pos);
+        const std::string buildId = readBytes(request, pos);
+
+        std::vector<uintptr_t> offsets(readCount(request, pos));
+        for (uintptr_t &offset : offsets) {
+            offset = (uintptr_t) readVarint(request, pos);
+        }
+
+        std::vector<std::vector<cached_frame>> frames;
+        if (!path.empty()) {
+            frames = resolveModuleOffsets(path, buildId, offsets, (resolve_level) level, loaded);
+        } else {
+            frames.resize(offsets.size());
+        }
+
+        writeVarint(response, frames.size());
+        for (const std::vector<cached_frame> &f : frames) {
+            writeVarint(response, f.size());
+            for (const cached_frame &frame : f) {
+                writeBytes(response, frame.function);
+                writeBytes(response, frame.fullFile);
+                writeVarint(response, (uint64_t) frame.line << 1 | (frame.inlined ? 1 : 0));
+            }
+        }
+    }
+
+    return response;
+}
+
+symbolizer_server::symbolizer_server(std::string socketPath, const symbolizer_options &options)
+        : path(std::move(socketPath)), options(options), listener(-1), running(false), numRequests(0), acceptor(),
+          mtx(), disconnected(), clients() {}
+
+void symbolizer_server::start() {
+    if (running) return;
+
+    sockaddr_un address{};
+    if (path.empty() || path.size() >= sizeof(address.sun_path) || options.maxClients == 0) {
+        throw std::invalid_argument("Invalid symbolizer_server options");
+    }
+
+    address.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), address.sun_path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        throw std::runtime_error(std::string("Could not create the symbolizer socket: ") + strerror(errno));
+    }
+
+    // Remove the socket of a previous daemon, but never any other file
+    struct stat st{};
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    // The permissions are set before listening, so no client connects before
+    if (bind(listener, (sockaddr *) &address, sizeof(address)) != 0 || chmod(path.c_str(), options.socketMode) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        const int error = errno;
+        close(listener);
+        listener = -1;
+        throw std::runtime_error("Could not listen on " + path + ": " + strerror(error));
+    }
+
+    running = true;
+    acceptor = std::thread(&symbolizer_server::acceptClients, this);
+}
+
+void symbolizer_server::stop() {
+    if (!running) return;
+
+    // Shutting down the socket wakes up accept
+    running = false;
+    shutdown(listener, SHUT_RDWR);
+    acceptor.join();
+
+    std::unique_lock<std::mutex> lock(mtx);
+    for (int client : clients) {
+        shutdown(client, SHUT_RDWR);
+    }
+
+    disconnected.wait(lock, [this] { return clients.empty(); });
+    lock.unlock();
+
+    close(listener);
+    listener = -1;
+    unlink(path.c_str());
+}
+
+bool symbolizer_server::isRunning() const noexcept {
+    return running;
+}
+
+uint64_t symbolizer_server::requests() const noexcept {
+    return numRequests;
+}
+
+const std::string &symbolizer_server::getPath() const noexcept {
+    return path;
+}
+
+symbolizer_server::~symbolizer_server() noexcept {
+    stop();
+}
+
+void symbolizer_server::acceptClients() {
+    while (running) {
+        const int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (!running) break;
+
+            // Out of file descriptors or an aborted connection, try again later
+            if (errno != EINTR) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!running || clients.size() >= options.maxClients || !setSocketTimeout(client, options.timeout)) {
+            close(client);
+            continue;
+        }
+
+        clients.push_back(client);
+        std::thread(&symbolizer_server::serve, this, client).detach();
+    }
+}
+
+void symbolizer_server::serve(int client) {
+    std::string request;
+    while (running && readMessage(client, request, options.maxRequestSize)) {
+        std::string response;
+        try {
+            response = answerSymbolizerRequest(request);
+        } catch (const std::exception &) {
+            break;
+        }
+
+        numRequests++;
+        if (!writeMessage(client, response)) break;
+    }
+
+    // Close the socket while holding the lock, so stop never shuts down a reused descriptor
+    std::unique_lock<std::mutex> lock(mtx);
+    clients.erase(std::find(clients.begin(), clients.end(), client));
+    close(client);
+    disconnected.notify_all();
+}
+
+// process_dump =======================
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+// The number of DWARF registers tracked when unwinding another process
+static constexpr size_t unwindRegisterCount = 33;
+
+#   ifdef __x86_64__
+// The DWARF numbers of the stack pointer, the frame pointer and the return address
+static constexpr size_t unwindSp = 7;
+static constexpr size_t unwindFp = 6;
+static constexpr size_t unwindRa = 16;
+#   else
+// The DWARF numbers of the stack pointer, the frame pointer and the link register
+static constexpr size_t unwindSp = 31;
+static constexpr size_t unwindFp = 29;
+static constexpr size_t unwindRa = 30;
+#   endif //x86_64
+
+// The max size of a CIE or FDE
+static constexpr size_t maxCfiRecord = 64 * 1024;
+
+// The max number of entries of the .eh_frame_hdr table of a module
+static constexpr uint64_t maxEhFrameEntries = 1 << 22;
+
+/**
+ * The registers of a thread of another process, indexed by their DWARF number
+ */
+struct unwind_registers {
+    // The values of the registers
+    uintptr_t values[unwindRegisterCount] = {};
+
+    // Whether the value of a register is known
+    bool known[unwindRegisterCount] = {};
+
+    // The program counter
+    uintptr_t pc = 0;
+};
+
+/**
+ * A thread of another process stopped by a process_dump
+ */
+struct stopped_thread {
+    // The id of the thread
+    pid_t thread = 0;
+
+    // Whether the thread is traced
+    bool attached = false;
+
+    // Whether the thread was stopped and its registers were read
+    bool stopped = false;
+
+    // The signal which stopped the thread instead of the interrupt, delivered when detaching
+    int signal = 0;
+
+    // The time the thread was stopped at
+    uint64_t stoppedAt = 0;
+
+    // The nanoseconds the thread was stopped
+    uint64_t pause = 0;
+
+    // The registers of the thread
+    unwind_registers registers;
+
+    // The address of the copied part of the stack
+    uintptr_t stackBase = 0;
+
+    // The copied part of the stack, starting at the stack pointer
+    std::string stack;
+};
+
+/**
+ * A line of /proc/PID/maps
+ */
+struct process_mapping {
+    // The first address of the mapping
+    uintptr_t start;
+
+    // The address after the mapping
+    uintptr_t end;
+
+    // The offset in the mapped file
+    uint64_t offset;
+
+    // The path of the mapped file or the name of the mapping, e.g. [stack]
+    std::string path;
+};
+
+/**
+ * An entry of the binary search table in .eh_frame_hdr.
+ * Both values are relative to the start of .eh_frame_hdr.
+ */
+struct eh_frame_entry {
+    // The first address of the function
+    int32_t location;
+
+    // The address of the FDE of the function
+    int32_t fde;
+};
+
+/**
+ * A call frame information rule to restore a register of the caller
+ */
+enum class cfi_rule_kind : uint8_t {
+    // The register is not changed by the callee
+    same_value,
+    // The register can't be restored
+    undefined,
+    // The register is saved at the canonical frame address plus the value
+    offset,
+    // The register is the canonical frame address plus the value
+    val_offset,
+    // The register is saved in the register with the number in value
+    reg,
+    // The register is restored using a DWARF expression, which is not supported
+    unsupported
+};
+
+/**
+ * A rule to restore a register of the caller
+ */
+struct cfi_rule {
+    cfi_rule_kind kind = cfi_rule_kind::same_value;
+    int64_t value = 0;
+};
+
+/**
+ * A row of the call frame information table, describing how to restore the registers of the caller
+ */
+struct cfi_row {
+    // The register the canonical frame address is relative to
+    uint64_t cfaRegister = unwindSp;
+
+    // The offset of the canonical frame address to the register
+    int64_t cfaOffset = 0;
+
+    // Whether the canonical frame address is computed by a DWARF expression, which is not supported
+    bool cfaExpression = false;
+
+    // The rules of all registers
+    cfi_rule rules[unwindRegisterCount];
+};
+
+/**
+ * A common information entry of .eh_frame
+ */
+struct cfi_cie {
+    // The factor of all advance_loc instructions
+    uint64_t codeAlign = 1;
+
+    // The factor of all offsets
+    int64_t dataAlign = 1;
+
+    // The register number of the return address
+    uint64_t raRegister = unwindRa;
+
+    // The encoding of the pointers in the FDEs
+    uint8_t fdeEncoding = 0;
+
+    // Whether the FDEs have augmentation data
+    bool augmented = false;
+
+    // The initial instructions
+    std::string instructions;
+};
+
+/**
+ * A module mapped into another process
+ */
+struct remote_module {
+    // The path of the module
+    std::string path;
+
+    // Whether the file was deleted or replaced since it was mapped
+    bool deleted = false;
+
+    // The build id of the module or an empty string
+    std::string buildId;
+
+    // The load bias of the module
+    uintptr_t bias = 0;
+
+    // The first address of the module
+    uintptr_t start = 0;
+
+    // The end of the last segment of the module
+    uintptr_t end = 0;
+
+    // The address of .eh_frame_hdr or 0 if the module has none
+    uintptr_t ehFrameHdr = 0;
+
+    // Whether the binary search table of .eh_frame_hdr was read
+    bool tableRead = false;
+
+    // The binary search table of .eh_frame_hdr, ordered by location
+    std::vector<eh_frame_entry> table;
+
+    // The CIEs read so far, by their address
+    std::unordered_map<uintptr_t, cfi_cie> cies;
+};
+
+/**
+ * Reads call frame information copied from another process.
+ * Throws std::invalid_argument if the data is invalid.
+ */
+class cfi_reader {
+public:
+    /**
+     * Create a reader
+     *
+     * @param data the data to read
+     * @param address the address of the data in the other process
+     */
+    cfi_reader(const std::string &data, uintptr_t address) : data(data), address(address), pos(0) {}
+
+    /**
+     * Read a fixed size value
+     *
+     * @tparam T the type of the value
+     * @return the value
+     */
+    template<class T>
+    T read() {
+        if (sizeof(T) > data.size() - pos) throw std::invalid_argument("Unexpected end of call frame information");
+
+        T value;
+        memcpy(&value, data.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    /**
+     * Read an unsigned LEB128 value
+     *
+     * @return the value
+     */
+    uint64_t uleb() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            const auto byte = read<uint8_t>();
+            value |= (uint64_t) (byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+
+        throw std::invalid_argument("Invalid LEB128 value in call frame information");
+    }
+
+    /**
+     * Read a signed LEB128 value
+     *
+     * @return the value
+     */
+    int64_t sleb() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            const auto byte = read<uint8_t>();
+            value |= (uint64_t) (byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                if (shift + 7 < 64 && (byte & 0x40) != 0) value |= ~(uint64_t) 0 << (shift + 7);
+                return (int64_t) value;
+            }
+        }
+
+        throw std::invalid_argument("Invalid LEB128 value in call frame information");
+    }
+
+    /**
+     * Read a pointer encoded using a DW_EH_PE encoding
+     *
+     * @param encoding the encoding
+     * @param dataBase the address datarel pointers are relative to
+     * @return the pointer
+     */
+    uintptr_t pointer(uint8_t encoding, uintptr_t dataBase) {
+        if (encoding == 0xFF) return 0;
+
+        const uintptr_t here = address + pos;
+        uint64_t value;
+        switch (encoding & 0x0F) {
+            case 0x00: value = read<uintptr_t>(); break;
+            case 0x01: value = uleb(); break;
+            case 0x02: value = read<uint16_t>(); break;
+            case 0x03: value = read<uint32_t>(); break;
+            case 0x04: value = read<uint64_t>(); break;
+            case 0x09: value = (uint64_t) sleb(); break;
+            case 0x0A: value = (uint64_t) (int64_t) read<int16_t>(); break;
+            case 0x0B: value = (uint64_t) (int64_t) read<int32_t>(); break;
+            case 0x0C: value = (uint64_t) read<int64_t>(); break;
+            default: throw std::invalid_argument("Unsupported pointer encoding in call frame information");
+        }
+
+        // The indirect flag is ignored, indirect pointers are only used for personality routines
+        switch (encoding & 0x70) {
+            case 0x00: return (uintptr_t) value;
+            case 0x10: return (uintptr_t) (here + value);
+            case 0x30: return (uintptr_t) (dataBase + value);
+            default: throw std::invalid_argument("Unsupported pointer encoding in call frame information");
+        }
+    }
+
+    /**
+     * Read a null terminated string
+     *
+     * @return the string
+     */
+    std::string string() {
+        const size_t end = data.find('\0', pos);
+        if (end == std::string::npos) throw std::invalid_argument("Unexpected end of call frame information");
+
+        std::string res = data.substr(pos, end - pos);
+        pos = end + 1;
+        return res;
+    }
+
+    /**
+     * Skip a number of bytes
+     *
+     * @param size the number of bytes to skip
+     */
+    void skip(uint64_t size) {
+        if (size > data.size() - pos) throw std::invalid_argument("Unexpected end of call frame information");
+        pos += (size_t) size;
+    }
+
+    /**
+     * Check if all data was read
+     *
+     * @return true, if the end of the data was reached
+     */
+    STACKTRACE_NODISCARD bool atEnd() const noexcept {
+        return pos >= data.size();
+    }
+
+    /**
+     * Get the remaining data
+     *
+     * @return the data after the current position
+     */
+    STACKTRACE_NODISCARD std::string rest() const {
+        return data.substr(pos);
+    }
+
+private:
+    const std::string &data;
+    uintptr_t address;
+    size_t pos;
+};
+
+/**
+ * Read memory of another process
+ *
+ * @param pid the id of the process
+ * @param address the address to read at
+ * @param buffer the buffer to read into
+ * @param size the number of bytes to read
+ * @return true, if all bytes were read
+ */
+static bool readProcessMemory(pid_t pid, uintptr_t address, void *buffer, size_t size) {
+    iovec local{buffer, size};
+    iovec remote{(void *) address, size};
+    return process_vm_readv(pid, &local, 1, &remote, 1, 0) == (ssize_t) size;
 }
 
-STACKTRACE_NODISCARD STACKTRACE_UNUSED const std::vector<frame *> &stacktrace::getFrames() const noexcept {
-    return frames;
+/**
+ * Read the general purpose registers of a stopped thread
+ *
+ * @param thread the id of the thread
+ * @param registers set to the registers
+ * @return true, if the registers were read
+ */
+static bool readRegisters(pid_t thread, unwind_registers &registers) {
+    user_regs_struct regs{};
+    iovec io{&regs, sizeof(regs)};
+    if (ptrace(PTRACE_GETREGSET, thread, (void *) NT_PRSTATUS, &io) != 0) return false;
+
+#   ifdef __x86_64__
+    const unsigned long long values[] = {regs.rax, regs.rdx, regs.rcx, regs.rbx, regs.rsi, regs.rdi, regs.rbp,
+                                         regs.rsp, regs.r8, regs.r9, regs.r10, regs.r11, regs.r12, regs.r13,
+                                         regs.r14, regs.r15};
+    registers.pc = (uintptr_t) regs.rip;
+#   else
+    unsigned long long values[32];
+    std::copy(regs.regs, regs.regs + 31, values);
+    values[31] = regs.sp;
+    registers.pc = (uintptr_t) regs.pc;
+#   endif //x86_64
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        registers.values[i] = (uintptr_t) values[i];
+        registers.known[i] = true;
+    }
+
+    return true;
 }
 
-STACKTRACE_NODISCARD const frame *stacktrace::operator[](size_t index) const {
-    return frames.at(index);
+/**
+ * Read the mappings of a process from /proc/PID/maps
+ *
+ * @param pid the id of the process
+ * @return the mappings, ordered by their address. Empty, if the file could not be read
+ */
+static std::vector<process_mapping> readMappings(pid_t pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/maps");
+    std::vector<process_mapping> res;
+    std::string line;
+    while (std::getline(in, line)) {
+        unsigned long long start = 0, end = 0, offset = 0;
+        int pathStart = 0;
+        if (sscanf(line.c_str(), "%llx-%llx %*s %llx %*s %*s %n", &start, &end, &offset, &pathStart) < 3) continue;
+
+        res.push_back({(uintptr_t) start, (uintptr_t) end, (uint64_t) offset,
+                       pathStart > 0 ? line.substr((size_t) pathStart) : std::string()});
+    }
+
+    return res;
 }
 
-std::vector<frame *>::iterator stacktrace::begin() noexcept {
-    return frames.begin();
+/**
+ * Find the modules mapped into another process by reading their ELF headers
+ *
+ * @param pid the id of the process
+ * @param mappings the mappings of the process
+ * @return the modules
+ */
+static std::vector<remote_module> findRemoteModules(pid_t pid, const std::vector<process_mapping> &mappings) {
+    static const std::string deletedSuffix = " (deleted)";
+    const uintptr_t pageMask = ~((uintptr_t) sysconf(_SC_PAGESIZE) - 1);
+
+    std::vector<remote_module> res;
+    for (const process_mapping &mapping : mappings) {
+        // Every module has a mapping of its ELF header, the vdso is the only module without a file
+        if (mapping.offset != 0 || mapping.path.empty() || (mapping.path[0] != '/' && mapping.path != "[vdso]")) {
+            continue;
+        }
+
+        ElfW(Ehdr) header{};
+        if (!readProcessMemory(pid, mapping.start, &header, sizeof(header)) ||
+            memcmp(header.e_ident, ELFMAG, SELFMAG) != 0 || header.e_phentsize != sizeof(ElfW(Phdr))) {
+            continue;
+        }
+
+        std::vector<ElfW(Phdr)> phdrs(header.e_phnum);
+        if (!readProcessMemory(pid, mapping.start + header.e_phoff, phdrs.data(), phdrs.size() * sizeof(ElfW(Phdr)))) {
+            continue;
+        }
+
+        uintptr_t first = UINTPTR_MAX;
+        for (const ElfW(Phdr) &phdr : phdrs) {
+            if (phdr.p_type == PT_LOAD) first = std::min(first, (uintptr_t) phdr.p_vaddr & pageMask);
+        }
+
+        if (first == UINTPTR_MAX) continue;
+
+        remote_module m;
+        m.path = mapping.path;
+        if (m.path.size() > deletedSuffix.size() &&
+            m.path.compare(m.path.size() - deletedSuffix.size(), deletedSuffix.size(), deletedSuffix) == 0) {
+            m.path.resize(m.path.size() - deletedSuffix.size());
+            m.deleted = true;
+        }
+
+        m.start = mapping.start;
+        m.bias = mapping.start - first;
+        for (const ElfW(Phdr) &phdr : phdrs) {
+            if (phdr.p_type == PT_LOAD) {
+                m.end = std::max(m.end, (uintptr_t) (m.bias + phdr.p_vaddr + phdr.p_memsz));
+            } else if (phdr.p_type == PT_GNU_EH_FRAME) {
+                m.ehFrameHdr = m.bias + phdr.p_vaddr;
+            } else if (phdr.p_type == PT_NOTE && m.buildId.empty() && phdr.p_memsz <= 4096) {
+                std::string notes(phdr.p_memsz, '\0');
+                if (readProcessMemory(pid, m.bias + phdr.p_vaddr, &notes[0], notes.size())) {
+                    m.buildId = findBuildId(notes.data(), notes.size(), phdr.p_align);
+                }
+            }
+        }
+
+        res.push_back(std::move(m));
+    }
+
+    return res;
 }
 
-STACKTRACE_NODISCARD std::vector<frame *>::const_iterator stacktrace::begin() const noexcept {
-    return frames.begin();
+/**
+ * Find the module containing an address
+ *
+ * @param modules the modules
+ * @param address the address
+ * @return the index of the module or SIZE_MAX if the address is in no module
+ */
+static size_t findRemoteModule(const std::vector<remote_module> &modules, uintptr_t address) {
+    for (size_t i = 0; i < modules.size(); i++) {
+        if (address >= modules[i].start && address < modules[i].end) return i;
+    }
+
+    return SIZE_MAX;
 }
 
-std::vector<frame *>::iterator stacktrace::end() noexcept {
-    return frames.end();
+/**
+ * Read the binary search table of .eh_frame_hdr of a module, if it was not read yet
+ *
+ * @param pid the id of the process
+ * @param m the module
+ */
+static void readEhFrameTable(pid_t pid, remote_module &m) {
+    if (m.tableRead) return;
+
+    m.tableRead = true;
+    std::string header(4 + 2 * sizeof(uint64_t), '\0');
+    if (m.ehFrameHdr == 0 || !readProcessMemory(pid, m.ehFrameHdr, &header[0], header.size())) return;
+
+    try {
+        cfi_reader reader(header, m.ehFrameHdr);
+        const auto version = reader.read<uint8_t>();
+        const auto framePointerEncoding = reader.read<uint8_t>();
+        const auto countEncoding = reader.read<uint8_t>();
+        const auto tableEncoding = reader.read<uint8_t>();
+
+        // Only tables using DW_EH_PE_datarel | DW_EH_PE_sdata4 can be searched, which is what linkers write
+        if (version != 1 || tableEncoding != 0x3B) return;
+
+        reader.pointer(framePointerEncoding, m.ehFrameHdr);
+        const uint64_t count = reader.pointer(countEncoding, m.ehFrameHdr);
+        if (count == 0 || count > maxEhFrameEntries) return;
+
+        const size_t headerSize = header.size() - reader.rest().size();
+        m.table.resize((size_t) count);
+        const size_t tableSize = m.table.size() * sizeof(eh_frame_entry);
+        if (!readProcessMemory(pid, m.ehFrameHdr + headerSize, m.table.data(), tableSize)) m.table.clear();
+    } catch (const std::invalid_argument &) {
+        m.table.clear();
+    }
 }
 
-STACKTRACE_NODISCARD std::vector<frame *>::const_iterator stacktrace::end() const noexcept {
-    return frames.end();
+/**
+ * Read a CIE or FDE from the memory of another process
+ *
+ * @param pid the id of the process
+ * @param address the address of the record
+ * @param data set to the record without its length
+ * @param start set to the address of data
+ * @return true, if the record was read
+ */
+static bool readCfiRecord(pid_t pid, uintptr_t address, std::string &data, uintptr_t &start) {
+    uint32_t length = 0;
+    if (!readProcessMemory(pid, address, &length, sizeof(length))) return false;
+
+    // Records using the 64 bit DWARF format are not written by any common toolchain
+    if (length == 0 || length == 0xFFFFFFFF || length > maxCfiRecord) return false;
+
+    data.resize(length);
+    start = address + sizeof(length);
+    return readProcessMemory(pid, start, &data[0], data.size());
 }
 
-STACKTRACE_NODISCARD size_t stacktrace::size() const noexcept {
-    return frames.size();
+/**
+ * Read a CIE from the memory of another process.
+ * Throws std::invalid_argument if the CIE is invalid.
+ *
+ * @param pid the id of the process
+ * @param address the address of the CIE
+ * @return the CIE
+ */
+static cfi_cie readCie(pid_t pid, uintptr_t address) {
+    std::string data;
+    uintptr_t start = 0;
+    if (!readCfiRecord(pid, address, data, start)) throw std::invalid_argument("Could not read the CIE");
+
+    cfi_reader reader(data, start);
+    reader.skip(sizeof(uint32_t));
+    const auto version = reader.read<uint8_t>();
+    const std::string augmentation = reader.string();
+    if ((version != 1 && version != 3) || augmentation.find("eh") != std::string::npos) {
+        throw std::invalid_argument("Unsupported CIE");
+    }
+
+    cfi_cie cie;
+    cie.codeAlign = reader.uleb();
+    cie.dataAlign = reader.sleb();
+    cie.raRegister = version == 1 ? reader.read<uint8_t>() : reader.uleb();
+    cie.augmented = !augmentation.empty() && augmentation[0] == 'z';
+    if (cie.augmented) {
+        const uint64_t size = reader.uleb();
+        const std::string augmentationData = reader.rest().substr(0, (size_t) size);
+        reader.skip(size);
+
+        cfi_reader augmentationReader(augmentationData, 0);
+        for (size_t i = 1; i < augmentation.size(); i++) {
+            if (augmentation[i] == 'R') {
+                cie.fdeEncoding = augmentationReader.read<uint8_t>();
+            } else if (augmentation[i] == 'P') {
+                augmentationReader.pointer(augmentationReader.read<uint8_t>() & 0x7F, 0);
+            } else if (augmentation[i] == 'L') {
+                augmentationReader.read<uint8_t>();
+            } else if (augmentation[i] != 'S' && augmentation[i] != 'B') {
+                break;
+            }
+        }
+    }
+
+    cie.instructions = reader.rest();
+    return cie;
 }
 
-STACKTRACE_NODISCARD bool stacktrace::empty() const noexcept {
-    return frames.empty();
+/**
+ * Execute call frame instructions until the row of an address is reached.
+ * Throws std::invalid_argument if an instruction is invalid or unknown.
+ *
+ * @param instructions the instructions
+ * @param cie the CIE the instructions belong to
+ * @param location the address the instructions start at
+ * @param address the address to get the row of
+ * @param initial the row after the initial instructions of the CIE
+ * @param row the row to update
+ */
+static void executeCfi(const std::string &instructions, const cfi_cie &cie, uintptr_t location, uintptr_t address,
+                       const cfi_row &initial, cfi_row &row) {
+    auto setRule = [&row](uint64_t reg, cfi_rule_kind kind, int64_t value) {
+        if (reg < unwindRegisterCount) row.rules[reg] = {kind, value};
+    };
+
+    std::vector<cfi_row> remembered;
+    cfi_reader reader(instructions, 0);
+    while (!reader.atEnd()) {
+        const auto op = reader.read<uint8_t>();
+        const uint8_t low = op & 0x3F;
+        uint64_t advance = 0;
+        switch (op >> 6) {
+            case 1: // DW_CFA_advance_loc
+                advance = low;
+                break;
+            case 2: // DW_CFA_offset
+                setRule(low, cfi_rule_kind::offset, (int64_t) reader.uleb() * cie.dataAlign);
+                continue;
+            case 3: // DW_CFA_restore
+                if (low < unwindRegisterCount) row.rules[low] = initial.rules[low];
+                continue;
+            default:
+                switch (op) {
+                    case 0x00: // DW_CFA_nop
+                        continue;
+                    case 0x01: // DW_CFA_set_loc
+                        location = reader.pointer(cie.fdeEncoding, 0);
+                        if (location > address) return;
+                        continue;
+                    case 0x02: // DW_CFA_advance_loc1
+                        advance = reader.read<uint8_t>();
+                        break;
+                    case 0x03: // DW_CFA_advance_loc2
+                        advance = reader.read<uint16_t>();
+                        break;
+                    case 0x04: // DW_CFA_advance_loc4
+                        advance = reader.read<uint32_t>();
+                        break;
+                    case 0x05: { // DW_CFA_offset_extended
+                        const uint64_t reg = reader.uleb();
+                        setRule(reg, cfi_rule_kind::offset, (int64_t) reader.uleb() * cie.dataAlign);
+                        continue;
+                    }
+                    case 0x06: { // DW_CFA_restore_extended
+                        const uint64_t reg = reader.uleb();
+                        if (reg < unwindRegisterCount) row.rules[reg] = initial.rules[reg];
+                        continue;
+                    }
+                    case 0x07: // DW_CFA_undefined
+                        setRule(reader.uleb(), cfi_rule_kind::undefined, 0);
+                        continue;
+                    case 0x08: // DW_CFA_same_value
+                        setRule(reader.uleb(), cfi_rule_kind::same_value, 0);
+                        continue;
+                    case 0x09: { // DW_CFA_register
+                        const uint64_t reg = reader.uleb();
+                        setRule(reg, cfi_rule_kind::reg, (int64_t) reader.uleb());
+                        continue;
+                    }
+                    case 0x0A: // DW_CFA_remember_state
+                        remembered.push_back(row);
+                        continue;
+                    case 0x0B: // DW_CFA_restore_state
+                        if (remembered.empty()) throw std::invalid_argument("Invalid DW_CFA_restore_state");
+                        row = remembered.back();
+                        remembered.pop_back();
+                        continue;
+                    case 0x0C: // DW_CFA_def_cfa
+                        row.cfaRegister = reader.uleb();
+                        row.cfaOffset = (int64_t) reader.uleb();
+                        row.cfaExpression = false;
+                        continue;
+                    case 0x0D: // DW_CFA_def_cfa_register
+                        row.cfaRegister = reader.uleb();
+                        row.cfaExpression = false;
+                        continue;
+                    case 0x0E: // DW_CFA_def_cfa_offset
+                        row.cfaOffset = (int64_t) reader.uleb();
+                        continue;
+                    case 0x0F: // DW_CFA_def_cfa_expression
+                        reader.skip(reader.uleb());
+                        row.cfaExpression = true;
+                        continue;
+                    case 0x10: // DW_CFA_expression
+                    case 0x16: { // DW_CFA_val_expression
+                        const uint64_t reg = reader.uleb();
+                        reader.skip(reader.uleb());
+                        setRule(reg, cfi_rule_kind::unsupported, 0);
+                        continue;
+                    }
+                    case 0x11: { // DW_CFA_offset_extended_sf
+                        const uint64_t reg = reader.uleb();
+                        setRule(reg, cfi_rule_kind::offset, reader.sleb() * cie.dataAlign);
+                        continue;
+                    }
+                    case 0x12: // DW_CFA_def_cfa_sf
+                        row.cfaRegister = reader.uleb();
+                        row.cfaOffset = reader.sleb() * cie.dataAlign;
+                        row.cfaExpression = false;
+                        continue;
+                    case 0x13: // DW_CFA_def_cfa_offset_sf
+                        row.cfaOffset = reader.sleb() * cie.dataAlign;
+                        continue;
+                    case 0x14: { // DW_CFA_val_offset
+                        const uint64_t reg = reader.uleb();
+                        setRule(reg, cfi_rule_kind::val_offset, (int64_t) reader.uleb() * cie.dataAlign);
+                        continue;
+                    }
+                    case 0x15: { // DW_CFA_val_offset_sf
+                        const uint64_t reg = reader.uleb();
+                        setRule(reg, cfi_rule_kind::val_offset, reader.sleb() * cie.dataAlign);
+                        continue;
+                    }
+                    case 0x2D: // DW_CFA_GNU_window_save, DW_CFA_AARCH64_negate_ra_state on aarch64
+                        continue;
+                    case 0x2E: // DW_CFA_GNU_args_size
+                        reader.uleb();
+                        continue;
+                    case 0x2F: { // DW_CFA_GNU_negative_offset_extended
+                        const uint64_t reg = reader.uleb();
+                        setRule(reg, cfi_rule_kind::offset, -(int64_t) reader.uleb() * cie.dataAlign);
+                        continue;
+                    }
+                    default:
+                        throw std::invalid_argument("Unknown call frame instruction");
+                }
+        }
+
+        location += advance * cie.codeAlign;
+        if (location > address) return;
+    }
 }
 
-STACKTRACE_NODISCARD stacktrace::operator bool() const noexcept {
-    return !frames.empty();
+/**
+ * Get the call frame information row of an address from the .eh_frame tables of its module
+ *
+ * @param pid the id of the process
+ * @param m the module the address is in
+ * @param address the address
+ * @param row set to the row of the address
+ * @param raRegister set to the register number of the return address
+ * @return true, if the module has call frame information for the address
+ */
+static bool findCfiRow(pid_t pid, remote_module &m, uintptr_t address, cfi_row &row, uint64_t &raRegister) {
+    readEhFrameTable(pid, m);
+    const auto relative = (int64_t) (address - m.ehFrameHdr);
+    auto it = std::upper_bound(m.table.begin(), m.table.end(), relative,
+                               [](int64_t value, const eh_frame_entry &entry) {
+                                   return value < entry.location;
+                               });
+    if (it == m.table.begin()) return false;
+
+    std::string data;
+    uintptr_t start = 0;
+    if (!readCfiRecord(pid, m.ehFrameHdr + (std::prev(it)->fde), data, start)) return false;
+
+    try {
+        cfi_reader reader(data, start);
+        const uintptr_t cieAddress = start - reader.read<uint32_t>();
+        auto cie = m.cies.find(cieAddress);
+        if (cie == m.cies.end()) {
+            cie = m.cies.emplace(cieAddress, readCie(pid, cieAddress)).first;
+        }
+
+        const uintptr_t begin = reader.pointer(cie->second.fdeEncoding, m.ehFrameHdr);
+        const uintptr_t range = reader.pointer(cie->second.fdeEncoding & 0x0F, 0);
+        if (address < begin || address - begin >= range) return false;
+
+        if (cie->second.augmented) reader.skip(reader.uleb());
+
+        cfi_row initial;
+        executeCfi(cie->second.instructions, cie->second, 0, UINTPTR_MAX, initial, initial);
+        row = initial;
+        executeCfi(reader.rest(), cie->second, begin, address, initial, row);
+        raRegister = cie->second.raRegister;
+    } catch (const std::invalid_argument &) {
+        return false;
+    }
+
+    return true;
 }
 
-STACKTRACE_NODISCARD std::string stacktrace::toString(bool fullPaths) const {
-    std::stringstream ss;
-    for (size_t i = 0; i < frames.size(); i++) {
-        ss << " " << i << "# " << frames[i]->toString(fullPaths) << std::endl;
+/**
+ * Read a pointer from the copied stack of a thread
+ *
+ * @param t the thread
+ * @param address the address to read at
+ * @param value set to the value
+ * @return true, if the address is in the copied stack
+ */
+static bool readStack(const stopped_thread &t, uintptr_t address, uintptr_t &value) {
+    if (address < t.stackBase || address - t.stackBase > t.stack.size() ||
+        t.stack.size() - (address - t.stackBase) < sizeof(value)) {
+        return false;
     }
 
-    return ss.str();
+    memcpy(&value, t.stack.data() + (address - t.stackBase), sizeof(value));
+    return true;
+}
+
+/**
+ * Restore the registers of the caller using call frame information
+ *
+ * @param t the thread
+ * @param row the call frame information row of the current address
+ * @param raRegister the register number of the return address
+ * @param registers the registers to update
+ * @return true, if the registers were restored
+ */
+static bool unwindCfi(const stopped_thread &t, const cfi_row &row, uint64_t raRegister,
+                      unwind_registers &registers) {
+    if (row.cfaExpression || row.cfaRegister >= unwindRegisterCount || !registers.known[row.cfaRegister] ||
+        raRegister >= unwindRegisterCount) {
+        return false;
+    }
+
+    const uintptr_t cfa = registers.values[row.cfaRegister] + row.cfaOffset;
+    unwind_registers caller = registers;
+    for (size_t i = 0; i < unwindRegisterCount; i++) {
+        const cfi_rule &rule = row.rules[i];
+        switch (rule.kind) {
+            case cfi_rule_kind::same_value:
+                break;
+            case cfi_rule_kind::offset:
+                caller.known[i] = readStack(t, cfa + rule.value, caller.values[i]);
+                break;
+            case cfi_rule_kind::val_offset:
+                caller.values[i] = cfa + rule.value;
+                caller.known[i] = true;
+                break;
+            case cfi_rule_kind::reg:
+                caller.known[i] = rule.value >= 0 && (uint64_t) rule.value < unwindRegisterCount &&
+                                  registers.known[rule.value];
+                if (caller.known[i]) caller.values[i] = registers.values[rule.value];
+                break;
+            default:
+                caller.known[i] = false;
+                break;
+        }
+    }
+
+    // The return address is undefined in the outermost frame
+    if (row.rules[raRegister].kind == cfi_rule_kind::undefined) {
+        caller.pc = 0;
+    } else if (caller.known[raRegister]) {
+        caller.pc = caller.values[raRegister];
+    } else {
+        return false;
+    }
+
+    caller.values[unwindSp] = cfa;
+    caller.known[unwindSp] = true;
+    registers = caller;
+    return true;
+}
+
+/**
+ * Restore the registers of the caller using the frame pointer
+ *
+ * @param t the thread
+ * @param registers the registers to update
+ * @return true, if the registers were restored
+ */
+static bool unwindFramePointer(const stopped_thread &t, unwind_registers &registers) {
+    const uintptr_t fp = registers.values[unwindFp];
+    uintptr_t callerFp = 0, ra = 0;
+    if (!registers.known[unwindFp] || !readStack(t, fp, callerFp) || !readStack(t, fp + sizeof(uintptr_t), ra)) {
+        return false;
+    }
+
+    registers.values[unwindSp] = fp + 2 * sizeof(uintptr_t);
+    registers.values[unwindFp] = callerFp;
+    registers.pc = ra;
+    return true;
 }
 
-stacktrace::~stacktrace() noexcept {
-    // Delete all frames
-    for (const auto &p : frames) {
-        delete p;
+/**
+ * Unwind the copied stack of a stopped thread
+ *
+ * @param pid the id of the process
+ * @param t the thread
+ * @param modules the modules of the process
+ * @param maxFrames the max number of frames
+ * @return the addresses of the stack, the innermost frame first
+ */
+static std::vector<void *> unwindThread(pid_t pid, const stopped_thread &t, std::vector<remote_module> &modules,
+                                        size_t maxFrames) {
+    unwind_registers registers = t.registers;
+    std::vector<void *> res;
+    while (res.size() < maxFrames && registers.pc != 0) {
+        res.push_back((void *) registers.pc);
+
+        // Return addresses point after the call, which may be the start of the next function
+        const uintptr_t address = res.size() == 1 ? registers.pc : registers.pc - 1;
+        const uintptr_t sp = registers.values[unwindSp];
+        const size_t module = findRemoteModule(modules, address);
+
+        cfi_row row;
+        uint64_t raRegister = unwindRa;
+        const bool unwound = module != SIZE_MAX && findCfiRow(pid, modules[module], address, row, raRegister) ?
+                             unwindCfi(t, row, raRegister, registers) : unwindFramePointer(t, registers);
+
+        // The stack grows down, so every caller must have a higher stack pointer
+        if (!unwound || registers.values[unwindSp] <= sp) break;
+
+#   ifdef __aarch64__
+        // Remove the pointer authentication code from the return address
+        registers.pc &= 0x0000FFFFFFFFFFFF;
+#   endif //aarch64
     }
+
+    return res;
 }
 
-void stacktrace::copyFrames(const std::vector<frame *> &toCopyFrom) {
-    if (!frames.empty()) {
-        for (frame *ptr : frames) delete ptr;
-        frames = std::vector<frame *>();
+#endif //x86_64 || aarch64
+
+process_dump::process_dump(pid_t pid, STACKTRACE_UNUSED const process_dump_options &options)
+        : pid(pid), threads(), pause(0), duration(0) {
+#if defined(__x86_64__) || defined(__aarch64__)
+    if (pid <= 0 || options.maxFrames == 0) {
+        throw std::invalid_argument("Invalid process_dump options");
     }
 
-    frames.reserve(toCopyFrom.size());
+    const uint64_t start = steadyNanos();
 
-    // Copy the frames depending on the os
-    for (frame *f : toCopyFrom) {
-#ifdef STACKTRACE_WINDOWS
-#   ifdef NDEBUG
-        frames.push_back(new win_release_frame(*(win_release_frame *) f));
-#   else
-        if (((win_frame *) f)->getType() == win_frame_type::debug) {
-            frames.push_back(new win_debug_frame(*(win_debug_frame *) f));
-        } else {
-            frames.push_back(new win_release_frame(*(win_release_frame *) f));
+    // Stop every thread, repeat until no threads were started while attaching
+    std::vector<stopped_thread> stopped;
+    int error = ESRCH;
+    for (int pass = 0; pass < 10; pass++) {
+        bool added = false;
+        for (pid_t thread : listThreads(pid)) {
+            if (std::any_of(stopped.begin(), stopped.end(), [thread](const stopped_thread &t) {
+                return t.thread == thread;
+            })) {
+                continue;
+            }
+
+            stopped_thread t;
+            t.thread = thread;
+            t.attached = ptrace(PTRACE_SEIZE, thread, nullptr, nullptr) == 0;
+            if (t.attached) {
+                ptrace(PTRACE_INTERRUPT, thread, nullptr, nullptr);
+            } else {
+                error = errno;
+            }
+
+            stopped.push_back(std::move(t));
+            added = true;
+        }
+
+        if (!added) break;
+    }
+
+    std::sort(stopped.begin(), stopped.end(), [](const stopped_thread &a, const stopped_thread &b) {
+        return a.thread < b.thread;
+    });
+
+    const uint64_t stopStart = steadyNanos();
+    for (stopped_thread &t : stopped) {
+        if (!t.attached) continue;
+
+        int status = 0;
+        pid_t res;
+        do {
+            res = waitpid(t.thread, &status, __WALL);
+        } while (res < 0 && errno == EINTR);
+
+        // Exited threads are detached automatically
+        if (res != t.thread || !WIFSTOPPED(status)) {
+            t.attached = false;
+            continue;
+        }
+
+        // Deliver a signal which arrived before the interrupt when detaching
+        if ((status >> 16) != PTRACE_EVENT_STOP) t.signal = WSTOPSIG(status);
+        t.stoppedAt = steadyNanos();
+        t.stopped = true;
+    }
+
+    // Copy the registers and the top of the stack of every thread, everything else is read after detaching
+    const std::vector<process_mapping> mappings = readMappings(pid);
+    for (stopped_thread &t : stopped) {
+        if (!t.stopped) continue;
+
+        t.stopped = readRegisters(t.thread, t.registers);
+        const uintptr_t sp = t.registers.values[unwindSp];
+        for (const process_mapping &mapping : mappings) {
+            if (!t.stopped || sp < mapping.start || sp >= mapping.end) continue;
+
+            t.stackBase = sp;
+            t.stack.resize((size_t) std::min<uint64_t>(mapping.end - sp, options.stackSize));
+            if (!readProcessMemory(pid, sp, &t.stack[0], t.stack.size())) t.stack.clear();
+        }
+    }
+
+    for (stopped_thread &t : stopped) {
+        if (!t.attached) continue;
+
+        ptrace(PTRACE_DETACH, t.thread, nullptr, (void *) (intptr_t) t.signal);
+        if (t.stoppedAt != 0) t.pause = steadyNanos() - t.stoppedAt;
+    }
+
+    pause = steadyNanos() - stopStart;
+    if (std::none_of(stopped.begin(), stopped.end(), [](const stopped_thread &t) { return t.stopped; })) {
+        throw std::runtime_error("Could not stop process " + std::to_string(pid) + ": " + strerror(error));
+    }
+
+    // Unwind the stacks while the process is running again
+    std::vector<remote_module> modules = findRemoteModules(pid, mappings);
+    std::vector<std::vector<void *>> stacks(stopped.size());
+    std::vector<std::vector<uintptr_t>> offsets(modules.size());
+    for (size_t i = 0; i < stopped.size(); i++) {
+        if (!stopped[i].stopped) continue;
+
+        stacks[i] = unwindThread(pid, stopped[i], modules, options.maxFrames);
+        for (size_t j = 0; j < stacks[i].size(); j++) {
+            const auto address = (uintptr_t) stacks[i][j];
+            const size_t module = findRemoteModule(modules, j == 0 ? address : address - 1);
+            if (module != SIZE_MAX) offsets[module].push_back(address - modules[module].bias);
+        }
+    }
+
+    // Resolve every unique offset of a module at once
+    const std::vector<module_range> loaded = getModuleRanges();
+    std::vector<std::unordered_map<uintptr_t, std::vector<frame>>> resolved(modules.size());
+    for (size_t i = 0; i < modules.size() && options.level != resolve_level::raw; i++) {
+        const remote_module &m = modules[i];
+        std::sort(offsets[i].begin(), offsets[i].end());
+        offsets[i].erase(std::unique(offsets[i].begin(), offsets[i].end()), offsets[i].end());
+        if (offsets[i].empty()) continue;
+
+        // The file of a deleted module may have been replaced by another version
+        std::vector<std::vector<cached_frame>> frames =
+                m.deleted ? std::vector<std::vector<cached_frame>>(offsets[i].size())
+                          : resolveModuleOffsets(m.path, m.buildId, offsets[i], options.level, loaded);
+        for (size_t j = 0; j < offsets[i].size(); j++) {
+            const auto *address = (const void *) (m.bias + offsets[i][j]);
+            std::vector<frame> &res = resolved[i][offsets[i][j]];
+            for (const cached_frame &f : frames[j]) {
+                res.emplace_back(f.function, f.fullFile, f.line, address, f.inlined);
+            }
+
+            if (res.empty()) {
+                char buffer[3 + sizeof(uintptr_t) * 2] = {'+', '0', 'x'};
+                const size_t len = 3 + formatHex(buffer + 3, offsets[i][j]);
+                res.emplace_back(std::string_view(buffer, len), m.deleted ? m.path + " (deleted)" : m.path, 0,
+                                 address);
+            }
+        }
+    }
+
+    // Every frame gets its resolved frames, so no address of the other process is resolved in this process
+    threads.reserve(stopped.size());
+    for (size_t i = 0; i < stopped.size(); i++) {
+        const std::vector<void *> &addresses = stacks[i];
+        std::vector<std::vector<frame>> unknown;
+        unknown.reserve(addresses.size());
+        std::vector<const std::vector<frame> *> known(addresses.size(), nullptr);
+        for (size_t j = 0; j < addresses.size(); j++) {
+            const auto address = (uintptr_t) addresses[j];
+            const size_t module = findRemoteModule(modules, j == 0 ? address : address - 1);
+            if (module != SIZE_MAX && options.level != resolve_level::raw) {
+                known[j] = &resolved[module][address - modules[module].bias];
+            } else {
+                unknown.push_back({frame(addressToString(addresses[j]), std::string_view(), 0, addresses[j])});
+                known[j] = &unknown.back();
+            }
         }
-#   endif //Release
+
+        stacktrace trace(addresses, options.level);
+        trace.resolveAll(known, false);
+        threads.push_back({stopped[i].thread, threadName(pid, stopped[i].thread), std::move(trace),
+                           stopped[i].stopped, stopped[i].pause});
+    }
+
+    duration = steadyNanos() - start;
 #else
-        frames.push_back(new unix_frame(*(unix_frame *) f));
-#endif //Windows
+    throw std::runtime_error("process_dump is not supported on this architecture");
+#endif //x86_64 || aarch64
+}
+
+STACKTRACE_NODISCARD pid_t process_dump::getPid() const noexcept {
+    return pid;
+}
+
+STACKTRACE_NODISCARD const std::vector<thread_stack> &process_dump::getThreads() const noexcept {
+    return threads;
+}
+
+STACKTRACE_NODISCARD size_t process_dump::size() const noexcept {
+    return threads.size();
+}
+
+STACKTRACE_NODISCARD uint64_t process_dump::getPause() const noexcept {
+    return pause;
+}
+
+STACKTRACE_NODISCARD uint64_t process_dump::getDuration() const noexcept {
+    return duration;
+}
+
+std::ostream &process_dump::printTo(std::ostream &os, bool fullPaths) const {
+    for (const thread_stack &t : threads) {
+        os << "Thread ";
+        if (!t.name.empty()) os << '\'' << t.name << "' ";
+        os << '#' << t.thread;
+        if (t.captured) {
+            os << " (stopped " << t.pause / 1000 << "us):" << std::endl;
+            t.trace.printTo(os, fullPaths);
+        } else {
+            os << ": could not be stopped" << std::endl;
+        }
+
+        os << std::endl;
     }
-}
\ No newline at end of file
+
+    return os;
+}
+
+STACKTRACE_NODISCARD std::string process_dump::toString(bool fullPaths) const {
+    std::stringstream ss;
+    printTo(ss, fullPaths);
+    return ss.str();
+}
+
+#endif //Unix && !Apple
@@ -28,8 +28,22 @@
 #define MARKUSJX_STACKTRACE_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <sstream>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <stdexcept>
+#include <functional>
+#include <thread>
+#include <condition_variable>
+#include <shared_mutex>
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
 #   define STACKTRACE_SLASH '\\'
@@ -53,6 +67,8 @@
 #   include <execinfo.h>
 #   include <dlfcn.h>
 #   include <cxxabi.h>
+#   include <csignal>
+#   include <sys/types.h>
 
 #endif //Unix
 
@@ -71,50 +87,74 @@ namespace markusjx {
     namespace stacktrace {
 
         /**
-         * A stack frame. Virtual.
+         * The level of detail stack frames are resolved with.
+         * Every level includes the information of the levels below it.
          */
-        class frame {
-        protected:
-            /**
-             * The frame constructor
-             */
-            explicit frame(const void *address);
+        enum class resolve_level {
+            // Only the address of every frame
+            raw = 0,
+            // The module and the offset in the module. Uses dladdr only
+            module_offset = 1,
+            // The function name. Does not read any line tables
+            function = 2,
+            // The function name, file and line
+            function_line = 3,
+            // The function name, file and line including inlined functions as separate frames
+            full = 4
+        };
 
+        /**
+         * A function receiving formatted output. Called with the context
+         * passed to the formatting function and the data to write.
+         * The data is not null-terminated.
+         */
+        using frame_writer = void (*)(void *ctx, const char *data, size_t size);
+
+        /**
+         * A stack frame. A plain value, the names point into a process-wide
+         * table of interned strings, so copying a frame never copies any names.
+         * Interned names are never freed, equal names are only stored once.
+         */
+        class frame {
+        public:
             /**
-             * Copy constructor
-             *
-             * @param f the frame to copy from
+             * Create an empty frame
              */
-            frame(const frame &f);
+            frame() noexcept;
 
             /**
-             * Move constructor
+             * Create a frame. The names are interned, the file name
+             * is the part of the full file path after the last slash.
              *
-             * @param f the frame to move
+             * @param function the function
+             * @param fullFile the full file path or the module if the file is unknown
+             * @param line the line or 0 if unknown
+             * @param address the address
+             * @param inlined whether this function was inlined into the next frame
              */
-            frame(frame &&f) noexcept;
+            frame(std::string_view function, std::string_view fullFile, size_t line, const void *address,
+                  bool inlined = false);
 
-        public:
             /**
              * Get the function name
              *
              * @return the function name
              */
-            STACKTRACE_NODISCARD const std::string &getFunction() const noexcept;
+            STACKTRACE_NODISCARD std::string_view getFunction() const noexcept;
 
             /**
              * Get the full file path
              *
              * @return the file path
              */
-            STACKTRACE_NODISCARD const std::string &getFullFilePath() const noexcept;
+            STACKTRACE_NODISCARD std::string_view getFullFilePath() const noexcept;
 
             /**
-             * Get the file name
+             * Get the file name. Points into the full file path.
              *
              * @return the file name
              */
-            STACKTRACE_NODISCARD const std::string &getFile() const noexcept;
+            STACKTRACE_NODISCARD std::string_view getFile() const noexcept;
 
             /**
              * Get the line number of the call
@@ -131,240 +171,473 @@ namespace markusjx {
             STACKTRACE_NODISCARD const void *getAddress() const noexcept;
 
             /**
-             * Convert the frame to a string. Purely virtual function so frame cannot be constructed.
+             * Check if this frame is a function inlined into the next frame.
+             * Inlined frames are only created using resolve_level::full.
+             *
+             * @return true, if this frame was inlined
+             */
+            STACKTRACE_NODISCARD bool isInlined() const noexcept;
+
+            /**
+             * Write the frame to a writer without allocating any memory
+             *
+             * @param write the function to write the frame to
+             * @param ctx the context passed to write
+             * @param fullPaths whether the full path names should be used
+             */
+            void formatTo(frame_writer write, void *ctx, bool fullPaths) const;
+
+            /**
+             * Convert the frame to a string
              *
              * @param fullPaths whether the full path names should be used
              * @return the frame as a string
              */
-            STACKTRACE_NODISCARD virtual std::string toString(bool fullPaths) const = 0;
+            STACKTRACE_NODISCARD std::string toString(bool fullPaths) const;
+
+            /**
+             * Get the hash of this frame. As the names are interned,
+             * only their addresses are hashed.
+             *
+             * @return the hash
+             */
+            STACKTRACE_NODISCARD size_t hash() const noexcept;
+
+            /**
+             * Check if two frames are equal. Only compares the addresses
+             * of the interned names, not the names themselves.
+             *
+             * @param other the frame to compare with
+             * @return true, if both frames are equal
+             */
+            STACKTRACE_NODISCARD bool operator==(const frame &other) const noexcept;
 
             /**
-             * The frame destructor
+             * Check if two frames are not equal
+             *
+             * @param other the frame to compare with
+             * @return true, if the frames are not equal
              */
-            virtual ~frame();
+            STACKTRACE_NODISCARD bool operator!=(const frame &other) const noexcept;
+
+        private:
+            // The function name
+            std::string_view function;
+
+            // The full file path
+            std::string_view fullFile;
 
-        protected:
-            std::string function;
-            std::string fullFile;
-            std::string file;
+            // The offset of the file name in fullFile
+            size_t fileOffset;
+
+            // The line number
             size_t line;
+
+            // The address of the frame
             const void *address;
+
+            // Whether the function was inlined into the next frame
+            bool inlined;
         };
 
 #ifdef STACKTRACE_WINDOWS
         using handle_ptr = std::shared_ptr<void>;
+#endif //Windows
 
         /**
-         * The type of a frame on windows. Can be win_debug_frame or win_release_frame.
+         * Options for stacktrace::prewarm
          */
-        enum win_frame_type {
-            debug = 1,
-            release = 2
+        struct prewarm_options {
+            // Only load modules whose path contains one of these strings.
+            // All modules are loaded if this is empty.
+            std::vector<std::string> modules;
+
+            // The max number of modules to load or 0 for no limit
+            size_t maxModules = 0;
+
+            // The max number of bytes the loaded symbol and line tables may use or 0 for no limit.
+            // Modules which would exceed this limit are skipped.
+            size_t maxBytes = 0;
+
+            // Whether to also load the line number tables
+            bool loadLines = true;
         };
 
         /**
-         * A frame on windows. Virtual.
+         * The result of stacktrace::prewarm
          */
-        class win_frame : public frame {
-        protected:
-            /**
-             * The constructor of win_frame
-             */
-            win_frame(const void *address);
+        struct prewarm_result {
+            // The number of modules loaded
+            size_t modules = 0;
 
-            /**
-             * Copy constructor of win_frame
-             *
-             * @param f the frame to copy from
-             */
-            win_frame(const win_frame &f);
+            // The estimated number of bytes used by the loaded modules
+            size_t bytes = 0;
+        };
 
-            /**
-             * Move constructor of win_frame
-             *
-             * @param f the frame to move
-             */
-            win_frame(win_frame &&f) noexcept;
+        /**
+         * The symbol cache usage of a single module
+         */
+        struct module_cache_stats {
+            // The path of the module
+            std::string path;
 
-        public:
-            /**
-             * Get the type of this frame
-             *
-             * @return the type of this frame
-             */
-            STACKTRACE_NODISCARD virtual win_frame_type getType() const noexcept = 0;
+            // The estimated number of bytes used by the symbol and line tables.
+            // Modules with different paths to the same file share the tables
+            size_t tableBytes = 0;
+
+            // The estimated number of bytes used by the resolved frames
+            size_t frameBytes = 0;
+
+            // The estimated number of bytes used by the demangled names
+            size_t nameBytes = 0;
+
+            // The number of resolved frames cached
+            size_t frames = 0;
+        };
+
+        /**
+         * The result of stacktrace::getCacheStats
+         */
+        struct cache_stats {
+            // The estimated number of bytes used by all caches
+            size_t bytes = 0;
+
+            // The max number of bytes the caches may use or 0 for no limit
+            size_t maxBytes = 0;
+
+            // The number of modules evicted from the cache
+            size_t evictions = 0;
+
+            // The number of bytes used by the interned names of all frames.
+            // Interned names are never freed and not part of bytes.
+            size_t internedBytes = 0;
+
+            // The usage of every cached module, the most recently used one first
+            std::vector<module_cache_stats> modules;
         };
 
         /**
-         * A windows debug frame
+         * A table of resolved addresses, created by stacktrace::symbolize
          */
-        class STACKTRACE_UNUSED win_debug_frame : public win_frame {
+        class symbol_table {
         public:
             /**
-             * The win_debug_frame constructor
+             * Create an empty symbol table
              *
-             * @param address the address of the function
-             * @param handle the handle of this process
+             * @param level the level of detail the addresses are resolved with
              */
-            STACKTRACE_UNUSED explicit win_debug_frame(const void *address, const handle_ptr &handle);
+            explicit symbol_table(resolve_level level = resolve_level::function_line);
 
             /**
              * Copy constructor
              *
-             * @param f the frame to copy from
+             * @param table the table to copy from
              */
-            win_debug_frame(const win_debug_frame &f);
+            symbol_table(const symbol_table &table);
 
             /**
              * Move constructor
              *
-             * @param f the frame to move
+             * @param table the table to move
              */
-            win_debug_frame(win_debug_frame &&f) noexcept;
+            symbol_table(symbol_table &&table) noexcept;
 
             /**
-             * Convert the frame to a string. Purely virtual function so frame cannot be constructed.
+             * Operator =
              *
-             * @param fullPaths whether the full path names should be used
-             * @return the frame as a string
+             * @param table the table to copy from
+             * @return this
              */
-            STACKTRACE_NODISCARD std::string toString(bool fullPaths) const override;
+            symbol_table &operator=(const symbol_table &table);
 
             /**
-             * Get the type of this frame
+             * Operator =
              *
-             * @return the type of this frame. In this case, it is win_frame_type::debug
-             */
-            STACKTRACE_NODISCARD win_frame_type getType() const noexcept override;
-
-            /**
-             * The destructor of win_debug_frame
+             * @param table the table to move
+             * @return this
              */
-            ~win_debug_frame() override;
-        };
+            symbol_table &operator=(symbol_table &&table) noexcept;
 
-        /**
-         * A windows release frame
-         */
-        class STACKTRACE_UNUSED win_release_frame : public win_frame {
-        public:
             /**
-             * The constructor of win_release_frame
+             * Get the frames of an address.
+             * With resolve_level::full, the inlined frames come first.
              *
-             * @param address the address of the function
-             * @param handle the handle of this process
+             * @param address the address to search for
+             * @return the frames of the address or nullptr if the address is not in this table
              */
-            STACKTRACE_UNUSED explicit win_release_frame(const void *address, const handle_ptr &handle);
+            STACKTRACE_NODISCARD const std::vector<frame> *find(const void *address) const;
 
             /**
-             * Copy constructor
+             * Get the level of detail the addresses are resolved with
              *
-             * @param f the frame to copy from
+             * @return the resolve level
              */
-            win_release_frame(const win_release_frame &f);
+            STACKTRACE_NODISCARD resolve_level getLevel() const noexcept;
 
             /**
-             * Move constructor
+             * Get the number of addresses in this table
              *
-             * @param f the frame to move
+             * @return the number of addresses
              */
-            win_release_frame(win_release_frame &&f) noexcept;
+            STACKTRACE_NODISCARD size_t size() const noexcept;
 
             /**
-             * Convert this frame to a string
-             *
-             * @param fullPath a unused parameter. Just here to override the original toString function
-             * @return this frame as a string
+             * The symbol_table destructor
              */
-            STACKTRACE_NODISCARD std::string toString(bool) const override;
+            ~symbol_table() noexcept;
 
-            /**
-             * Get the type of this frame
-             *
-             * @return the type of this frame. In this case, it is win_frame_type::release
-             */
-            STACKTRACE_NODISCARD win_frame_type getType() const noexcept override;
+        private:
+            friend class stacktrace;
 
-            /**
-             * The destructor of win_release_frame
-             */
-            inline ~win_release_frame() override;
+            // The level of detail the addresses are resolved with
+            resolve_level level;
+
+            // The frames of every address
+            std::unordered_map<const void *, std::vector<frame>> table;
         };
 
-#endif //Windows
+        /**
+         * A field of a trace_format
+         */
+        enum class format_field {
+            // Literal text
+            text,
+            // The index of the captured address in the trace
+            index,
+            // The address of the frame
+            address,
+            // The file name of the module the address is in
+            module,
+            // The function name
+            function,
+            // The source file name
+            file,
+            // The full source file path
+            path,
+            // The line number
+            line,
+            // Writes nothing, but is only present if the frame was inlined
+            inlined,
+            // The start of an optional group
+            group_begin,
+            // The end of an optional group
+            group_end
+        };
 
-#ifdef STACKTRACE_UNIX
+        /**
+         * A part of a parsed trace_format
+         */
+        struct format_segment {
+            // The field to write
+            format_field field = format_field::text;
+
+            // The text to write if field is format_field::text
+            const char *text = nullptr;
+
+            // The length of text. The index of the matching
+            // group_end if field is format_field::group_begin.
+            size_t size = 0;
+        };
 
         /**
-         * A unix stack frame.
-         * Mostly based on this: https://gist.github.com/fmela/591333/c64f4eb86037bb237862a8283df70cdfc25f01d3
+         * A format for the lines of a stack trace. The format is parsed once,
+         * formatting a trace only walks the parsed segments. Formats can be
+         * created at compile time:
+         * <pre>
+         * constexpr markusjx::stacktrace::trace_format format("{index}|{function}[|{file}:{line}]\n");
+         * std::cout << trace.toString(format);
+         * </pre>
+         *
+         * Fields are written in braces: {index}, {address}, {module}, {function},
+         * {file}, {path}, {line} and {inlined}. Text in square brackets is only
+         * written if every field directly in it is present, i.e. not empty, not
+         * line 0 and, for {inlined}, only for inlined frames. Groups may be nested.
+         * Use a backslash to write {, }, [, ] or \ themselves.
+         * The layout used by toString for unix frames equals
+         * " {index}# {function}[ in {file}[:{line}][ (inlined){inlined}]]\n".
          */
-        class unix_frame : public frame {
+        class trace_format {
         public:
+            // The max number of segments a format may consist of
+            static constexpr size_t maxSegments = 64;
+
             /**
-             * Construct a unix_frame object
+             * Parse a format. Throws std::invalid_argument if the format is invalid,
+             * which fails the compilation if the format is parsed at compile time.
              *
-             * @param address the function address
+             * @param format the format to parse. Must outlive this object
+             * @param stripPrefix a prefix to remove from {path}, e.g. the source root.
+             *                    Must outlive this object
              */
-            explicit unix_frame(void *address);
+            constexpr explicit trace_format(const char *format, const char *stripPrefix = "")
+                    : segments(), count(0), prefix(stripPrefix), prefixSize(length(stripPrefix)), usesModule(false) {
+                size_t groups[maxSegments] = {};
+                size_t depth = 0;
+                size_t start = 0;
+                size_t i = 0;
+
+                while (format[i] != '\0') {
+                    const char c = format[i];
+                    if (c == '\\' && format[i + 1] != '\0') {
+                        // An escaped character, write the text before and the character itself
+                        addText(format + start, i - start);
+                        addText(format + i + 1, 1);
+                        i += 2;
+                        start = i;
+                    } else if (c == '{') {
+                        addText(format + start, i - start);
+
+                        size_t end = i + 1;
+                        while (format[end] != '\0' && format[end] != '}') end++;
+                        if (format[end] == '\0') throw std::invalid_argument("Unterminated field in trace format");
+
+                        add(parseField(format + i + 1, end - i - 1), nullptr, 0);
+                        i = end + 1;
+                        start = i;
+                    } else if (c == '[') {
+                        addText(format + start, i - start);
+                        groups[depth++] = count;
+                        add(format_field::group_begin, nullptr, 0);
+                        start = ++i;
+                    } else if (c == ']') {
+                        addText(format + start, i - start);
+                        if (depth == 0) throw std::invalid_argument("Unmatched ']' in trace format");
+
+                        segments[groups[--depth]].size = count;
+                        add(format_field::group_end, nullptr, 0);
+                        start = ++i;
+                    } else if (c == '}') {
+                        throw std::invalid_argument("Unmatched '}' in trace format");
+                    } else {
+                        i++;
+                    }
+                }
+
+                addText(format + start, i - start);
+                if (depth != 0) throw std::invalid_argument("Unterminated group in trace format");
+            }
 
             /**
-             * Create a unix frame from existing data
+             * Write a frame using this format
              *
-             * @param function the function
-             * @param fullFile the full file path
-             * @param file the file
-             * @param line the line
-             * @param address the address
+             * @param index the index of the captured address of the frame
+             * @param f the frame to write
+             * @param write the function to write the frame to
+             * @param ctx the context passed to write
              */
-            STACKTRACE_UNUSED unix_frame(const std::string &function, const std::string &fullFile,
-                                         const std::string &file, size_t line, const void *address);
+            void formatFrame(size_t index, const frame &f, frame_writer write, void *ctx) const;
 
             /**
-             * Copy constructor
+             * Get the parsed segments
              *
-             * @param f the frame to copy from
+             * @return the segments
              */
-            unix_frame(const unix_frame &f);
+            STACKTRACE_NODISCARD constexpr const format_segment *begin() const noexcept {
+                return segments;
+            }
 
             /**
-             * Move constructor
+             * Get the end of the parsed segments
              *
-             * @param f the frame to move
+             * @return the end of the segments
              */
-            unix_frame(unix_frame &&f) noexcept;
+            STACKTRACE_NODISCARD constexpr const format_segment *end() const noexcept {
+                return segments + count;
+            }
 
+        private:
             /**
-             * Convert this to a string
+             * Get the length of a null-terminated string
              *
-             * @param fullPath whether to use full paths
-             * @return this frame as a string
+             * @param str the string
+             * @return the length of the string
              */
-            STACKTRACE_NODISCARD inline std::string toString(bool fullPath) const override;
+            static constexpr size_t length(const char *str) {
+                size_t len = 0;
+                while (str[len] != '\0') len++;
+                return len;
+            }
 
-        private:
-#ifndef STACKTRACE_NO_ADDR2LINE
             /**
-             * Try to get the file name, function name and line using the addr2line tool
+             * Check if a part of the format equals a field name
              *
-             * @param backtrace_sym the result from backtrace_symbols
-             * @return true, if the operation was successful
+             * @param name the part of the format
+             * @param size the size of name
+             * @param field the field name to compare with
+             * @return true if both are equal
              */
-            bool init_using_addr2line(const char *backtrace_sym);
-#else
+            static constexpr bool equals(const char *name, size_t size, const char *field) {
+                for (size_t i = 0; i < size; i++) {
+                    if (field[i] != name[i]) return false;
+                }
+
+                return field[size] == '\0';
+            }
+
+            /**
+             * Parse the name of a field
+             *
+             * @param name the name of the field, not null-terminated
+             * @param size the size of name
+             * @return the parsed field
+             */
+            constexpr format_field parseField(const char *name, size_t size) {
+                if (equals(name, size, "index")) return format_field::index;
+                if (equals(name, size, "address")) return format_field::address;
+                if (equals(name, size, "function")) return format_field::function;
+                if (equals(name, size, "file")) return format_field::file;
+                if (equals(name, size, "path")) return format_field::path;
+                if (equals(name, size, "line")) return format_field::line;
+                if (equals(name, size, "inlined")) return format_field::inlined;
+                if (equals(name, size, "module")) {
+                    usesModule = true;
+                    return format_field::module;
+                }
+
+                throw std::invalid_argument("Unknown field in trace format");
+            }
 
             /**
-             * Addr2line on systems without libbfd. Static because it only returns false
-             * and does nothing else
+             * Add a segment
              *
-             * @return false. All the time.
+             * @param field the field of the segment
+             * @param text the text of the segment
+             * @param size the size of the segment
              */
-            static bool init_using_addr2line(const char *);
+            constexpr void add(format_field field, const char *text, size_t size) {
+                if (count >= maxSegments) throw std::invalid_argument("Too many segments in trace format");
 
-#endif
-        };
+                segments[count].field = field;
+                segments[count].text = text;
+                segments[count].size = size;
+                count++;
+            }
 
-#endif //Unix
+            /**
+             * Add a text segment, if the text is not empty
+             *
+             * @param text the text to add
+             * @param size the size of text
+             */
+            constexpr void addText(const char *text, size_t size) {
+                if (size > 0) add(format_field::text, text, size);
+            }
+
+            // The parsed segments
+            format_segment segments[maxSegments];
+
+            // The number of segments
+            size_t count;
+
+            // The prefix to remove from paths
+            const char *prefix;
+
+            // The length of prefix
+            size_t prefixSize;
+
+            // Whether the format contains {module}
+            bool usesModule;
+        };
 
         /**
          * The stacktrace class
@@ -391,17 +664,36 @@ namespace markusjx {
              * If you are not using addr2line, make sure to export the symbols of your executable.
              * Also, link against dl on linux-based systems.
              *
+             * The frames are only captured by the constructor, they are resolved
+             * once they are accessed, e.g. by calling toString.
+             * Use a lower resolve level to only pay for the information you need,
+             * e.g. resolve_level::function does not read any line tables.
+             * On windows, everything below resolve_level::function_line only uses
+             * the symbol table and resolve_level::full does not create inlined frames.
+             *
              * @param framesToSkip the number of frames to skip
              * @param maxFrames the max number of frames to capture
+             * @param level the level of detail to resolve the frames with
              */
-            explicit stacktrace(unsigned long framesToSkip = 0, size_t maxFrames = 128);
+            explicit stacktrace(unsigned long framesToSkip = 0, size_t maxFrames = 128,
+                                resolve_level level = resolve_level::function_line);
 
             /**
-             * Copy constructor
+             * Create a stack trace from already captured addresses.
+             * The addresses are resolved once they are accessed.
+             *
+             * @param addresses the addresses, the innermost frame first
+             * @param level the level of detail to resolve the frames with
+             */
+            explicit stacktrace(std::vector<void *> addresses, resolve_level level = resolve_level::function_line);
+
+            /**
+             * Copy constructor. The copy shares the addresses and
+             * frames of trace, no frames are copied.
              *
              * @param trace the object to copy from
              */
-            stacktrace(const stacktrace &trace);
+            stacktrace(const stacktrace &trace) noexcept;
 
             /**
              * Move constructor
@@ -411,12 +703,13 @@ namespace markusjx {
             stacktrace(stacktrace &&trace) noexcept;
 
             /**
-             * Operator =
+             * Operator =. Shares the addresses and frames of trace,
+             * the frames of this trace are released.
              *
              * @param trace the object to copy from
              * @return this
              */
-            stacktrace &operator=(const stacktrace &trace);
+            stacktrace &operator=(const stacktrace &trace) noexcept;
 
             /**
              * Operator =
@@ -427,54 +720,65 @@ namespace markusjx {
             stacktrace &operator=(stacktrace &&trace) noexcept;
 
             /**
-             * Get the frame vector
+             * Get the frame vector. Resolves all frames.
              *
              * @return a reference to the frame vector
              */
-            STACKTRACE_NODISCARD STACKTRACE_UNUSED const std::vector<frame *> &getFrames() const noexcept;
+            STACKTRACE_NODISCARD STACKTRACE_UNUSED const std::vector<frame> &getFrames() const;
 
             /**
-             * Get a frame pointer at an index
+             * Get the captured addresses. Does not resolve any frames.
              *
-             * @param index the index of the frame pointer
-             * @return the frame pointer
+             * @return the captured addresses
              */
-            STACKTRACE_NODISCARD const frame *operator[](size_t index) const;
+            STACKTRACE_NODISCARD const std::vector<void *> &getAddresses() const noexcept;
 
             /**
-             * begin()
+             * Get the frames of a captured address. With resolve_level::full, the inlined frames
+             * come first. Only resolves the requested address, unless resolve_level::full is used.
              *
-             * @return a vector iterator
+             * @param index the index of the captured address
+             * @return the first frame of the address and the end of its frames
              */
-            std::vector<frame *>::iterator begin() noexcept;
+            STACKTRACE_NODISCARD std::pair<const frame *, const frame *> getAddressFrames(size_t index) const;
 
             /**
-             * begin()
+             * Get the level of detail the frames are resolved with
              *
-             * @return a vector const iterator
+             * @return the resolve level
+             */
+            STACKTRACE_NODISCARD resolve_level getLevel() const noexcept;
+
+            /**
+             * Get a frame at an index. The reference stays valid while this trace exists.
+             * Only resolves the requested frame, unless resolve_level::full is used.
+             *
+             * @param index the index of the frame
+             * @return the frame
              */
-            STACKTRACE_NODISCARD std::vector<frame *>::const_iterator begin() const noexcept;
+            STACKTRACE_NODISCARD const frame &operator[](size_t index) const;
 
             /**
-             * end()
+             * begin(). Resolves all frames.
              *
-             * @return a vector iterator
+             * @return a vector const iterator
              */
-            std::vector<frame *>::iterator end() noexcept;
+            STACKTRACE_NODISCARD std::vector<frame>::const_iterator begin() const;
 
             /**
-             * end()
+             * end(). Resolves all frames.
              *
              * @return a vector const iterator
              */
-            STACKTRACE_NODISCARD std::vector<frame *>::const_iterator end() const noexcept;
+            STACKTRACE_NODISCARD std::vector<frame>::const_iterator end() const;
 
             /**
-             * Get the number of frames captured
+             * Get the number of frames. Only resolves the
+             * frames if resolve_level::full is used.
              *
              * @return the size of the frame vector
              */
-            STACKTRACE_NODISCARD size_t size() const noexcept;
+            STACKTRACE_NODISCARD size_t size() const;
 
             /**
              * Check if the frame vector is empty
@@ -490,6 +794,31 @@ namespace markusjx {
              */
             STACKTRACE_NODISCARD operator bool() const noexcept;
 
+            /**
+             * Get the hash of the captured addresses. The hash is
+             * computed once when the trace is created, no frames are resolved.
+             *
+             * @return the hash
+             */
+            STACKTRACE_NODISCARD size_t hash() const noexcept;
+
+            /**
+             * Check if two traces captured the same addresses with the same
+             * resolve level. Does not resolve any frames.
+             *
+             * @param other the trace to compare with
+             * @return true, if both traces are equal
+             */
+            STACKTRACE_NODISCARD bool operator==(const stacktrace &other) const noexcept;
+
+            /**
+             * Check if two traces are not equal. Does not resolve any frames.
+             *
+             * @param other the trace to compare with
+             * @return true, if the traces are not equal
+             */
+            STACKTRACE_NODISCARD bool operator!=(const stacktrace &other) const noexcept;
+
             /**
              * Dump this stack trace
              *
@@ -498,29 +827,2323 @@ namespace markusjx {
              */
             STACKTRACE_NODISCARD std::string toString(bool fullPaths = false) const;
 
+            /**
+             * Dump a range of this stack trace. Only the frames in the range are resolved.
+             * The range refers to the captured addresses, with resolve_level::full,
+             * the inlined frames of an address are dumped with it using the same index.
+             *
+             * @param fullPaths whether to use full paths for file names
+             * @param first the index of the first captured address to dump
+             * @param count the max number of captured addresses to dump
+             * @return the dumped stack trace
+             */
+            STACKTRACE_NODISCARD std::string toString(bool fullPaths, size_t first, size_t count) const;
+
+            /**
+             * Write this stack trace to a writer. The output equals toString.
+             * Formatting does not allocate any memory, but frames which are not resolved
+             * yet are resolved first. Call getFrames before to resolve all frames.
+             *
+             * @param write the function to write the trace to
+             * @param ctx the context passed to write
+             * @param fullPaths whether to use full paths for file names
+             * @param first the index of the first captured address to write
+             * @param count the max number of captured addresses to write
+             */
+            void formatTo(frame_writer write, void *ctx, bool fullPaths = false, size_t first = 0,
+                          size_t count = SIZE_MAX) const;
+
+            /**
+             * Write this stack trace into a buffer, like snprintf.
+             * At most size - 1 characters are written, followed by a null terminator.
+             * The output equals toString. See formatTo(frame_writer, void *, bool, size_t, size_t)
+             *
+             * @param buffer the buffer to write to
+             * @param size the size of the buffer
+             * @param fullPaths whether to use full paths for file names
+             * @param first the index of the first captured address to write
+             * @param count the max number of captured addresses to write
+             * @return the length of the whole output, which may be larger than size
+             */
+            size_t formatTo(char *buffer, size_t size, bool fullPaths = false, size_t first = 0,
+                            size_t count = SIZE_MAX) const;
+
+            /**
+             * Write this stack trace to an output iterator.
+             * The output equals toString. See formatTo(frame_writer, void *, bool, size_t, size_t)
+             *
+             * @tparam OutputIt the type of the iterator. Must not be a pointer, use formatTo(char *, size_t) instead
+             * @param out the iterator to write to
+             * @param fullPaths whether to use full paths for file names
+             * @return the iterator past the last written character
+             */
+            template<class OutputIt, class = typename std::enable_if<!std::is_pointer<OutputIt>::value>::type>
+            OutputIt formatTo(OutputIt out, bool fullPaths = false) const {
+                formatTo(&writeToIterator<OutputIt>, &out, fullPaths);
+                return out;
+            }
+
+            /**
+             * Convert this stack trace to a string using a custom format
+             *
+             * @param format the format of every frame
+             * @param first the index of the first captured address to write
+             * @param count the max number of captured addresses to write
+             * @return this stack trace as a string
+             */
+            STACKTRACE_NODISCARD std::string toString(const trace_format &format, size_t first = 0,
+                                                      size_t count = SIZE_MAX) const;
+
+            /**
+             * Write this stack trace to a writer using a custom format.
+             * Does not allocate any memory except for resolving frames.
+             * See formatTo(frame_writer, void *, bool, size_t, size_t)
+             *
+             * @param format the format of every frame
+             * @param write the function to write the trace to
+             * @param ctx the context passed to write
+             * @param first the index of the first captured address to write
+             * @param count the max number of captured addresses to write
+             */
+            void formatTo(const trace_format &format, frame_writer write, void *ctx, size_t first = 0,
+                          size_t count = SIZE_MAX) const;
+
+            /**
+             * Write this stack trace into a buffer using a custom format, like snprintf.
+             * See formatTo(char *, size_t, bool, size_t, size_t)
+             *
+             * @param format the format of every frame
+             * @param buffer the buffer to write to
+             * @param size the size of the buffer
+             * @param first the index of the first captured address to write
+             * @param count the max number of captured addresses to write
+             * @return the length of the whole output, which may be larger than size
+             */
+            size_t formatTo(const trace_format &format, char *buffer, size_t size, size_t first = 0,
+                            size_t count = SIZE_MAX) const;
+
+            /**
+             * Write this stack trace directly to a stream using a custom format.
+             * See printTo(std::ostream &, bool, bool, size_t, size_t)
+             *
+             * @param os the stream to write to
+             * @param format the format of every frame
+             * @param flush whether to flush the stream after every frame
+             * @return the stream
+             */
+            std::ostream &printTo(std::ostream &os, const trace_format &format, bool flush = false) const;
+
+            /**
+             * Serialize this stack trace into a compact binary form.
+             * Addresses are stored as module ids and offsets in the module,
+             * so traces can be decoded in other processes running the same modules.
+             * Offsets are stored as varint encoded differences to the previous
+             * offset in the same module.
+             *
+             * @param withSymbols whether to resolve all frames and store the
+             *                    resolved symbols as interned strings, too
+             * @return the serialized trace
+             */
+            STACKTRACE_NODISCARD std::string serialize(bool withSymbols = false) const;
+
+            /**
+             * Decode a stack trace created by serialize.
+             * Addresses in modules loaded into this process are mapped
+             * to their addresses in this process. Addresses in modules
+             * which are not loaded are shown as their module offset.
+             * Stored symbols are used instead of resolving the addresses.
+             * Throws std::invalid_argument if the data is malformed.
+             *
+             * @param data the serialized trace
+             * @return the decoded trace
+             */
+            static stacktrace deserialize(const std::string &data);
+
+            /**
+             * Write this stack trace as JSON to a writer. Strings are escaped
+             * while writing, no document is built in memory. The output is an object
+             * with a "frames" array. Every frame has the fields "index", "address",
+             * "module" and "offset" and, with symbols, "function", "file", "path",
+             * "line" and "inlined".
+             *
+             * @param write the function to write the JSON to
+             * @param ctx the context passed to write
+             * @param withSymbols whether to resolve the frames and write their symbols
+             */
+            void writeJson(frame_writer write, void *ctx, bool withSymbols = true) const;
+
+            /**
+             * Write this stack trace as JSON to a stream.
+             * See writeJson(frame_writer, void *, bool)
+             *
+             * @param os the stream to write to
+             * @param withSymbols whether to resolve the frames and write their symbols
+             * @return the stream
+             */
+            std::ostream &writeJson(std::ostream &os, bool withSymbols = true) const;
+
+            /**
+             * Convert this stack trace to JSON.
+             * See writeJson(frame_writer, void *, bool)
+             *
+             * @param withSymbols whether to resolve the frames and write their symbols
+             * @return the JSON string
+             */
+            STACKTRACE_NODISCARD std::string toJson(bool withSymbols = true) const;
+
+            /**
+             * Fill the unresolved frames of this trace from a symbol table.
+             * Only used if the table was created with the resolve level of this trace.
+             * Addresses not in the table are resolved once they are accessed.
+             *
+             * @param table the table to get the frames from
+             */
+            void resolveFrom(const symbol_table &table);
+
+            /**
+             * Capture the addresses of the current stack into a buffer,
+             * without allocating any memory or resolving any frames
+             *
+             * @param buffer the buffer to write the addresses to, the innermost frame first
+             * @param size the size of the buffer
+             * @param framesToSkip the number of frames to skip, only used on windows
+             * @return the number of captured addresses
+             */
+            static size_t capture(void **buffer, size_t size, unsigned long framesToSkip = 0);
+
+            /**
+             * Resolve many addresses at once, e.g. the addresses of many traces.
+             * Every unique address is only resolved once and all addresses of a
+             * module are resolved together. Use stacktrace::resolveFrom to
+             * fill traces using the returned table.
+             *
+             * @param addresses the addresses to resolve
+             * @param count the number of addresses
+             * @param level the level of detail to resolve the addresses with
+             * @return the table containing every resolved address
+             */
+            static symbol_table symbolize(void *const *addresses, size_t count,
+                                          resolve_level level = resolve_level::function_line);
+
+            /**
+             * Resolve the addresses of many traces at once. See stacktrace::symbolize
+             *
+             * @param traces the traces to resolve the addresses of
+             * @param level the level of detail to resolve the addresses with
+             * @return the table containing every resolved address
+             */
+            static symbol_table symbolize(const std::vector<stacktrace> &traces,
+                                          resolve_level level = resolve_level::function_line);
+
+            /**
+             * Write this stack trace directly to a stream, without building
+             * the whole trace in a temporary string. The output equals toString.
+             * Frames are resolved one after another while writing, so output
+             * begins before the later frames are resolved. Stops writing once
+             * the stream is in a failed state.
+             *
+             * @param os the stream to write to
+             * @param fullPaths whether to use full paths for file names
+             * @param flush whether to flush the stream after every frame, so the
+             *              frames become visible while the next ones are resolved
+             * @param first the index of the first captured address to write
+             * @param count the max number of captured addresses to write
+             * @return the stream
+             */
+            std::ostream &printTo(std::ostream &os, bool fullPaths = false, bool flush = false, size_t first = 0,
+                                  size_t count = SIZE_MAX) const;
+
             // Operator<< for streams
             friend inline std::ostream &operator<<(std::ostream &os, const stacktrace &data) {
-                os << data.toString();
-                return os;
+                return data.printTo(os);
             }
 
             /**
-             * The stacktrace destructor
+             * Load the symbol data of all modules loaded into this process, so the
+             * first stack trace does not have to pay for it.
+             * On windows, all modules are loaded by SymInitialize, the options are ignored.
+             * On systems without addr2line, this does nothing.
+             *
+             * @param options the options specifying which modules to load
+             * @return the number of modules loaded and the memory used by them
              */
-            ~stacktrace() noexcept;
+            static prewarm_result prewarm(const prewarm_options &options = prewarm_options());
 
-        private:
-            // A vector containing all frames
-            std::vector<frame *> frames;
+            /**
+             * Load the symbol data of all modules in a background thread.
+             * See stacktrace::prewarm
+             *
+             * @param options the options specifying which modules to load
+             * @return a future resolved once the modules are loaded
+             */
+            static std::future<prewarm_result> prewarmAsync(const prewarm_options &options = prewarm_options());
 
             /**
-             * Copy all frames from another frame vector
+             * Get the memory used by the symbol caches.
+             * The caches store the symbol and line tables, demangled names
+             * and resolved frames of every module. Only used on unix.
              *
-             * @param toCopyFrom the vector to copy from
+             * @return the cache statistics
              */
-            void copyFrames(const std::vector<frame *> &toCopyFrom);
-        };
-    }
+            static cache_stats getCacheStats();
+
+            /**
+             * Set the max number of bytes all symbol caches may use together.
+             * If the limit is exceeded, the least recently used modules are evicted.
+             *
+             * @param maxBytes the limit or 0 for no limit. Defaults to 0
+             */
+            static void setCacheLimit(size_t maxBytes);
+
+            /**
+             * Remove everything from the symbol caches. The interned names of frames are kept,
+             * as existing frames point to them
+             */
+            static void clearCache();
+
+            /**
+             * Resolve addresses using a symbolizer daemon (see symbolizer_server) listening on a unix
+             * socket, so the symbol and line tables are only loaded once per host instead of into every
+             * process. Addresses the daemon could not resolve are resolved in this process, as are all
+             * addresses if the daemon could not be reached. Only used on linux.
+             *
+             * @param socketPath the path of the socket of the daemon or an empty string to resolve in this process
+             * @param timeout the max time to wait for the daemon in milliseconds
+             */
+            static void setSymbolizer(const std::string &socketPath, size_t timeout = 1000);
+
+            /**
+             * The stacktrace destructor
+             */
+            ~stacktrace() noexcept;
+
+        private:
+            friend class flight_recorder;
+
+            friend class process_dump;
+
+            /**
+             * A frame_writer writing to an output iterator
+             *
+             * @tparam OutputIt the type of the iterator
+             * @param ctx a pointer to the iterator
+             * @param data the data to write
+             * @param size the size of data
+             */
+            template<class OutputIt>
+            static void writeToIterator(void *ctx, const char *data, size_t size) {
+                OutputIt &out = *static_cast<OutputIt *>(ctx);
+                out = std::copy(data, data + size, out);
+            }
+
+            /**
+             * The captured addresses and their frames. Shared by all copies of a trace,
+             * so copying a trace does not copy any frames. Frames are only ever added
+             * while resolving, a resolved frame is never changed again.
+             */
+            struct trace_data {
+                // The captured addresses
+                std::vector<void *> addresses;
+
+                // The level of detail to resolve the frames with
+                resolve_level level = resolve_level::function_line;
+
+                // The hash of the addresses
+                size_t hash = 0;
+
+                // All frames in one array. Without resolve_level::full, every captured
+                // address has exactly one frame at its own index, which is filled once resolved.
+                // With resolve_level::full, all addresses are resolved at once and
+                // the inlined frames of an address come before its actual frame.
+                std::vector<frame> frames;
+
+                // Whether the frame of a captured address is resolved.
+                // Not used with resolve_level::full.
+                std::vector<bool> isResolved;
+
+                // The index of the first frame of every captured address, followed
+                // by the number of frames. Only used with resolve_level::full,
+                // empty until all addresses are resolved.
+                std::vector<size_t> firstFrames;
+
+                // A mutex guarding the lazy resolution
+                std::mutex mtx;
+            };
+
+            // The shared data of this trace, never null
+            std::shared_ptr<trace_data> data;
+
+            /**
+             * Get the data of an empty trace, shared by all moved from traces
+             *
+             * @return the empty trace data
+             */
+            static const std::shared_ptr<trace_data> &emptyData() noexcept;
+
+            /**
+             * Resolve the frames of a captured address, if not already resolved.
+             * With resolve_level::full, all addresses are resolved. The mutex of data must be locked.
+             *
+             * @param index the index of the captured address
+             * @return the first frame of the address and the end of its frames
+             */
+            std::pair<const frame *, const frame *> resolve(size_t index) const;
+
+            /**
+             * Resolve all captured addresses which are not resolved yet.
+             * The mutex of data must be locked.
+             *
+             * @param known the already known frames of the captured addresses,
+             *              by their index. nullptr or missing entries are resolved
+             * @param resolveMissing whether to resolve the addresses which are not known.
+             *                       Always true with resolve_level::full
+             */
+            void resolveAll(const std::vector<const std::vector<frame> *> &known = {},
+                            bool resolveMissing = true) const;
+
+            /**
+             * Resolve the captured addresses in a range which are not resolved yet at once if a
+             * symbolizer daemon is set, so formatting them only sends one request to the daemon.
+             * Otherwise, the frames are resolved one by one while they are formatted.
+             * The mutex of data must be locked.
+             *
+             * @param first the index of the first captured address
+             * @param count the max number of captured addresses
+             */
+            void resolveForFormat(size_t first, size_t count) const;
+        };
+
+        /**
+         * The raw addresses of the stack an exception was created at. Capturing only
+         * copies the addresses into fixed storage, the frames are only resolved
+         * once getStacktrace is called, e.g. when the exception is logged.
+         */
+        class exception_trace {
+        public:
+            // The max number of captured frames
+            static constexpr size_t maxFrames = 64;
+
+            /**
+             * Capture the current stack
+             */
+            exception_trace() noexcept;
+
+            /**
+             * Get the captured stack as a stack trace. The frames are resolved once they are accessed.
+             *
+             * @param level the level of detail to resolve the frames with
+             * @return the stack trace
+             */
+            STACKTRACE_NODISCARD stacktrace getStacktrace(resolve_level level = resolve_level::function_line) const;
+
+            /**
+             * Get the captured addresses
+             *
+             * @return the addresses, the innermost frame first
+             */
+            STACKTRACE_NODISCARD void *const *getAddresses() const noexcept;
+
+            /**
+             * Get the number of captured addresses
+             *
+             * @return the number of addresses
+             */
+            STACKTRACE_NODISCARD size_t size() const noexcept;
+
+            /**
+             * Get the stack of the exception thrown last on the current thread.
+             * Only available if the library is built with STACKTRACE_INTERPOSE_CXA_THROW
+             * defined, which captures the stack of every thrown exception.
+             * Exceptions thrown while a handler runs, replace the stack.
+             *
+             * @param level the level of detail to resolve the frames with
+             * @return the stack trace or an empty trace if no exception was thrown
+             */
+            STACKTRACE_NODISCARD static stacktrace lastThrown(resolve_level level = resolve_level::function_line);
+
+        private:
+            // The captured addresses
+            void *addresses[maxFrames];
+
+            // The number of captured addresses
+            size_t count;
+        };
+
+        /**
+         * An exception of type E carrying the stack it was created at.
+         * Can be caught as E or as exception_trace:<br>
+         * <code>
+         * try {<br>
+         * &nbsp;&nbsp;&nbsp;&nbsp;throw traced_exception&lt;std::runtime_error&gt;("error");<br>
+         * } catch (const std::exception &e) {<br>
+         * &nbsp;&nbsp;&nbsp;&nbsp;const auto *trace = dynamic_cast&lt;const exception_trace *&gt;(&e);<br>
+         * &nbsp;&nbsp;&nbsp;&nbsp;if (trace) std::cerr &lt;&lt; trace->getStacktrace();<br>
+         * }
+         * </code>
+         *
+         * @tparam E the type of the exception
+         */
+        template<class E>
+        class traced_exception : public E, public exception_trace {
+        public:
+            /**
+             * Create an exception and capture the current stack
+             *
+             * @tparam Args the types of the arguments of E
+             * @param args the arguments passed to the constructor of E
+             */
+            template<class... Args>
+            explicit traced_exception(Args &&... args) : E(std::forward<Args>(args)...), exception_trace() {}
+        };
+
+        /**
+         * A table storing every unique stack trace only once. Every trace gets a small id,
+         * which is stable for the lifetime of the table. As the stored traces share their
+         * frames with all of their copies, every unique trace is also only resolved once.
+         *
+         * Looking up traces which are already in the table never locks,
+         * only adding new traces does. The number of traces is bounded,
+         * once the table is full, no new traces are added.
+         */
+        class stack_table {
+        public:
+            // The id returned if a trace could not be added as the table is full
+            static constexpr uint32_t invalidId = UINT32_MAX;
+
+            /**
+             * Create an empty table
+             *
+             * @param capacity the max number of unique traces to store
+             */
+            explicit stack_table(size_t capacity = 4096);
+
+            stack_table(const stack_table &) = delete;
+
+            stack_table &operator=(const stack_table &) = delete;
+
+            /**
+             * Get the id of a trace, add the trace if it is not in the table yet
+             *
+             * @param trace the trace to add
+             * @return the id of the trace or invalidId if the table is full
+             */
+            uint32_t intern(const stacktrace &trace);
+
+            /**
+             * Get the id of captured addresses, add them if they are not in the table yet.
+             * Does not allocate any memory if the addresses are already in the table.
+             *
+             * @param addresses the addresses, the innermost frame first
+             * @param count the number of addresses
+             * @param level the level of detail to resolve the frames with
+             * @return the id of the addresses or invalidId if the table is full
+             */
+            uint32_t intern(void *const *addresses, size_t count,
+                            resolve_level level = resolve_level::function_line);
+
+            /**
+             * Capture the current stack and get its id. Does not allocate
+             * any memory if the stack is already in the table.
+             *
+             * @param framesToSkip the number of frames to skip
+             * @param maxFrames the max number of frames to capture, at most 256
+             * @param level the level of detail to resolve the frames with
+             * @return the id of the stack or invalidId if the table is full
+             */
+            uint32_t capture(unsigned long framesToSkip = 0, size_t maxFrames = 128,
+                             resolve_level level = resolve_level::function_line);
+
+            /**
+             * Get a trace by its id
+             *
+             * @param id the id of the trace
+             * @return the trace, valid as long as this table exists
+             */
+            STACKTRACE_NODISCARD const stacktrace &get(uint32_t id) const;
+
+            /**
+             * Get the number of traces in this table
+             *
+             * @return the number of traces
+             */
+            STACKTRACE_NODISCARD size_t size() const noexcept;
+
+            /**
+             * Get the max number of traces in this table
+             *
+             * @return the capacity
+             */
+            STACKTRACE_NODISCARD size_t capacity() const noexcept;
+
+            /**
+             * The stack_table destructor
+             */
+            ~stack_table() noexcept;
+
+        private:
+            /**
+             * Find addresses in the table
+             *
+             * @param hash the hash of the addresses
+             * @param addresses the addresses to search for
+             * @param count the number of addresses
+             * @param level the resolve level of the trace
+             * @param slot set to the slot of the trace or the first empty slot
+             * @return the id of the trace or invalidId if it is not in the table
+             */
+            uint32_t find(size_t hash, void *const *addresses, size_t count, resolve_level level,
+                          size_t &slot) const noexcept;
+
+            // The max number of traces
+            size_t maxTraces;
+
+            // The number of slots minus one, the number of slots is a power of two
+            size_t mask;
+
+            // The id of the trace in every slot plus one, 0 if the slot is empty
+            std::unique_ptr<std::atomic<uint32_t>[]> slots;
+
+            // The traces by their id. Filled before the id is published in slots.
+            std::unique_ptr<std::unique_ptr<const stacktrace>[]> traces;
+
+            // The number of traces
+            std::atomic<size_t> numTraces;
+
+            // A mutex guarding the insertion of new traces
+            std::mutex mtx;
+        };
+
+        /**
+         * A unique stack trace and the number of times it was recorded
+         */
+        struct stack_count {
+            // The stack trace
+            stacktrace trace;
+
+            // The number of times the trace was recorded
+            size_t count;
+        };
+
+        /**
+         * Counts how often every unique stack is recorded, e.g. to find the call paths
+         * hitting an error most often. Every thread records into its own buffer, the
+         * buffers are only merged once a report is created. Stacks are only
+         * resolved once they are reported.
+         */
+        class stack_aggregator {
+        public:
+            /**
+             * Create an empty aggregator
+             *
+             * @param capacity the max number of unique stacks to count
+             * @param level the level of detail to resolve the reported stacks with
+             */
+            explicit stack_aggregator(size_t capacity = 4096,
+                                      resolve_level level = resolve_level::function_line);
+
+            stack_aggregator(const stack_aggregator &) = delete;
+
+            stack_aggregator &operator=(const stack_aggregator &) = delete;
+
+            /**
+             * Record the current stack. Does not allocate any memory
+             * once the stack was recorded by this thread before.
+             *
+             * @param framesToSkip the number of frames to skip
+             * @param maxFrames the max number of frames to capture, at most 256
+             */
+            void record(unsigned long framesToSkip = 0, size_t maxFrames = 128);
+
+            /**
+             * Record an already captured trace
+             *
+             * @param trace the trace to record
+             */
+            void record(const stacktrace &trace);
+
+            /**
+             * Record already captured addresses. Does not allocate any memory
+             * once the addresses were recorded by this thread before.
+             *
+             * @param addresses the addresses, the innermost frame first
+             * @param size the number of addresses
+             */
+            void record(void *const *addresses, size_t size);
+
+            /**
+             * Get the most often recorded stacks, the most often recorded one first.
+             * Resolves all returned stacks at once.
+             *
+             * @param n the max number of stacks to return
+             * @return the most often recorded stacks
+             */
+            STACKTRACE_NODISCARD std::vector<stack_count> top(size_t n);
+
+            /**
+             * Get the number of recorded stacks
+             *
+             * @return the number of recorded stacks, including dropped ones
+             */
+            STACKTRACE_NODISCARD size_t total();
+
+            /**
+             * Get the number of recorded stacks which were not counted,
+             * as the max number of unique stacks was reached
+             *
+             * @return the number of dropped stacks
+             */
+            STACKTRACE_NODISCARD size_t dropped() const noexcept;
+
+            /**
+             * Write all stacks in the folded format used by flame graph tools.
+             * Every line contains the function names from the outermost frame down,
+             * separated by semicolons, followed by the count. The stacks are written
+             * one by one, without formatting all of them first. Stacks with the same function
+             * names but different addresses are written on separate lines, which flame graph tools add up.
+             *
+             * @param write the function to write the stacks to
+             * @param ctx the context passed to write
+             */
+            void writeFolded(frame_writer write, void *ctx);
+
+            /**
+             * Write all stacks in the folded format to a stream
+             *
+             * @param os the stream to write to
+             * @return the stream
+             */
+            std::ostream &writeFolded(std::ostream &os);
+
+            /**
+             * Write all stacks in the pprof profile.proto format, uncompressed.
+             * Every function and location is only written once.
+             *
+             * @param write the function to write the profile to
+             * @param ctx the context passed to write
+             */
+            void writePprof(frame_writer write, void *ctx);
+
+            /**
+             * Write all stacks in the pprof profile.proto format to a stream
+             *
+             * @param os the stream to write to, should be opened in binary mode
+             * @return the stream
+             */
+            std::ostream &writePprof(std::ostream &os);
+
+            /**
+             * Reset all counts. The unique stacks are kept.
+             */
+            void clear();
+
+            /**
+             * The stack_aggregator destructor
+             */
+            ~stack_aggregator() noexcept;
+
+        private:
+            // The counts recorded by a single thread
+            struct thread_buffer;
+
+            /**
+             * Get the buffer of the current thread, create it if needed
+             *
+             * @return the buffer of the current thread
+             */
+            thread_buffer &localBuffer();
+
+            /**
+             * Count a stack in the buffer of the current thread
+             *
+             * @param stackId the id of the stack or stack_table::invalidId
+             */
+            void count(uint32_t stackId);
+
+            /**
+             * Move the counts of all thread buffers into counts. mtx must be locked.
+             */
+            void merge();
+
+            // The unique stacks
+            stack_table table;
+
+            // The level of detail to resolve the reported stacks with
+            resolve_level level;
+
+            // A unique id of this aggregator, used to find the thread buffers
+            uint64_t id;
+
+            // The buffers of all threads which recorded a stack
+            std::vector<std::shared_ptr<thread_buffer>> buffers;
+
+            // The merged counts of every stack by its id
+            std::unordered_map<uint32_t, size_t> counts;
+
+            // The number of dropped stacks
+            std::atomic<size_t> droppedCount;
+
+            // A mutex guarding buffers and counts
+            std::mutex mtx;
+        };
+
+        /**
+         * A node of a call_tree
+         */
+        struct call_tree_node {
+            // The address of the frame, nullptr for the root
+            const void *address;
+
+            // The index of the parent node, call_tree::npos for the root
+            size_t parent;
+
+            // The index of the first child or call_tree::npos if there are no children
+            size_t firstChild;
+
+            // The index of the next child of the parent or call_tree::npos
+            size_t nextSibling;
+
+            // The number of traces going through this node
+            size_t inclusive;
+
+            // The number of traces ending in this node
+            size_t exclusive;
+        };
+
+        /**
+         * Merges many traces into a tree of calls, the outermost frames at the root.
+         * Traces with a common prefix share their nodes, so a call tree uses much less
+         * memory than the traces it is created from. Every address is only resolved once,
+         * no matter how many nodes it is in. Not thread safe.
+         */
+        class call_tree {
+        public:
+            // The index used for missing nodes
+            static constexpr size_t npos = SIZE_MAX;
+
+            /**
+             * Create an empty call tree with only a root node
+             *
+             * @param level the level of detail to resolve the addresses with
+             */
+            explicit call_tree(resolve_level level = resolve_level::function);
+
+            /**
+             * Insert a trace into the tree. Does not resolve the trace.
+             *
+             * @param trace the trace to insert
+             * @param count the number of times the trace was recorded
+             */
+            void insert(const stacktrace &trace, size_t count = 1);
+
+            /**
+             * Insert captured addresses into the tree
+             *
+             * @param addresses the addresses, the innermost frame first
+             * @param size the number of addresses
+             * @param count the number of times the addresses were recorded
+             */
+            void insert(void *const *addresses, size_t size, size_t count = 1);
+
+            /**
+             * Get all nodes, the root node is at index 0
+             *
+             * @return the nodes
+             */
+            STACKTRACE_NODISCARD const std::vector<call_tree_node> &getNodes() const noexcept;
+
+            /**
+             * Get the frames of a node. With resolve_level::full, the inlined frames come first.
+             * Resolves all nodes which are not resolved yet.
+             *
+             * @param node the index of the node
+             * @return the first frame of the node and the end of its frames
+             */
+            std::pair<const frame *, const frame *> getFrames(size_t node);
+
+            /**
+             * Resolve the addresses of all nodes which are not resolved yet at once
+             */
+            void resolve();
+
+            /**
+             * Write the tree in the folded format used by flame graph tools.
+             * Every line contains the function names from the root down,
+             * separated by semicolons, followed by the exclusive count.
+             *
+             * @param write the function to write the tree to
+             * @param ctx the context passed to write
+             */
+            void writeFolded(frame_writer write, void *ctx);
+
+            /**
+             * Convert the tree to the folded format
+             *
+             * @return the folded tree
+             */
+            STACKTRACE_NODISCARD std::string toFolded();
+
+            /**
+             * Write the difference of two trees in the folded format used by differential
+             * flame graph tools. Every line contains the function names from the root down,
+             * followed by the exclusive counts in before and after.
+             * Paths are compared by their function names, so trees from different processes can be compared.
+             *
+             * @param before the first tree
+             * @param after the second tree
+             * @param write the function to write the difference to
+             * @param ctx the context passed to write
+             */
+            static void writeFoldedDiff(call_tree &before, call_tree &after, frame_writer write, void *ctx);
+
+            /**
+             * Get the number of nodes, including the root
+             *
+             * @return the number of nodes
+             */
+            STACKTRACE_NODISCARD size_t size() const noexcept;
+
+        private:
+            /**
+             * Call a function with the folded path and the exclusive count
+             * of every node with an exclusive count greater than 0
+             *
+             * @param fn the function to call
+             */
+            void forEachPath(const std::function<void(const std::string &, size_t)> &fn);
+
+            // The level of detail to resolve the addresses with
+            resolve_level level;
+
+            // All nodes, the root first
+            std::vector<call_tree_node> nodes;
+
+            // The number of nodes which are resolved. Nodes are only
+            // ever added, so all nodes before this index are resolved.
+            size_t resolvedNodes;
+
+            // The frames of all resolved addresses
+            std::vector<frame> frames;
+
+            // The index of the first frame of every resolved address and the number of frames
+            std::unordered_map<const void *, std::pair<size_t, size_t>> addressFrames;
+        };
+
+        /**
+         * Options of a contention_profiler
+         */
+        struct contention_options {
+            // Waits taking at least this many nanoseconds are always recorded
+            uint64_t threshold = 1000000;
+
+            // One of this many shorter waits is recorded, 0 to only record waits over the threshold
+            size_t sampleRate = 100;
+
+            // The max number of frames of a recorded wait, at most 256
+            size_t maxFrames = 32;
+
+            // The max number of unique waiting stacks
+            size_t maxStacks = 4096;
+
+            // The level of detail to resolve the reported stacks with
+            resolve_level level = resolve_level::function_line;
+        };
+
+        /**
+         * The time spent waiting for a lock at a stack.
+         * Sampled waits count for the number of waits they represent.
+         */
+        struct contention_stats {
+            // The stack which waited for the lock
+            stacktrace trace;
+
+            // The id of the lock
+            uint32_t lock;
+
+            // The name of the lock
+            std::string name;
+
+            // The estimated number of waits
+            size_t waits;
+
+            // The estimated time spent waiting in nanoseconds
+            uint64_t totalWait;
+
+            // The longest recorded wait in nanoseconds
+            uint64_t maxWait;
+        };
+
+        /**
+         * A lock contention profiler. Records the stacks of threads waiting for a
+         * traced_mutex or traced_shared_mutex, keyed by the stack and the id of the lock.
+         * Waits taking longer than the threshold are always recorded, shorter waits
+         * are sampled. Locks which are acquired without waiting are never recorded.
+         *
+         * Only one profiler may run at a time.
+         */
+        class contention_profiler {
+        public:
+            /**
+             * Create a profiler. Does not start profiling.
+             *
+             * @param options the options of the profiler
+             */
+            explicit contention_profiler(const contention_options &options = contention_options());
+
+            contention_profiler(const contention_profiler &) = delete;
+
+            contention_profiler &operator=(const contention_profiler &) = delete;
+
+            /**
+             * Start profiling. Throws a std::runtime_error if another profiler is running.
+             */
+            void start();
+
+            /**
+             * Stop profiling
+             */
+            void stop();
+
+            /**
+             * Check if the profiler is running
+             *
+             * @return true, if the profiler is running
+             */
+            STACKTRACE_NODISCARD bool isRunning() const noexcept;
+
+            /**
+             * Get the stacks which waited the longest in total, the longest first.
+             * Resolves all returned stacks at once.
+             *
+             * @param n the max number of stacks to return
+             * @return the stacks with the most time spent waiting
+             */
+            STACKTRACE_NODISCARD std::vector<contention_stats> top(size_t n);
+
+            /**
+             * Write a report of the stacks which waited the longest in total
+             *
+             * @param out the stream to write to
+             * @param n the max number of stacks to write
+             */
+            void writeReport(std::ostream &out, size_t n = 10);
+
+            /**
+             * Get the number of waits which were dropped as the max number of unique stacks was reached
+             *
+             * @return the number of dropped waits
+             */
+            STACKTRACE_NODISCARD size_t dropped() const noexcept;
+
+            /**
+             * Get a new unique lock id
+             *
+             * @return the lock id
+             */
+            STACKTRACE_NODISCARD static uint32_t newLockId() noexcept;
+
+            /**
+             * Tell the running profiler about a thread which waited for a lock. Records the stack
+             * of the caller if the wait took longer than the threshold or is sampled.
+             * Does nothing if no profiler is running.
+             *
+             * @param lock the id of the lock, created using newLockId
+             * @param name the name of the lock
+             * @param nanos the time the thread waited in nanoseconds
+             */
+            static void onWait(uint32_t lock, std::string_view name, uint64_t nanos) noexcept;
+
+            /**
+             * The contention_profiler destructor. Stops the profiler.
+             */
+            ~contention_profiler() noexcept;
+
+        private:
+            friend class traced_mutex;
+
+            friend class traced_shared_mutex;
+
+            // The time spent waiting at a stack for a lock
+            struct wait_usage {
+                // The estimated number of waits
+                size_t waits = 0;
+
+                // The estimated time spent waiting in nanoseconds
+                uint64_t totalWait = 0;
+
+                // The longest recorded wait in nanoseconds
+                uint64_t maxWait = 0;
+            };
+
+            /**
+             * Check if a wait should be recorded and record it with the running profiler
+             *
+             * @param lock the id of the lock
+             * @param name the name of the lock
+             * @param nanos the time the thread waited in nanoseconds
+             * @param caller the address of the function which waited
+             */
+            static void waited(uint32_t lock, std::string_view name, uint64_t nanos, const void *caller) noexcept;
+
+            /**
+             * Record a wait
+             *
+             * @param lock the id of the lock
+             * @param name the name of the lock
+             * @param nanos the time the wait represents in nanoseconds
+             * @param waits the number of waits the wait represents
+             * @param caller the address of the function which waited
+             */
+            void record(uint32_t lock, std::string_view name, uint64_t nanos, size_t waits, const void *caller);
+
+            // The options of the profiler
+            contention_options options;
+
+            // The unique waiting stacks
+            stack_table table;
+
+            // The wait times by the id of the lock in the upper and the id of the stack in the lower 32 bits
+            std::unordered_map<uint64_t, wait_usage> usage;
+
+            // The names of the recorded locks by their id
+            std::unordered_map<uint32_t, std::string> names;
+
+            // The number of dropped waits
+            std::atomic<size_t> droppedWaits;
+
+            // Whether the profiler is running
+            std::atomic<bool> running;
+
+            // A mutex guarding usage and names
+            std::mutex mtx;
+        };
+
+        /**
+         * A std::mutex which reports the time threads waited for it to the running contention_profiler
+         */
+        class traced_mutex {
+        public:
+            /**
+             * Create a traced mutex
+             *
+             * @param name the name of the mutex shown in reports
+             */
+            explicit traced_mutex(std::string name = "");
+
+            traced_mutex(const traced_mutex &) = delete;
+
+            traced_mutex &operator=(const traced_mutex &) = delete;
+
+            /**
+             * Lock the mutex. Measures the time waited if the mutex is locked and a profiler is running.
+             */
+            void lock();
+
+            /**
+             * Try to lock the mutex
+             *
+             * @return true, if the mutex was locked
+             */
+            bool try_lock();
+
+            /**
+             * Unlock the mutex
+             */
+            void unlock();
+
+            /**
+             * Get the id of the mutex
+             *
+             * @return the lock id
+             */
+            STACKTRACE_NODISCARD uint32_t getId() const noexcept;
+
+        private:
+            // The actual mutex
+            std::mutex mtx;
+
+            // The lock id
+            uint32_t id;
+
+            // The name of the mutex
+            std::string name;
+        };
+
+        /**
+         * A std::shared_mutex which reports the time threads waited for it to the running contention_profiler.
+         * Exclusive and shared waits are recorded under the same lock id.
+         */
+        class traced_shared_mutex {
+        public:
+            /**
+             * Create a traced shared mutex
+             *
+             * @param name the name of the mutex shown in reports
+             */
+            explicit traced_shared_mutex(std::string name = "");
+
+            traced_shared_mutex(const traced_shared_mutex &) = delete;
+
+            traced_shared_mutex &operator=(const traced_shared_mutex &) = delete;
+
+            /**
+             * Lock the mutex exclusively. Measures the time waited
+             * if the mutex is locked and a profiler is running.
+             */
+            void lock();
+
+            /**
+             * Try to lock the mutex exclusively
+             *
+             * @return true, if the mutex was locked
+             */
+            bool try_lock();
+
+            /**
+             * Unlock the exclusively locked mutex
+             */
+            void unlock();
+
+            /**
+             * Lock the mutex shared. Measures the time waited
+             * if the mutex is locked exclusively and a profiler is running.
+             */
+            void lock_shared();
+
+            /**
+             * Try to lock the mutex shared
+             *
+             * @return true, if the mutex was locked
+             */
+            bool try_lock_shared();
+
+            /**
+             * Unlock the shared locked mutex
+             */
+            void unlock_shared();
+
+            /**
+             * Get the id of the mutex
+             *
+             * @return the lock id
+             */
+            STACKTRACE_NODISCARD uint32_t getId() const noexcept;
+
+        private:
+            // The actual mutex
+            std::shared_mutex mtx;
+
+            // The lock id
+            uint32_t id;
+
+            // The name of the mutex
+            std::string name;
+        };
+
+#if defined(STACKTRACE_UNIX) && !defined(__APPLE__)
+
+        /**
+         * Options of a sampling_profiler
+         */
+        struct profiler_options {
+            // The number of samples per second of cpu time used by a thread
+            size_t frequency = 100;
+
+            // The max number of frames of a sample, at most 256
+            size_t maxFrames = 64;
+
+            // The number of samples buffered per thread until they are collected.
+            // Samples are dropped if a buffer is full.
+            size_t bufferSize = 1024;
+
+            // The interval the buffers are collected in, in milliseconds
+            size_t collectInterval = 100;
+
+            // The max number of unique stacks to count
+            size_t maxStacks = 4096;
+
+            // The level of detail to resolve the reported stacks with
+            resolve_level level = resolve_level::function;
+        };
+
+        /**
+         * A sampling profiler. Every profiled thread gets a timer measuring its cpu time,
+         * which sends SIGPROF to the thread at the configured frequency. The signal handler
+         * captures the stack into a buffer of the thread without allocating or locking.
+         * A collector thread moves the samples from the buffers into a stack_aggregator.
+         *
+         * Only one profiler may run at a time, as the SIGPROF handler is process wide.
+         * Only available on linux.
+         */
+        class sampling_profiler {
+        public:
+            /**
+             * Create a profiler. Does not start profiling.
+             *
+             * @param options the options of the profiler
+             */
+            explicit sampling_profiler(const profiler_options &options = profiler_options());
+
+            sampling_profiler(const sampling_profiler &) = delete;
+
+            sampling_profiler &operator=(const sampling_profiler &) = delete;
+
+            /**
+             * Start profiling the calling thread. Other threads must be added using addThread.
+             * Throws a std::runtime_error if another profiler is running or the timer
+             * or signal handler could not be created.
+             */
+            void start();
+
+            /**
+             * Stop profiling all threads and collect the remaining samples
+             */
+            void stop();
+
+            /**
+             * Start profiling the calling thread. The profiler must be running.
+             * Does nothing if the thread is profiled already.
+             */
+            void addThread();
+
+            /**
+             * Stop profiling the calling thread
+             */
+            void removeThread();
+
+            /**
+             * Check if the profiler is running
+             *
+             * @return true, if the profiler is running
+             */
+            STACKTRACE_NODISCARD bool isRunning() const noexcept;
+
+            /**
+             * Move all buffered samples into the aggregator now
+             */
+            void collect();
+
+            /**
+             * Get the stacks with the most samples, the one with the most samples first.
+             * Collects all buffered samples first.
+             *
+             * @param n the max number of stacks to return
+             * @return the stacks with the most samples
+             */
+            STACKTRACE_NODISCARD std::vector<stack_count> top(size_t n);
+
+            /**
+             * Get the number of samples, collects all buffered samples first
+             *
+             * @return the number of samples, including dropped ones
+             */
+            STACKTRACE_NODISCARD size_t samples();
+
+            /**
+             * Write all samples in the folded format used by flame graph tools.
+             * Collects all buffered samples first.
+             *
+             * @param write the function to write the samples to
+             * @param ctx the context passed to write
+             */
+            void writeFolded(frame_writer write, void *ctx);
+
+            /**
+             * Write all samples in the folded format to a stream
+             *
+             * @param os the stream to write to
+             * @return the stream
+             */
+            std::ostream &writeFolded(std::ostream &os);
+
+            /**
+             * Write all samples in the pprof profile.proto format, uncompressed.
+             * Every sample has a count and the cpu time in nanoseconds.
+             * Collects all buffered samples first.
+             *
+             * @param write the function to write the profile to
+             * @param ctx the context passed to write
+             */
+            void writePprof(frame_writer write, void *ctx);
+
+            /**
+             * Write all samples in the pprof profile.proto format to a stream
+             *
+             * @param os the stream to write to, should be opened in binary mode
+             * @return the stream
+             */
+            std::ostream &writePprof(std::ostream &os);
+
+            /**
+             * Get the number of samples which were dropped as a buffer was full
+             * or the max number of unique stacks was reached
+             *
+             * @return the number of dropped samples
+             */
+            STACKTRACE_NODISCARD size_t dropped() const;
+
+            /**
+             * The sampling_profiler destructor. Stops the profiler.
+             */
+            ~sampling_profiler() noexcept;
+
+        private:
+            // The buffer of a profiled thread
+            struct sample_ring;
+
+            /**
+             * The SIGPROF handler. The timers pass the
+             * sample_ring of their thread as the value of the signal.
+             *
+             * @param signal the signal number
+             * @param info the signal info
+             * @param context the interrupted context
+             */
+            static void onSignal(int signal, siginfo_t *info, void *context);
+
+            /**
+             * Move the samples of all buffers into the aggregator. mtx must be locked.
+             */
+            void drain();
+
+            // The options of the profiler
+            profiler_options options;
+
+            // The counts of all collected samples
+            stack_aggregator aggregator;
+
+            // The buffers of all threads which were profiled.
+            // Kept until the profiler is destroyed, as signals may still be pending.
+            std::vector<std::unique_ptr<sample_ring>> rings;
+
+            // The thread collecting the samples
+            std::thread collector;
+
+            // Notified when the profiler is stopped
+            std::condition_variable stopped;
+
+            // Whether the profiler is running
+            std::atomic<bool> running;
+
+            // A mutex guarding rings and the draining of the rings
+            mutable std::mutex mtx;
+        };
+
+        /**
+         * Options of an allocation_profiler
+         */
+        struct allocation_options {
+            // The mean number of bytes allocated between two samples
+            size_t sampleInterval = 512 * 1024;
+
+            // The max number of frames of a sample, at most 256
+            size_t maxFrames = 64;
+
+            // The max number of unique allocation stacks
+            size_t maxStacks = 4096;
+
+            // The level of detail to resolve the reported stacks with
+            resolve_level level = resolve_level::function;
+        };
+
+        /**
+         * The estimated memory usage of an allocation stack.
+         * Every sample counts for the number of bytes it represents.
+         */
+        struct allocation_stats {
+            // The stack the memory was allocated at
+            stacktrace trace;
+
+            // The estimated number of bytes which are still allocated
+            size_t liveBytes;
+
+            // The estimated number of allocations which were not freed yet
+            size_t liveAllocations;
+
+            // The estimated number of bytes allocated in total
+            size_t totalBytes;
+
+            // The estimated number of allocations in total
+            size_t totalAllocations;
+        };
+
+        /**
+         * A sampling heap profiler. Records the stack of about one allocation per
+         * sampleInterval bytes and tracks which of the sampled allocations are still alive.
+         *
+         * The allocations must be passed to onAllocation and onFree. If the library is built
+         * with STACKTRACE_INTERPOSE_MALLOC defined, malloc, calloc, realloc and free, and with
+         * them operator new and delete, are replaced to do this. Allocations which are not
+         * sampled only decrement a thread local counter.
+         *
+         * Only one profiler may run at a time. Only available on linux.
+         */
+        class allocation_profiler {
+        public:
+            /**
+             * Create a profiler. Does not start profiling.
+             *
+             * @param options the options of the profiler
+             */
+            explicit allocation_profiler(const allocation_options &options = allocation_options());
+
+            allocation_profiler(const allocation_profiler &) = delete;
+
+            allocation_profiler &operator=(const allocation_profiler &) = delete;
+
+            /**
+             * Start profiling. Throws a std::runtime_error if another profiler is running.
+             */
+            void start();
+
+            /**
+             * Stop profiling. Sampled allocations freed
+             * after the profiler was stopped are not tracked.
+             */
+            void stop();
+
+            /**
+             * Check if the profiler is running
+             *
+             * @return true, if the profiler is running
+             */
+            STACKTRACE_NODISCARD bool isRunning() const noexcept;
+
+            /**
+             * Get the stacks with the most live bytes, the one with the most bytes first.
+             * Resolves all returned stacks at once.
+             *
+             * @param n the max number of stacks to return
+             * @return the stacks with the most live bytes
+             */
+            STACKTRACE_NODISCARD std::vector<allocation_stats> top(size_t n);
+
+            /**
+             * Get the number of samples which were dropped as the max number of unique stacks was reached
+             *
+             * @return the number of dropped samples
+             */
+            STACKTRACE_NODISCARD size_t dropped() const noexcept;
+
+            /**
+             * Tell the running profiler about an allocation. Does nothing if no profiler is running.
+             * Must be called after the memory was allocated.
+             *
+             * @param ptr the allocated memory
+             * @param size the number of bytes allocated
+             */
+            static void onAllocation(void *ptr, size_t size) noexcept;
+
+            /**
+             * Tell the running profiler about memory being freed.
+             * Must be called before the memory is freed.
+             *
+             * @param ptr the memory which is freed
+             */
+            static void onFree(void *ptr) noexcept;
+
+            /**
+             * The allocation_profiler destructor. Stops the profiler.
+             */
+            ~allocation_profiler() noexcept;
+
+        private:
+            // The usage of a stack
+            struct stack_usage {
+                // The estimated number of bytes which are still allocated
+                size_t liveBytes = 0;
+
+                // The estimated number of allocations which were not freed yet
+                size_t liveAllocations = 0;
+
+                // The estimated number of bytes allocated in total
+                size_t totalBytes = 0;
+
+                // The estimated number of allocations in total
+                size_t totalAllocations = 0;
+            };
+
+            // A live sampled allocation
+            struct sampled_allocation {
+                // The id of the allocation stack
+                uint32_t stack;
+
+                // The estimated number of bytes the sample represents
+                size_t bytes;
+
+                // The estimated number of allocations the sample represents
+                size_t allocations;
+            };
+
+            /**
+             * Record a sampled allocation
+             *
+             * @param ptr the allocated memory
+             * @param size the number of bytes allocated
+             * @param caller the address onAllocation was called from
+             */
+            void record(void *ptr, size_t size, const void *caller);
+
+            /**
+             * Remove a sampled allocation
+             *
+             * @param ptr the freed memory
+             */
+            void release(void *ptr);
+
+            // The options of the profiler
+            allocation_options options;
+
+            // The unique allocation stacks
+            stack_table table;
+
+            // The usage of every stack by its id
+            std::vector<stack_usage> usage;
+
+            // All live sampled allocations by their address
+            std::unordered_map<const void *, sampled_allocation> live;
+
+            // The number of dropped samples
+            std::atomic<size_t> droppedSamples;
+
+            // Whether the profiler is running
+            std::atomic<bool> running;
+
+            // A mutex guarding usage and live
+            std::mutex mtx;
+        };
+
+        /**
+         * Options of a watchdog
+         */
+        struct watchdog_options {
+            // The interval the deadlines are checked at in milliseconds
+            size_t checkInterval = 10;
+
+            // The max number of frames of a stalled thread, at most 256
+            size_t maxFrames = 64;
+
+            // The signal sent to stalled threads to capture their stack
+            int signal = SIGUSR2;
+
+            // The max time to wait for a stalled thread to capture its stack in milliseconds
+            size_t captureTimeout = 100;
+
+            // The level of detail to resolve the stacks of stalled threads with
+            resolve_level level = resolve_level::function_line;
+        };
+
+        /**
+         * A thread which exceeded its deadline
+         */
+        struct stall_report {
+            // The stack of the thread when the deadline was exceeded,
+            // empty if the thread did not capture it in time
+            stacktrace trace;
+
+            // The name of the thread
+            std::string name;
+
+            // The id of the thread
+            pid_t thread;
+
+            // The milliseconds passed since the deadline when the stack was captured
+            uint64_t overrun;
+        };
+
+        /**
+         * A thread registered with a watchdog. The storage for the
+         * stack of the thread is allocated when it is registered.
+         */
+        class watched_thread {
+        public:
+            watched_thread(const watched_thread &) = delete;
+
+            watched_thread &operator=(const watched_thread &) = delete;
+
+            /**
+             * Set the deadline of the thread. If the thread is still armed once it passed,
+             * its stack is captured and reported. Every deadline is reported once.
+             * The time is read from the coarse monotonic clock, so the deadline may be up to one
+             * clock tick late. Deadlines are checked every checkInterval milliseconds.
+             *
+             * @param timeout the milliseconds from now until the deadline
+             */
+            void arm(uint64_t timeout) noexcept;
+
+            /**
+             * Remove the deadline of the thread
+             */
+            void disarm() noexcept;
+
+            /**
+             * Get the name of the thread
+             *
+             * @return the name
+             */
+            STACKTRACE_NODISCARD const std::string &getName() const noexcept;
+
+            /**
+             * Get the id of the thread
+             *
+             * @return the thread id
+             */
+            STACKTRACE_NODISCARD pid_t getThreadId() const noexcept;
+
+        private:
+            friend class watchdog;
+
+            /**
+             * Create a watched thread
+             *
+             * @param name the name of the thread
+             * @param thread the id of the thread
+             * @param maxFrames the max number of frames to capture
+             */
+            watched_thread(std::string name, pid_t thread, size_t maxFrames);
+
+            // The deadline in nanoseconds of the steady clock, 0 if disarmed
+            std::atomic<uint64_t> deadline;
+
+            // The last deadline which was reported. Only used by the watchdog thread.
+            uint64_t reported;
+
+            // The captured frames
+            std::unique_ptr<void *[]> frames;
+
+            // The max number of frames to capture
+            size_t maxFrames;
+
+            // The number of captured frames
+            size_t size;
+
+            // Whether a capture is idle, requested, running or done
+            std::atomic<int> state;
+
+            // The id of the thread
+            pid_t thread;
+
+            // The name of the thread
+            std::string name;
+        };
+
+        /**
+         * A watchdog reporting the stacks of threads which exceed their deadline.
+         * Threads register themselves using addThread and arm the returned
+         * watched_thread with a deadline, e.g. for every request they handle.
+         * Arming and disarming only stores the deadline.
+         *
+         * A thread checks the deadlines every checkInterval milliseconds. A thread
+         * which exceeded its deadline is sent a signal, the signal handler captures
+         * the raw stack of the thread into the storage of its watched_thread.
+         * The watchdog thread then resolves the stack and calls the stall handler.
+         *
+         * Only one watchdog may run at a time. Only available on linux.
+         */
+        class watchdog {
+        public:
+            // The function called with every stalled thread
+            using stall_handler = std::function<void(const stall_report &)>;
+
+            /**
+             * Create a watchdog. Does not start watching.
+             *
+             * @param options the options of the watchdog
+             * @param handler the function called with every stalled thread,
+             *                writes the stalled threads to std::cerr if empty
+             */
+            explicit watchdog(const watchdog_options &options = watchdog_options(), stall_handler handler = nullptr);
+
+            watchdog(const watchdog &) = delete;
+
+            watchdog &operator=(const watchdog &) = delete;
+
+            /**
+             * Start checking the deadlines. Throws a std::runtime_error if another
+             * watchdog is running or the signal handler could not be installed.
+             */
+            void start();
+
+            /**
+             * Stop checking the deadlines
+             */
+            void stop();
+
+            /**
+             * Register the calling thread. The returned watched_thread
+             * stays valid until removeThread is called on the thread.
+             * Must be removed before the thread exits.
+             *
+             * @param name the name of the thread used in reports
+             * @return the watched thread, returns the existing one if the thread is registered already
+             */
+            watched_thread &addThread(const std::string &name = "");
+
+            /**
+             * Remove the calling thread
+             */
+            void removeThread();
+
+            /**
+             * Check if the watchdog is running
+             *
+             * @return true, if the watchdog is running
+             */
+            STACKTRACE_NODISCARD bool isRunning() const noexcept;
+
+            /**
+             * Get the number of stalls which were reported
+             *
+             * @return the number of stalls
+             */
+            STACKTRACE_NODISCARD size_t stalls() const noexcept;
+
+            /**
+             * The watchdog destructor. Stops the watchdog.
+             */
+            ~watchdog() noexcept;
+
+        private:
+            /**
+             * The signal handler. Captures the stack of the calling thread,
+             * if the watchdog requested it.
+             *
+             * @param signal the signal number
+             * @param info the signal info
+             * @param context the interrupted context
+             */
+            static void onSignal(int signal, siginfo_t *info, void *context);
+
+            /**
+             * Capture the stacks of all threads which exceeded their deadline. mtx must be locked.
+             *
+             * @return the reports of the stalled threads
+             */
+            std::vector<stall_report> check();
+
+            // The options of the watchdog
+            watchdog_options options;
+
+            // The function called with every stalled thread
+            stall_handler handler;
+
+            // All registered threads
+            std::vector<std::unique_ptr<watched_thread>> threads;
+
+            // The thread checking the deadlines
+            std::thread checker;
+
+            // Notified when the watchdog is stopped
+            std::condition_variable stopped;
+
+            // Whether the watchdog is running
+            std::atomic<bool> running;
+
+            // The number of reported stalls
+            std::atomic<size_t> numStalls;
+
+            // A mutex guarding threads
+            std::mutex mtx;
+        };
+
+        /**
+         * Options of a thread_dump
+         */
+        struct thread_dump_options {
+            // The signal sent to the threads to capture their stack
+            int signal = SIGUSR1;
+
+            // The max number of frames of a thread, at most 256
+            size_t maxFrames = 64;
+
+            // The max time to wait for all threads to capture their stack in milliseconds
+            size_t timeout = 200;
+
+            // The level of detail to resolve the stacks with
+            resolve_level level = resolve_level::function_line;
+        };
+
+        /**
+         * The stack of a thread in a thread_dump or process_dump
+         */
+        struct thread_stack {
+            // The id of the thread
+            pid_t thread;
+
+            // The name of the thread
+            std::string name;
+
+            // The stack of the thread, empty if it was not captured
+            stacktrace trace;
+
+            // Whether the stack was captured. Threads in a thread_dump may not capture it in time,
+            // threads in a process_dump may exit before they are stopped
+            bool captured;
+
+            // The nanoseconds the thread was interrupted to capture its stack
+            uint64_t pause;
+        };
+
+        /**
+         * The stacks of all threads of this process, like jstack. Lists the threads in
+         * /proc/self/task and sends every thread a signal. The signal handler of every
+         * thread captures its raw stack into a slot allocated before the signals are sent.
+         * The stacks of all threads are resolved at once, every unique address only once.
+         *
+         * Threads which block the signal or do not handle it within the timeout are
+         * listed without a stack. Only one dump is created at a time. Only available on linux.
+         */
+        class thread_dump {
+        public:
+            /**
+             * Capture the stacks of all threads.
+             * Throws a std::runtime_error if the threads could not be listed
+             * or the signal handler could not be installed.
+             *
+             * @param options the options of the dump
+             */
+            explicit thread_dump(const thread_dump_options &options = thread_dump_options());
+
+            /**
+             * Get the stacks of all threads, ordered by their id
+             *
+             * @return the threads
+             */
+            STACKTRACE_NODISCARD const std::vector<thread_stack> &getThreads() const noexcept;
+
+            /**
+             * Get the number of threads
+             *
+             * @return the number of threads
+             */
+            STACKTRACE_NODISCARD size_t size() const noexcept;
+
+            /**
+             * Get the longest time a thread was interrupted to capture its stack
+             *
+             * @return the longest pause in nanoseconds
+             */
+            STACKTRACE_NODISCARD uint64_t getMaxPause() const noexcept;
+
+            /**
+             * Get the time it took to capture and resolve the stacks of all threads
+             *
+             * @return the duration in nanoseconds
+             */
+            STACKTRACE_NODISCARD uint64_t getDuration() const noexcept;
+
+            /**
+             * Print the stacks of all threads to a stream
+             *
+             * @param os the stream to write to
+             * @param fullPaths whether to print the full file paths
+             * @return the stream
+             */
+            std::ostream &printTo(std::ostream &os, bool fullPaths = false) const;
+
+            /**
+             * Get the stacks of all threads as a string
+             *
+             * @param fullPaths whether to print the full file paths
+             * @return the stacks of all threads
+             */
+            STACKTRACE_NODISCARD std::string toString(bool fullPaths = false) const;
+
+            // Operator<< for streams
+            friend inline std::ostream &operator<<(std::ostream &os, const thread_dump &dump) {
+                return dump.printTo(os);
+            }
+
+        private:
+            // The stacks of all threads
+            std::vector<thread_stack> threads;
+
+            // The time it took to create the dump in nanoseconds
+            uint64_t duration;
+        };
+
+        /**
+         * Options of a process_dump
+         */
+        struct process_dump_options {
+            // The max number of frames of a thread
+            size_t maxFrames = 64;
+
+            // The max number of bytes of the stack of every thread copied while the process is stopped
+            size_t stackSize = 256 * 1024;
+
+            // The level of detail to resolve the stacks with
+            resolve_level level = resolve_level::function_line;
+        };
+
+        /**
+         * The stacks of all threads of another process, like pstack. The process does not have to use
+         * this library. Every thread in /proc/PID/task is stopped using ptrace, its registers are read and
+         * the top of its stack is copied using process_vm_readv. The threads are detached right after,
+         * so the process is only stopped while copying. The copied stacks are unwound afterwards using
+         * the .eh_frame tables of the modules, which are read from the memory of the process once per
+         * module, or using frame pointers in functions without unwind tables.
+         *
+         * The modules are found using /proc/PID/maps and resolved using their files or their debug files
+         * in /usr/lib/debug/.build-id. Modules with the same build id loaded into this process are resolved
+         * like any stack trace. Requires permission to ptrace the process.
+         * Only available on linux on x86_64 and aarch64.
+         */
+        class process_dump {
+        public:
+            /**
+             * Capture the stacks of all threads of a process.
+             * Throws a std::runtime_error if the process could not be stopped.
+             *
+             * @param pid the id of the process
+             * @param options the options of the dump
+             */
+            explicit process_dump(pid_t pid, const process_dump_options &options = process_dump_options());
+
+            /**
+             * Get the id of the process
+             *
+             * @return the process id
+             */
+            STACKTRACE_NODISCARD pid_t getPid() const noexcept;
+
+            /**
+             * Get the stacks of all threads, ordered by their id
+             *
+             * @return the threads
+             */
+            STACKTRACE_NODISCARD const std::vector<thread_stack> &getThreads() const noexcept;
+
+            /**
+             * Get the number of threads
+             *
+             * @return the number of threads
+             */
+            STACKTRACE_NODISCARD size_t size() const noexcept;
+
+            /**
+             * Get the time the process was stopped
+             *
+             * @return the pause in nanoseconds
+             */
+            STACKTRACE_NODISCARD uint64_t getPause() const noexcept;
+
+            /**
+             * Get the time it took to capture, unwind and resolve the stacks of all threads
+             *
+             * @return the duration in nanoseconds
+             */
+            STACKTRACE_NODISCARD uint64_t getDuration() const noexcept;
+
+            /**
+             * Print the stacks of all threads to a stream
+             *
+             * @param os the stream to write to
+             * @param fullPaths whether to print the full file paths
+             * @return the stream
+             */
+            std::ostream &printTo(std::ostream &os, bool fullPaths = false) const;
+
+            /**
+             * Get the stacks of all threads as a string
+             *
+             * @param fullPaths whether to print the full file paths
+             * @return the stacks of all threads
+             */
+            STACKTRACE_NODISCARD std::string toString(bool fullPaths = false) const;
+
+            // Operator<< for streams
+            friend inline std::ostream &operator<<(std::ostream &os, const process_dump &dump) {
+                return dump.printTo(os);
+            }
+
+        private:
+            // The id of the process
+            pid_t pid;
+
+            // The stacks of all threads
+            std::vector<thread_stack> threads;
+
+            // The time the process was stopped in nanoseconds
+            uint64_t pause;
+
+            // The time it took to create the dump in nanoseconds
+            uint64_t duration;
+        };
+
+        /**
+         * Options of a flight_recorder
+         */
+        struct flight_recorder_options {
+            // The number of records kept, older records are overwritten
+            size_t slots = 1024;
+
+            // The max number of frames of a record, at most 256
+            size_t maxFrames = 32;
+
+            // The max number of modules stored in the file
+            size_t maxModules = 256;
+        };
+
+        /**
+         * A record read from a flight recorder file
+         */
+        struct flight_record {
+            // The number of records written before this one
+            uint64_t sequence;
+
+            // The time the record was written at in nanoseconds since the epoch
+            uint64_t timestamp;
+
+            // The id of the thread which wrote the record
+            pid_t thread;
+
+            // The tag passed to record
+            uint32_t tag;
+
+            // The recorded stack
+            stacktrace trace;
+        };
+
+        /**
+         * A flight recorder keeping the last records of notable stacks in a file, so
+         * they survive a crash of the process. The file is mapped into memory using
+         * MAP_SHARED and contains a table of the loaded modules and a ring of records.
+         * Every record stores the module id and the offset in the module of every frame,
+         * so the file can be read and resolved offline using flight_recorder::read,
+         * e.g. by the stacktrace_flight_reader tool.
+         *
+         * Writing a record never locks or allocates. Every record gets its slot by
+         * incrementing a counter, so writers never wait for each other. A record which
+         * was overwritten while it was written is detected by its checksum.
+         * Only available on linux.
+         */
+        class flight_recorder {
+        public:
+            /**
+             * Create a flight recorder writing to a file. Creates or
+             * overwrites the file and stores the currently loaded modules.
+             * Throws a std::runtime_error if the file could not be created or mapped.
+             *
+             * @param path the path of the file
+             * @param options the options of the recorder
+             */
+            explicit flight_recorder(std::string path,
+                                     const flight_recorder_options &options = flight_recorder_options());
+
+            flight_recorder(const flight_recorder &) = delete;
+
+            flight_recorder &operator=(const flight_recorder &) = delete;
+
+            /**
+             * Record the stack of the caller
+             *
+             * @param tag a value stored with the record, e.g. the kind of event
+             */
+            void record(uint32_t tag = 0) noexcept;
+
+            /**
+             * Record a captured stack
+             *
+             * @param addresses the addresses of the stack
+             * @param count the number of addresses
+             * @param tag a value stored with the record, e.g. the kind of event
+             */
+            void record(void *const *addresses, size_t count, uint32_t tag = 0) noexcept;
+
+            /**
+             * Add the modules which were loaded since the recorder was created to the file.
+             * Frames in modules which are not in the file are stored as raw addresses.
+             */
+            void refreshModules();
+
+            /**
+             * Get the number of records written
+             *
+             * @return the number of records
+             */
+            STACKTRACE_NODISCARD uint64_t size() const noexcept;
+
+            /**
+             * Get the path of the file
+             *
+             * @return the path
+             */
+            STACKTRACE_NODISCARD const std::string &getPath() const noexcept;
+
+            /**
+             * The flight_recorder destructor. Unmaps the file, the file is kept.
+             */
+            ~flight_recorder() noexcept;
+
+            /**
+             * Read all complete records of a flight recorder file, the oldest first.
+             * Modules loaded into this process are resolved like any stack trace,
+             * other modules are resolved using their file if possible. Modules with
+             * another build id than recorded only get the module and the offset.
+             * Throws a std::runtime_error if the file could not be read and a
+             * std::invalid_argument if it is not a flight recorder file.
+             *
+             * @param path the path of the file
+             * @param level the level of detail to resolve the stacks with
+             * @return the records
+             */
+            static std::vector<flight_record> read(const std::string &path,
+                                                   resolve_level level = resolve_level::function_line);
+
+        private:
+            // The mapped file
+            void *mapping;
+
+            // The size of the mapped file
+            size_t mappingSize;
+
+            // The path of the file
+            std::string path;
+
+            // A mutex guarding the module table
+            std::mutex mtx;
+        };
+
+        /**
+         * Options of a symbolizer_server
+         */
+        struct symbolizer_options {
+            // The max number of clients served at the same time, more clients are rejected
+            size_t maxClients = 64;
+
+            // The max time in milliseconds to wait for a client to send or receive a message
+            size_t timeout = 5000;
+
+            // The max size of a request in bytes
+            size_t maxRequestSize = 16 * 1024 * 1024;
+
+            // The permissions of the socket. The daemon reads any file a client names,
+            // so only the user running it may connect by default
+            mode_t socketMode = 0600;
+        };
+
+        /**
+         * A symbolizer daemon resolving the stacks of other processes. Clients connect to its unix
+         * socket and send batches of module paths, build ids and offsets in the modules, which are
+         * resolved using the symbol cache of the server process. Thus, the symbol and line tables of
+         * a module are only loaded once, no matter how many clients resolve addresses in it.
+         * If a module has a build id and a file with its debug info exists in
+         * /usr/lib/debug/.build-id, the debug file is used instead of the module.
+         *
+         * Use stacktrace::setSymbolizer to resolve all stack traces of a process using a daemon.
+         * The stacktrace_symbolizer tool runs a daemon. Only available on linux.
+         */
+        class symbolizer_server {
+        public:
+            /**
+             * Create a symbolizer server. Does not start listening.
+             *
+             * @param socketPath the path of the unix socket to listen on
+             * @param options the options of the server
+             */
+            explicit symbolizer_server(std::string socketPath,
+                                       const symbolizer_options &options = symbolizer_options());
+
+            symbolizer_server(const symbolizer_server &) = delete;
+
+            symbolizer_server &operator=(const symbolizer_server &) = delete;
+
+            /**
+             * Start accepting clients in a background thread. Replaces an existing file at the socket path.
+             * Throws a std::runtime_error if the socket could not be created.
+             */
+            void start();
+
+            /**
+             * Stop accepting clients, disconnect all clients and remove the socket file
+             */
+            void stop();
+
+            /**
+             * Check if the server is running
+             *
+             * @return true, if the server is running
+             */
+            STACKTRACE_NODISCARD bool isRunning() const noexcept;
+
+            /**
+             * Get the number of requests served
+             *
+             * @return the number of requests
+             */
+            STACKTRACE_NODISCARD uint64_t requests() const noexcept;
+
+            /**
+             * Get the path of the socket
+             *
+             * @return the path
+             */
+            STACKTRACE_NODISCARD const std::string &getPath() const noexcept;
+
+            /**
+             * The symbolizer_server destructor. Stops the server.
+             */
+            ~symbolizer_server() noexcept;
+
+        private:
+            /**
+             * Accept clients until the server is stopped
+             */
+            void acceptClients();
+
+            /**
+             * Serve the requests of a client until it disconnects
+             *
+             * @param client the socket of the client
+             */
+            void serve(int client);
+
+            // The path of the socket
+            std::string path;
+
+            // The options of the server
+            symbolizer_options options;
+
+            // The listening socket or -1
+            int listener;
+
+            // Whether the server is running
+            std::atomic<bool> running;
+
+            // The number of requests served
+            std::atomic<uint64_t> numRequests;
+
+            // The thread accepting clients
+            std::thread acceptor;
+
+            // A mutex guarding clients
+            std::mutex mtx;
+
+            // Notified when a client disconnects
+            std::condition_variable disconnected;
+
+            // The sockets of the connected clients
+            std::vector<int> clients;
+        };
+
+#endif //Unix && !Apple
+    }
+}
+
+namespace std {
+    template<>
+    struct hash<markusjx::stacktrace::frame> {
+        size_t operator()(const markusjx::stacktrace::frame &f) const noexcept {
+            return f.hash();
+        }
+    };
+
+    template<>
+    struct hash<markusjx::stacktrace::stacktrace> {
+        size_t operator()(const markusjx::stacktrace::stacktrace &trace) const noexcept {
+            return trace.hash();
+        }
+    };
 }
 
 // Undef everything
@@ -0,0 +1,51 @@
+#include "stacktrace.hpp"
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+
+using namespace markusjx::stacktrace;
+
+/**
+ * Print the usage of the tool
+ *
+ * @param name the name of the executable
+ */
+static void printUsage(const char *name) {
+    std::cerr << "Usage: " << name << " <socket> [cache limit in MB]" << std::endl
+              << "Resolves the stacks of other processes sent to the unix socket, until interrupted" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    char *end = nullptr;
+    const unsigned long long limit = argc == 3 ? strtoull(argv[2], &end, 10) : 0;
+    if (argc < 2 || argc > 3 || (argc == 3 && (end == argv[2] || *end != '\0'))) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    // Block the signals before starting the server, so only sigwait receives them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try {
+        stacktrace::setCacheLimit((size_t) limit * 1024 * 1024);
+
+        symbolizer_server server(argv[1]);
+        server.start();
+        std::cerr << "Listening on " << server.getPath() << std::endl;
+
+        int received = 0;
+        sigwait(&signals, &received);
+
+        server.stop();
+        std::cerr << "Served " << server.requests() << " requests" << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,11 +1,556 @@
 #include <iostream>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <sstream>
+#include <cstdlib>
+#include <stdexcept>
 #include "test.hpp"
 #include "stacktrace.hpp"
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+#   include <csignal>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   include <sys/wait.h>
+#endif
+
 void test_1() {
     std::cout << "Call in test_1:" << std::endl << markusjx::stacktrace::stacktrace() << std::endl;
 }
 
 void test::test_2() {
     std::cout << "Call in test_2:" << std::endl << markusjx::stacktrace::stacktrace() << std::endl;
-}
\ No newline at end of file
+}
+
+void test::test_partial(int depth) {
+    if (depth > 0) {
+        test_partial(depth - 1);
+    } else {
+        std::cout << "Top 3 frames of a deep stack:" << std::endl
+                  << markusjx::stacktrace::stacktrace().toString(false, 0, 3) << std::endl;
+    }
+}
+
+void test::test_symbolize() {
+    std::vector<markusjx::stacktrace::stacktrace> traces;
+    for (int i = 0; i < 10; i++) {
+        traces.emplace_back();
+    }
+
+    markusjx::stacktrace::symbol_table table = markusjx::stacktrace::stacktrace::symbolize(traces);
+    for (markusjx::stacktrace::stacktrace &trace : traces) {
+        trace.resolveFrom(table);
+    }
+
+    std::cout << "Resolved " << table.size() << " unique addresses of " << traces.size() << " traces:" << std::endl
+              << traces.back() << std::endl;
+}
+
+void test::test_format() {
+    markusjx::stacktrace::stacktrace trace;
+    (void) trace.getFrames();
+
+    char buffer[4096];
+    size_t length = trace.formatTo(buffer, sizeof(buffer));
+
+    std::string str;
+    trace.formatTo(std::back_inserter(str));
+
+    if (length >= sizeof(buffer) || str != buffer || str != trace.toString()) {
+        throw std::runtime_error("The formatted trace is not equal to toString");
+    }
+
+    std::cout << "Formatted " << length << " characters into a buffer, equal to toString" << std::endl << std::endl;
+
+    constexpr markusjx::stacktrace::trace_format defaultFormat(
+            " {index}# {function}[ in {file}[:{line}][ (inlined){inlined}]]\n");
+    constexpr markusjx::stacktrace::trace_format customFormat("\\[{index}\\] {address} {module}: {function}[ @ {path}]\n");
+
+    if (trace.toString(defaultFormat) != trace.toString()) {
+        throw std::runtime_error("The default layout is not equal to toString");
+    }
+
+    std::cout << "Custom format, default layout equal:" << std::endl;
+    trace.printTo(std::cout, customFormat) << std::endl;
+}
+
+void test::test_serialize() {
+    markusjx::stacktrace::stacktrace trace;
+
+    std::string raw = trace.serialize();
+    std::string withSymbols = trace.serialize(true);
+
+    if (markusjx::stacktrace::stacktrace::deserialize(raw).toString() != trace.toString()) {
+        throw std::runtime_error("The deserialized trace is not equal to the original");
+    }
+
+    if (markusjx::stacktrace::stacktrace::deserialize(withSymbols).toString() != trace.toString()) {
+        throw std::runtime_error("The deserialized trace with symbols is not equal to the original");
+    }
+
+    bool rejected = false;
+    try {
+        (void) markusjx::stacktrace::stacktrace::deserialize(raw.substr(0, raw.size() - 1));
+    } catch (const std::invalid_argument &) {
+        rejected = true;
+    }
+
+    if (!rejected) throw std::runtime_error("Truncated data was not rejected");
+
+    std::cout << "Serialized " << trace.getAddresses().size() << " addresses into " << raw.size()
+              << " bytes, " << withSymbols.size() << " bytes with symbols, round trips equal" << std::endl;
+
+    trace.writeJson(std::cout) << std::endl << std::endl;
+}
+
+void test::test_copy() {
+    markusjx::stacktrace::stacktrace trace;
+    markusjx::stacktrace::stacktrace copy = trace;
+    if (&copy.getFrames() != &trace.getFrames()) throw std::runtime_error("Copies do not share their frames");
+
+    markusjx::stacktrace::stacktrace moved = std::move(copy);
+    if (moved.toString() != trace.toString()) throw std::runtime_error("The moved trace is not equal");
+    if (!copy.empty()) throw std::runtime_error("The moved from trace is not empty");
+
+    std::cout << "Copies share their frames, moved trace equal, moved from trace empty" << std::endl << std::endl;
+}
+
+void test::test_hash() {
+    std::unordered_map<markusjx::stacktrace::stacktrace, size_t> counts;
+    for (int i = 0; i < 10; i++) {
+        counts[markusjx::stacktrace::stacktrace()]++;
+        if (i % 2 == 0) counts[markusjx::stacktrace::stacktrace()]++;
+    }
+
+    std::unordered_set<markusjx::stacktrace::frame> frames;
+    for (const auto &p : counts) {
+        frames.insert(p.first.begin(), p.first.end());
+    }
+
+    std::cout << "Counted " << counts.size() << " unique traces with " << frames.size() << " unique frames:"
+              << std::endl;
+    for (const auto &p : counts) {
+        std::cout << p.second << "x" << std::endl << p.first.toString(false, 0, 2);
+    }
+
+    std::cout << std::endl;
+}
+
+void test::test_stack_table() {
+    markusjx::stacktrace::stack_table table(16);
+    std::vector<uint32_t> ids;
+    for (int i = 0; i < 10; i++) {
+        ids.push_back(table.capture());
+        if (i % 2 == 0) ids.push_back(table.intern(markusjx::stacktrace::stacktrace()));
+    }
+
+    std::cout << "Interned " << ids.size() << " traces as " << table.size() << " unique traces, ids:";
+    for (uint32_t id : ids) {
+        std::cout << " " << id;
+    }
+
+    std::cout << std::endl << table.get(ids.front()).toString(false, 0, 2) << std::endl;
+}
+
+static void record_a(markusjx::stacktrace::stack_aggregator &aggregator) {
+    aggregator.record();
+}
+
+static void record_b(markusjx::stacktrace::stack_aggregator &aggregator) {
+    aggregator.record();
+}
+
+static void record_recursive(markusjx::stacktrace::stack_aggregator &aggregator, int depth) {
+    if (depth > 0) {
+        record_recursive(aggregator, depth - 1);
+    } else {
+        aggregator.record();
+    }
+}
+
+/**
+ * Read a varint of a protobuf message
+ */
+static uint64_t read_varint(const std::string &data, size_t &pos) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; pos < data.size(); shift += 7) {
+        const auto byte = (uint8_t) data[pos++];
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) break;
+    }
+
+    return value;
+}
+
+/**
+ * Count the location ids of all samples of a pprof profile, or the ids in one packed field if nested
+ */
+static size_t count_sample_locations(const std::string &data, bool nested = false) {
+    size_t count = 0, pos = 0;
+    while (pos < data.size()) {
+        const uint64_t key = read_varint(data, pos);
+        if ((key & 7) == 0) {
+            read_varint(data, pos);
+            continue;
+        }
+
+        const std::string field = data.substr(pos, read_varint(data, pos));
+        pos += field.size();
+        if (!nested && key >> 3 == 2) {
+            count += count_sample_locations(field, true);
+        } else if (nested && key >> 3 == 1) {
+            // The location ids of a sample are packed varints
+            for (size_t i = 0; i < field.size(); i++) {
+                if (((uint8_t) field[i] & 0x80) == 0) count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+void test::test_aggregate() {
+    markusjx::stacktrace::stack_aggregator aggregator;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&aggregator] {
+            for (int j = 0; j < 100; j++) {
+                record_a(aggregator);
+                if (j % 4 == 0) record_b(aggregator);
+            }
+        });
+    }
+
+    for (std::thread &t : threads) {
+        t.join();
+    }
+
+    std::cout << "Recorded " << aggregator.total() << " stacks, top stacks:" << std::endl;
+    for (const markusjx::stacktrace::stack_count &c : aggregator.top(2)) {
+        std::cout << c.count << "x" << std::endl << c.trace.toString(false, 0, 4);
+    }
+
+    // Every captured address of a recursive stack is its own location
+    markusjx::stacktrace::stack_aggregator recursive;
+    record_recursive(recursive, 10);
+    record_recursive(recursive, 13);
+
+    size_t addresses = 0;
+    for (const markusjx::stacktrace::stack_count &c : recursive.top(2)) {
+        addresses += c.trace.getAddresses().size();
+    }
+
+    std::stringstream pprof;
+    recursive.writePprof(pprof);
+    const size_t locations = count_sample_locations(pprof.str());
+    std::cout << "Exported " << locations << " pprof locations for " << addresses << " addresses of recursive stacks"
+              << std::endl << std::endl;
+    if (locations != addresses) throw std::runtime_error("Recursive calls were merged into one pprof location");
+}
+
+static void insert_at(markusjx::stacktrace::call_tree &tree, int depth) {
+    if (depth > 0) {
+        insert_at(tree, depth - 1);
+    } else {
+        tree.insert(markusjx::stacktrace::stacktrace());
+    }
+}
+
+void test::test_call_tree() {
+    markusjx::stacktrace::call_tree before, after;
+    for (markusjx::stacktrace::call_tree *tree : {&before, &after}) {
+        for (int i = 0; i < 10; i++) {
+            insert_at(*tree, i % (tree == &before ? 3 : 4));
+        }
+    }
+
+    const markusjx::stacktrace::call_tree_node &root = before.getNodes().front();
+    std::cout << "Merged " << root.inclusive << " traces into " << before.size() << " nodes, folded:" << std::endl
+              << before.toFolded();
+
+    std::string diff;
+    markusjx::stacktrace::call_tree::writeFoldedDiff(before, after, [](void *ctx, const char *data, size_t size) {
+        static_cast<std::string *>(ctx)->append(data, size);
+    }, &diff);
+
+    std::cout << "Difference:" << std::endl << diff << std::endl;
+}
+
+static void throw_traced() {
+    throw markusjx::stacktrace::traced_exception<std::runtime_error>("traced");
+}
+
+void test::test_exception() {
+    try {
+        throw_traced();
+    } catch (const std::runtime_error &e) {
+        const auto *trace = dynamic_cast<const markusjx::stacktrace::exception_trace *>(&e);
+        std::cout << "Caught '" << e.what() << "' with " << (trace ? trace->size() : 0) << " captured frames:"
+                  << std::endl << (trace ? trace->getStacktrace().toString(false, 0, 2) : "") << std::endl;
+    }
+}
+
+static void wait_for_lock(markusjx::stacktrace::traced_mutex &mtx) {
+    std::lock_guard<markusjx::stacktrace::traced_mutex> lock(mtx);
+}
+
+void test::test_contention() {
+    markusjx::stacktrace::contention_options options;
+    options.threshold = 1000;
+
+    markusjx::stacktrace::contention_profiler profiler(options);
+    profiler.start();
+
+    markusjx::stacktrace::traced_mutex mtx("test_mutex");
+    {
+        std::unique_lock<markusjx::stacktrace::traced_mutex> lock(mtx);
+        std::thread waiter(wait_for_lock, std::ref(mtx));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        lock.unlock();
+        waiter.join();
+    }
+
+    profiler.stop();
+    for (const markusjx::stacktrace::contention_stats &s : profiler.top(1)) {
+        std::cout << "Waited " << s.totalWait / 1000000 << "ms for '" << s.name << "' in " << s.waits << " waits:"
+                  << std::endl << s.trace.toString(false, 0, 2) << std::endl;
+    }
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+static volatile double profiled_sink = 0;
+
+static void profiled_loop() {
+    for (int i = 0; i < 50000000; i++) {
+        profiled_sink = profiled_sink + i * 0.5;
+    }
+}
+
+void test::test_profiler() {
+    markusjx::stacktrace::profiler_options options;
+    options.frequency = 1000;
+
+    markusjx::stacktrace::sampling_profiler profiler(options);
+    profiler.start();
+    profiled_loop();
+    profiler.stop();
+
+    std::cout << "Profiled " << profiler.samples() << " samples (" << profiler.dropped() << " dropped), top stack:"
+              << std::endl;
+    for (const markusjx::stacktrace::stack_count &c : profiler.top(1)) {
+        std::cout << c.count << "x" << std::endl << c.trace.toString(false, 0, 3);
+    }
+
+    std::stringstream folded, pprof;
+    profiler.writeFolded(folded);
+    profiler.writePprof(pprof);
+    std::cout << "Exported " << folded.str().size() << " bytes of folded stacks and " << pprof.str().size()
+              << " bytes of pprof profile" << std::endl << std::endl;
+}
+
+static volatile double stalled_sink = 0;
+
+static void stalled_request(markusjx::stacktrace::watched_thread &watched) {
+    watched.arm(10);
+    const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    while (std::chrono::steady_clock::now() < end) {
+        for (int i = 0; i < 1000000; i++) {
+            stalled_sink = stalled_sink + 0.5;
+        }
+    }
+
+    watched.disarm();
+}
+
+void test::test_watchdog() {
+    std::mutex mtx;
+    std::vector<markusjx::stacktrace::stall_report> reports;
+    markusjx::stacktrace::watchdog dog(markusjx::stacktrace::watchdog_options(),
+                                       [&](const markusjx::stacktrace::stall_report &report) {
+                                           std::unique_lock<std::mutex> lock(mtx);
+                                           reports.push_back(report);
+                                       });
+    dog.start();
+
+    std::thread worker([&dog] {
+        stalled_request(dog.addThread("worker"));
+        dog.removeThread();
+    });
+    worker.join();
+    dog.stop();
+
+    for (const markusjx::stacktrace::stall_report &report : reports) {
+        std::cout << "Thread '" << report.name << "' stalled, " << report.overrun << "ms over its deadline:"
+                  << std::endl << report.trace.toString(false, 0, 2) << std::endl;
+    }
+}
+
+static void parked_thread(std::atomic<bool> &done) {
+    while (!done) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void test::test_thread_dump() {
+    std::atomic<bool> done(false);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < 3; i++) {
+        workers.emplace_back(parked_thread, std::ref(done));
+    }
+
+    // Let the threads park first
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    markusjx::stacktrace::thread_dump dump;
+    done = true;
+    for (std::thread &t : workers) {
+        t.join();
+    }
+
+    // SIG_IGN would be inherited by processes started later
+    struct sigaction action{};
+    sigaction(SIGUSR1, nullptr, &action);
+    if (action.sa_handler == SIG_IGN) throw std::runtime_error("The thread dump left SIGUSR1 ignored");
+
+    size_t captured = 0;
+    for (const markusjx::stacktrace::thread_stack &t : dump.getThreads()) {
+        if (t.captured) captured++;
+    }
+
+    std::cout << "Dumped " << captured << " of " << dump.size() << " threads in " << dump.getDuration() / 1000
+              << "us, the longest pause was " << dump.getMaxPause() / 1000 << "us" << std::endl
+              << dump.getThreads().back().trace.toString(false, 0, 3) << std::endl;
+}
+
+static void record_event(markusjx::stacktrace::flight_recorder &recorder, uint32_t tag) {
+    recorder.record(tag);
+}
+
+void test::test_flight_recorder() {
+    markusjx::stacktrace::flight_recorder_options options;
+    options.slots = 4;
+
+    {
+        markusjx::stacktrace::flight_recorder recorder("stacktrace_flight.bin", options);
+        for (uint32_t i = 0; i < 6; i++) {
+            record_event(recorder, i);
+        }
+    }
+
+    // Only the last 4 records are kept
+    std::vector<markusjx::stacktrace::flight_record> records =
+            markusjx::stacktrace::flight_recorder::read("stacktrace_flight.bin");
+    std::remove("stacktrace_flight.bin");
+
+    if (records.size() != 4) throw std::runtime_error("The flight recorder did not keep the last 4 records");
+    for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].tag != i + 2) throw std::runtime_error("The flight records are not the last ones in order");
+    }
+
+    std::cout << "Read " << records.size() << " flight records, the last one with tag " << records.back().tag
+              << ':' << std::endl << records.back().trace.toString(false, 0, 2) << std::endl;
+}
+
+void test::test_symbolizer() {
+    markusjx::stacktrace::symbolizer_server server("stacktrace_symbolizer.sock");
+    server.start();
+
+    struct stat st{};
+    if (stat(server.getPath().c_str(), &st) != 0 || (st.st_mode & 0777) != 0600) {
+        throw std::runtime_error("Other users may connect to the symbolizer socket");
+    }
+
+    void *buffer[16];
+    const std::vector<void *> addresses(buffer, buffer + markusjx::stacktrace::stacktrace::capture(buffer, 16));
+
+    markusjx::stacktrace::stacktrace::clearCache();
+    const std::string local = markusjx::stacktrace::stacktrace(addresses).toString();
+
+    // Resolve the same addresses using the daemon, which runs in this process here
+    markusjx::stacktrace::stacktrace::clearCache();
+    markusjx::stacktrace::stacktrace::setSymbolizer(server.getPath());
+    const markusjx::stacktrace::stacktrace remote(addresses);
+    const bool same = remote.toString() == local;
+    markusjx::stacktrace::stacktrace::setSymbolizer("");
+    server.stop();
+
+    std::cout << "Resolved " << addresses.size() << " frames using " << server.requests()
+              << " symbolizer requests, " << (same ? "equal to" : "different from") << " resolving them locally:"
+              << std::endl << remote.toString(false, 0, 2) << std::endl;
+
+    // All frames of the trace are sent to the daemon at once
+    if (server.requests() != 1) throw std::runtime_error("The frames were not resolved in a single request");
+}
+
+static void sleeping_child() {
+    for (;;) {
+        pause();
+    }
+}
+
+void test::test_process_dump() {
+    const pid_t child = fork();
+    if (child == 0) {
+        sleeping_child();
+    }
+
+    // Let the child start sleeping first
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    try {
+        const markusjx::stacktrace::process_dump dump(child);
+        std::cout << "Dumped " << dump.size() << " threads of process " << dump.getPid() << " in "
+                  << dump.getDuration() / 1000 << "us, it was stopped for " << dump.getPause() / 1000 << "us:"
+                  << std::endl << dump.getThreads().front().trace.toString(false, 0, 4) << std::endl;
+    } catch (const std::exception &e) {
+        std::cout << "Could not dump process " << child << ": " << e.what() << std::endl;
+    }
+
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+}
+
+// Allocations are only passed to the profiler here, if malloc and free are not replaced
+static void *allocate_tracked(size_t size) {
+    void *ptr = malloc(size);
+#ifndef STACKTRACE_INTERPOSE_MALLOC
+    markusjx::stacktrace::allocation_profiler::onAllocation(ptr, size);
+#endif //STACKTRACE_INTERPOSE_MALLOC
+    return ptr;
+}
+
+static void free_tracked(void *ptr) {
+#ifndef STACKTRACE_INTERPOSE_MALLOC
+    markusjx::stacktrace::allocation_profiler::onFree(ptr);
+#endif //STACKTRACE_INTERPOSE_MALLOC
+    free(ptr);
+}
+
+void test::test_allocations() {
+    markusjx::stacktrace::allocation_options options;
+    options.sampleInterval = 4096;
+
+    markusjx::stacktrace::allocation_profiler profiler(options);
+    profiler.start();
+
+    std::vector<void *> allocations;
+    for (int i = 0; i < 1000; i++) {
+        allocations.push_back(allocate_tracked(1024));
+    }
+
+    // Free every second allocation
+    for (size_t i = 0; i < allocations.size(); i += 2) {
+        free_tracked(allocations[i]);
+    }
+
+    for (const markusjx::stacktrace::allocation_stats &s : profiler.top(1)) {
+        std::cout << "About " << s.liveBytes / 1024 << "KB of " << s.totalBytes / 1024 << "KB allocated are alive:"
+                  << std::endl << s.trace.toString(false, 0, 2) << std::endl;
+    }
+
+    profiler.stop();
+    for (size_t i = 1; i < allocations.size(); i += 2) {
+        free_tracked(allocations[i]);
+    }
+}
+#endif
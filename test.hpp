@@ -5,6 +5,44 @@ void test_1();
 
 namespace test {
     void test_2();
+
+    void test_partial(int depth);
+
+    void test_symbolize();
+
+    void test_format();
+
+    void test_serialize();
+
+    void test_copy();
+
+    void test_hash();
+
+    void test_stack_table();
+
+    void test_aggregate();
+
+    void test_call_tree();
+
+    void test_exception();
+
+    void test_contention();
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+    void test_profiler();
+
+    void test_watchdog();
+
+    void test_thread_dump();
+
+    void test_flight_recorder();
+
+    void test_symbolizer();
+
+    void test_process_dump();
+
+    void test_allocations();
+#endif
 }
 
 #endif //STACKTRACE_TEST_HPP
@@ -0,0 +1,37 @@
+#ifndef STACKTRACE_TOOLS_HPP
+#define STACKTRACE_TOOLS_HPP
+
+#include "stacktrace.hpp"
+#include <cstring>
+#include <utility>
+
+namespace tools {
+    /**
+     * Parse a resolve level
+     *
+     * @param name the name of the level
+     * @param level set to the parsed level
+     * @return true, if the level is valid
+     */
+    inline bool parseLevel(const char *name, markusjx::stacktrace::resolve_level &level) {
+        using markusjx::stacktrace::resolve_level;
+        static const std::pair<const char *, resolve_level> levels[] = {
+                {"raw",           resolve_level::raw},
+                {"module_offset", resolve_level::module_offset},
+                {"function",      resolve_level::function},
+                {"function_line", resolve_level::function_line},
+                {"full",          resolve_level::full}
+        };
+
+        for (const auto &p : levels) {
+            if (strcmp(p.first, name) == 0) {
+                level = p.second;
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
+
+#endif //STACKTRACE_TOOLS_HPP